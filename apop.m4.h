@@ -66,6 +66,9 @@ typedef struct{
 	char ** text;
 	int colct, rowct, textct;
     unsigned long *colhash, *rowhash, *texthash;
+    int colcap, rowcap, textcap; //allocated length of each list; see apop_name_add.
+    struct apop_name_index *colindex, *rowindex, *textindex; //lookup tables for long lists; see apop_name_find.
+    int *shared; //If not NULL, the count of name structs holding these lists; see apop_data_share.
 } apop_name;
 
 /** The \ref apop_data structure represents a data set. See \ref dataoverview.*/
@@ -78,6 +81,8 @@ typedef struct apop_data{
     gsl_vector  *weights;
     struct apop_data   *more;
     char        error;
+    struct apop_text_arena *textarena; //If not NULL, where the text is stored; see apop_text_set.
+    struct apop_data_shares *shared; //If not NULL, the count of the sets holding the text shared with this one; see apop_data_share.
 } apop_data;
 
 /* Settings groups. For internal use only; see apop_settings.c and 
@@ -114,6 +119,27 @@ struct apop_model{
     char error;
 };
 
+/** Settings for loading many rows into the database at once. They apply to \ref
+apop_text_to_db and \ref apop_data_to_db (and so <tt>apop_data_print(..., .output_type='d')</tt>)
+via \ref apop_opts_type "apop_opts.db_load", or to one call of \ref apop_text_to_db via
+its \c load argument. Under the all-zero default, \ref apop_text_to_db loads each row in
+its own autocommitted transaction, as always, and \ref apop_data_to_db puts all of its rows
+in one transaction (or in the one the user already has open).
+
+\code
+apop_opts.db_load = (apop_db_load_type){.rows_per_commit=10000, .synchronous="off"};
+apop_text_to_db("survey.csv", "survey",
+        .load=&(apop_db_load_type){.rows_per_commit=10000, .indexes=(char*[]){"age, sex", NULL}});
+\endcode
+*/
+typedef struct{
+    int rows_per_commit; /**< If positive, insert the rows inside transactions of this many rows each. If a transaction is already open, the rows go into it and it is left open. If the load fails partway, the batch in progress is rolled back, but the batches already committed stay in the table. */
+    char *journal_mode;  /**< If not \c NULL, the SQLite <tt>journal_mode</tt> pragma during the load, such as <tt>"memory"</tt> or <tt>"off"</tt>. The prior setting is restored afterward. Not changed if a transaction is already open. */
+    char *synchronous;   /**< If not \c NULL, the SQLite <tt>synchronous</tt> pragma during the load, such as <tt>"off"</tt>. The prior setting is restored afterward. Not changed if a transaction is already open. */
+    int cache_size;      /**< If nonzero, the SQLite <tt>cache_size</tt> pragma during the load (positive: pages; negative: kibibytes). The prior setting is restored afterward. Not changed if a transaction is already open. */
+    char **indexes;      /**< A \c NULL-terminated list of indexes to build once the rows are in, each a comma-separated list of columns, like <tt>(char*[]){"age", "age, sex", NULL}</tt>. Building an index once is faster than keeping it up to date through the load. */
+} apop_db_load_type;
+
 /** The global options. */
 typedef struct{
     int verbose; /**< Set this to zero for silent mode, one for errors and warnings. default = 0. */
@@ -126,6 +152,8 @@ typedef struct{
     char db_engine; /**< If this is 'm', use mySQL, else use SQLite. */
     char db_user[101]; /**< Username for database login. Max 100 chars.  */
     char db_pass[101]; /**< Password for database login. Max 100 chars.  */
+    char text_arena; /**< If \c 'y', the data sets returned by \ref apop_query_to_text and \ref apop_query_to_mixed_data keep their text in a few large blocks, which is much faster to allocate and free, but means that you can't \c free a cell yourself; see \ref apop_text_set. Default: \c 'n', one malloced string per cell. */
+    apop_db_load_type db_load; /**< Transactions, pragmas, and indexes for loading data into the database; see \ref apop_db_load_type. Default: all zero, meaning autocommit. */
     FILE *log_file;  /**< The file handle for the log. Defaults to \c stderr, but change it with, e.g.,
                            <tt>apop_opts.log_file = fopen("outlog", "w");</tt> */
 
@@ -190,6 +218,8 @@ Apop_var_declare( apop_data * apop_data_calloc(const size_t size1, const size_t
 Apop_var_declare( apop_data * apop_data_stack(apop_data *m1, apop_data * m2, char posn, char inplace) )
 apop_data ** apop_data_split(apop_data *in, int splitpoint, char r_or_c);
 apop_data * apop_data_copy(const apop_data *in);
+apop_data * apop_data_share(apop_data *in);
+apop_data * apop_data_make_writable(apop_data *d);
 void        apop_data_rm_columns(apop_data *d, int *drop);
 void apop_data_memcpy(apop_data *out, const apop_data *in);
 Apop_var_declare( double * apop_data_ptr(apop_data *data, int row, int col, const char *rowname, const char *colname, const char *page) )
@@ -202,6 +232,10 @@ void apop_text_free(char ***freeme, int rows, int cols);
 Apop_var_declare( apop_data * apop_data_transpose(apop_data *in, char transpose_text, char inplace) )
 gsl_matrix * apop_matrix_realloc(gsl_matrix *m, size_t newheight, size_t newwidth);
 gsl_vector * apop_vector_realloc(gsl_vector *v, size_t newheight);
+gsl_matrix * apop_matrix_reserve(gsl_matrix *m, size_t rows);
+gsl_vector * apop_vector_reserve(gsl_vector *v, size_t size);
+apop_data * apop_data_reserve(apop_data *d, size_t rows);
+apop_data * apop_data_shrink_to_fit(apop_data *d);
 
 #define apop_data_prune_columns(in, ...) apop_data_prune_columns_base((in), (char *[]) {__VA_ARGS__, NULL})
 apop_data* apop_data_prune_columns_base(apop_data *d, char **colnames);
@@ -224,7 +258,7 @@ Apop_var_declare( gsl_matrix * apop_vector_to_matrix(const gsl_vector *in, char
 
 //From matrix
 gsl_matrix *apop_matrix_copy(const gsl_matrix *in);
-Apop_var_declare( apop_data *apop_db_to_crosstab(char const*tabname, char const*row, char const*col, char const*data, char is_aggregate) )
+Apop_var_declare( apop_data *apop_db_to_crosstab(char const*tabname, char const*row, char const*col, char const*data, char is_aggregate, char sparse) )
 
 //From array
 Apop_var_declare( gsl_vector * apop_array_to_vector(double *in, int size) )
@@ -235,7 +269,11 @@ Apop_var_declare( gsl_vector * apop_array_to_vector(double *in, int size) )
 
 //From text
 Apop_var_declare( apop_data * apop_text_to_data(char const *text_file, int has_row_names, int has_col_names, int const *field_ends, char const *delimiters) )
-Apop_var_declare( int apop_text_to_db(char const *text_file, char *tabname, int has_row_names, int has_col_names, char **field_names, int const *field_ends, apop_data *field_params, char *table_params, char const *delimiters, char if_table_exists) )
+Apop_var_declare( int apop_text_to_db(char const *text_file, char *tabname, int has_row_names, int has_col_names, char **field_names, int const *field_ends, apop_data *field_params, char *table_params, char const *delimiters, char if_table_exists, apop_db_load_type const *load) )
+typedef struct apop_text_stream apop_text_stream;
+Apop_var_declare( apop_text_stream * apop_text_stream_open(char const *text_file, int has_row_names, int has_col_names, int const *field_ends, char const *delimiters) )
+apop_data *apop_text_stream_next(apop_text_stream *stream, size_t max_rows);
+void apop_text_stream_close(apop_text_stream *stream);
 
 //rank data
 apop_data *apop_data_rank_expand (apop_data *in);
@@ -879,6 +917,7 @@ The view is automatically allocated, and disappears as soon as the program leave
         .textsize[0]=(d)->textsize[0]> (rownum)+(len)-1 ? (len) : 0,                                   \
         .textsize[1]=(d)->textsize[1],                                           \
         .text = (d)->text ? &((d)->text[rownum]) : NULL,                         \
+        .textarena = (d)->textarena,                                             \
         })
 
 
@@ -997,6 +1036,10 @@ Apop_var_declare( int apop_table_exists(char const *name, char remove) )
 
 int apop_db_open(char const *filename);
 Apop_var_declare( int apop_db_close(char vacuum) )
+typedef struct apop_db_handle apop_db_handle;
+apop_db_handle *apop_db_handle_open(char const *filename);
+apop_db_handle *apop_db_use(apop_db_handle *handle);
+void apop_db_handle_close(apop_db_handle *handle);
 
 int apop_query(const char *q, ...) __attribute__ ((format (printf,1,2)));
 apop_data * apop_query_to_text(const char * fmt, ...) __attribute__ ((format (printf,1,2)));
@@ -1004,8 +1047,16 @@ apop_data * apop_query_to_data(const char * fmt, ...) __attribute__ ((format (pr
 apop_data * apop_query_to_mixed_data(const char *typelist, const char * fmt, ...) __attribute__ ((format (printf,2,3)));
 gsl_vector * apop_query_to_vector(const char * fmt, ...) __attribute__ ((format (printf,1,2)));
 double apop_query_to_float(const char * fmt, ...) __attribute__ ((format (printf,1,2)));
+Apop_var_declare( int apop_query_bind(char const *query, double const *values, apop_data const *data, int row) )
+Apop_var_declare( apop_data * apop_query_to_data_bind(char const *query, double const *values, apop_data const *data, int row) )
+
+typedef struct apop_query_cursor apop_query_cursor;
+apop_query_cursor *apop_query_cursor_open(const char * fmt, ...) __attribute__ ((format (printf,1,2)));
+apop_data *apop_query_cursor_next(apop_query_cursor *cursor, size_t max_rows);
+void apop_query_cursor_close(apop_query_cursor *cursor);
 
 int apop_data_to_db(const apop_data *set, const char *tabname, char);
+int apop_data_register_vtab(apop_data const *d, char const *tabname);
 
 
         //////Settings groups
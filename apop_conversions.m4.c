@@ -5,6 +5,29 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <libgen.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #define Use_mmap 1
+#endif
+#ifdef _OPENMP
+    #include <omp.h>
+    #include <sched.h>
+#endif
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    #include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+    #include <zstd.h>
+#endif
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
 
 /*extend a string. this prevents a minor leak you'd get if you did
  asprintf(&q, "%s is a teapot.", q);
@@ -73,14 +96,38 @@ APOP_VAR_ENDHEAD
     return out;
 }
 
-static int find_cat_index(char **d, char * r, int start_from, int size){
-//used for apop_db_to_crosstab.
-    int i = start_from % size;	//i is probably the same or i+1.
-	do {
-		if(!strcmp(d[i], r)) return i;
-		i++;
-		i %= size;	//loop around as necessary.
-	} while (i!=start_from); 
+/* For apop_db_to_crosstab: an open-addressed hash table from category names to their
+   places in the list of names, so each line of the query output finds its cell in
+   constant time however many categories there are. */
+typedef struct {
+    char **names;
+    int *slots; //-1 for empty, else an index into names.
+    size_t mask;
+} cat_index_t;
+
+static unsigned long cat_hash(char const *s){
+    unsigned long hash = 5381;
+    for (int c; (c = *s++); ) hash = ((hash << 5) + hash) + c;
+    return hash;
+}
+
+static int cat_index_alloc(cat_index_t *ix, char **names, size_t n){
+    size_t size = 16;
+    while (size < 2*n) size *= 2;
+    *ix = (cat_index_t){.names=names, .slots=malloc(size*sizeof(int)), .mask=size-1};
+    Apop_stopif(!ix->slots, return 1, 0, "malloc failed. Probably out of memory.");
+    for (size_t i=0; i < size; i++) ix->slots[i] = -1;
+    for (size_t k=0; k < n; k++){
+        size_t i = cat_hash(names[k]) & ix->mask;
+        while (ix->slots[i] != -1) i = (i+1) & ix->mask;
+        ix->slots[i] = k;
+    }
+    return 0;
+}
+
+static int find_cat_index(cat_index_t const *ix, char const *r){
+    for (size_t i = cat_hash(r) & ix->mask; ix->slots[i] != -1; i = (i+1) & ix->mask)
+        if (!strcmp(ix->names[ix->slots[i]], r)) return ix->slots[i];
     Apop_assert_c(0, -2, 0, "Something went wrong in the crosstabbing; couldn't find %s.", r);
 }
 
@@ -95,6 +142,11 @@ indexed by 'row' and cols by 'col' and the cells filled with the entry in the 'd
 \param is_aggregate Set to \c 'y' if the \c data is a function like <tt>count(*)</tt>
     or <tt>sum(col)</tt>. That is, set to \c 'y' if querying this would require a <tt>group
     by</tt> clause. (default: if I find an end-paren in \c datacol, \c 'y'; else \c 'n'.)
+\param sparse If \c 'y', skip the grid and return one row per cell the query
+    produces, PMF-style: the row and column categories in the two text columns (named
+    after \c row and \c col) and the data in the weights. For a table with thousands of
+    categories on each side and most cells empty, this is far smaller, and you can send
+    it straight to <tt>apop_estimate(out, apop_pmf)</tt>. (default: \c 'n')
 
 \li  If the query to get data to fill the table (select row, col, data from
     tabname) returns an empty data set, then I will return a \c NULL data set and if
@@ -104,11 +156,12 @@ indexed by 'row' and cols by 'col' and the cells filled with the entry in the 'd
 \exception out->error='q' Query returned an empty table (which might mean that it just failed).
 
 \li The simplest use is to get a tally of how often (r1, r2) appears in the data via <tt>apop_db_to_crosstab("datatab", "r1", "r2")</tt>.
+\li Cells the query does not produce are zero in the grid, and absent from the sparse form.
 \li If you want a 1-D crosstab, omit the other dimension. Or omit both to get a grand tally of your statistic for the entire table.
 \li There is a commnad-line tool, <tt>apop_db_to_crosstab</tt> that calls this function.
 \li This function uses the \ref designated syntax for inputs.
 */
-APOP_VAR_HEAD apop_data *apop_db_to_crosstab(char const*tabname, char const*row, char const* col, char const*data, char is_aggregate){
+APOP_VAR_HEAD apop_data *apop_db_to_crosstab(char const*tabname, char const*row, char const* col, char const*data, char is_aggregate, char sparse){
     char const* apop_varad_var(tabname, NULL);
     Apop_stopif(!tabname, return NULL, 1, "Missing tabname. Returning NULL.");
     char const* apop_varad_var(row, "1");
@@ -117,10 +170,12 @@ APOP_VAR_HEAD apop_data *apop_db_to_crosstab(char const*tabname, char const*row,
     //This '(' balances the end-paren below, keeping m4 from losing the thread.
     //Note the transitional check for "group by", which we should one day remove.
     char apop_varad_var(is_aggregate, (strchr(data, ')') && !strstr(data, "group by"))?'y':'n');
+    char apop_varad_var(sparse, 'n');
 APOP_VAR_ENDHEAD
     gsl_matrix *out=NULL;
-    int	i, j=0;
+    int	i, j;
     apop_data *pre_d1=NULL, *pre_d2=NULL, *datachars=NULL;
+    cat_index_t rows = {}, cols = {};
     apop_data *outdata = apop_data_alloc();
 
     char* p = apop_opts.db_name_column;
@@ -133,8 +188,27 @@ APOP_VAR_ENDHEAD
                                     is_aggregate!='n' ? "," : "",
                                     is_aggregate!='n' ? col : "");
     datachars = apop_query_to_text("%s", Q);
-    Apop_stopif(!datachars, free(Q); return NULL, 2, "[%s] returned an empty table.", Q);
-    Apop_stopif(datachars->error, free(Q); goto bailout, 0, "error from [%s].", Q);
+    Apop_stopif(!datachars, free(Q); apop_data_free(outdata); apop_opts.db_name_column = p; return NULL,
+                                            2, "[%s] returned an empty table.", Q);
+    Apop_stopif(datachars->error, outdata->error='q'; goto bailout, 0, "error from [%s].", Q);
+
+    if (sparse=='y'){ //hand over the category columns as they are, and the data as weights.
+        size_t n = *datachars->textsize;
+        outdata->weights = gsl_vector_alloc(n);
+        for (size_t k=0; k< n; k++)
+            gsl_vector_set(outdata->weights, k, atof(datachars->text[k][2]));
+        apop_text_alloc(datachars, n, 2);
+        outdata->text = datachars->text;
+        outdata->textsize[0] = n;
+        outdata->textsize[1] = 2;
+        outdata->textarena = datachars->textarena;
+        datachars->text = NULL;
+        datachars->textsize[0] = datachars->textsize[1] = 0;
+        datachars->textarena = NULL;
+        apop_name_add(outdata->names, row, 't');
+        apop_name_add(outdata->names, col, 't');
+        goto bailout;
+    }
 
     //A bit inefficient, but well-encapsulated.
     //Pull the distinct (sorted) list of headers, copy into outdata->names.
@@ -148,15 +222,21 @@ APOP_VAR_ENDHEAD
     for (i=0; i < pre_d2->textsize[0]; i++)
         apop_name_add(outdata->names, pre_d2->text[i][0], 'c');
 
+    Apop_stopif(cat_index_alloc(&rows, outdata->names->row, outdata->names->rowct)
+                || cat_index_alloc(&cols, outdata->names->col, outdata->names->colct),
+                outdata->error='a'; goto bailout, 0, "Couldn't index the categories.");
 	out	= gsl_matrix_calloc(pre_d1->textsize[0], pre_d2->textsize[0]);
 	for (size_t k =0; k< datachars->textsize[0]; k++){
-		i = find_cat_index(outdata->names->row, datachars->text[k][0], i, pre_d1->textsize[0]);
-		j = find_cat_index(outdata->names->col, datachars->text[k][1], j, pre_d2->textsize[0]);
+		i = find_cat_index(&rows, datachars->text[k][0]);
+		j = find_cat_index(&cols, datachars->text[k][1]);
         Apop_stopif(i==-2 || j == -2, outdata->error='n'; goto bailout, 0, "Something went wrong in the crosstabbing; "
                                                  "couldn't find %s or %s.", datachars->text[k][0], datachars->text[k][1]);
 		gsl_matrix_set(out, i, j, atof(datachars->text[k][2]));
 	}
     bailout:
+    free(Q);
+    free(rows.slots);
+    free(cols.slots);
     apop_data_free(pre_d1);
     apop_data_free(pre_d2);
     apop_data_free(datachars);
@@ -195,8 +275,8 @@ void apop_crosstab_to_db(apop_data *in,  char *tabname, char *row_col_name,
     char *colname, *rowname;
     Get_vmsizes(in); //msize1, msize2
     int maxcol= GSL_MAX(msize2, in->textsize[1]);
-    char sparerow[msize1 > 0 ? (int)log10(msize1)+1 : 0];
-    char sparecol[maxcol > 0 ? (int)log10(maxcol)+1 : 0];
+    char sparerow[msize1 > 0 ? (int)log10(msize1)+3 : 1]; //'r', the digits, '\0'.
+    char sparecol[maxcol > 0 ? (int)log10(maxcol)+3 : 1];
 #define DbType apop_opts.db_engine=='m' ? "text" : "character"
 #define DbType2 apop_opts.db_engine=='m' ? "double" : "numeric"
 	apop_query("CREATE TABLE %s (%s %s, %s %s, %s %s)", tabname, 
@@ -393,11 +473,18 @@ SQLite stores these NaN-type values internally as \c NULL; that means that funct
 \ref apop_query_to_data will convert both your \c nan_string string and \c NULL to \c NaN.
 
   \li The system uses the standards for C's \c atof() function for
-floating-point numbers: INFINITY, -INFINITY, and NaN work as expected.
+floating-point numbers: INFINITY, -INFINITY, and NaN work as expected. The decimal point is
+always a period, whatever the locale. (On a system without \c strtod_l, this holds only
+for plain decimal numbers of up to 19 significant digits; hex floats and longer numbers
+go to \c strtod and use the locale's decimal point.)
   \li If there are row names and column names, then the input will not be perfectly square:
 there should be no first entry in the sequence of column names like <tt>row names</tt>. That is,
 for a 100x100 data set with row and column names, there are 100 names in the top row,
 and 101 entries in each subsequent row (name plus 100 data points).
+  \li If the file is compressed via gzip or zstd, it is decompressed as it is read. The
+format is detected from the first bytes of the file, not the file name, so this works for
+compressed data sent to stdin as well. Reading gzip files requires that Apophenia was
+compiled with zlib, and zstd files, libzstd.
   \li White space before or after a field is ignored. So <tt>1, 2,3, 4 , 5, " six ",7 </tt>
 is eqivalent to <tt>1,2,3,4,5," six ",7</tt>.
   \li NUL characters (<tt>'\0'</tt>) are treated as white space, so if your fields have NULs as padding, you should have no problem. NULs inside of a string terminates the string as it always does in C.
@@ -409,16 +496,11 @@ NUMLEOL
 \endcode
 and <tt>.field_ends=(int[]){3, 5, 7}</tt>, we have three columns, named NUM, LE,
 and OL. The names can be read from the first row by setting <tt>.has_row_names='y'</tt>.
+If lines run past the last field end, the remainder of each line is read as one more
+field; in that case, end the list with a zero, like <tt>.field_ends=(int[]){3, 5, 0}</tt>,
+so that the reader knows where the list stops.
 */
 
-static int prep_text_reading(char const *text_file, FILE **infile){
-    *infile = !strcmp(text_file, "-")
-                    ? stdin
-	                : fopen(text_file, "r");
-    Apop_assert_c(*infile, 1,  0, "Trouble opening %s. Returning NULL.", text_file);
-    return 0;
-}
-
 /////New text file reading
 /** \cond doxy_ignore */
 extern char *apop_nul_string;
@@ -429,95 +511,449 @@ extern char *apop_nul_string;
                 : (((len) > 0) ? malloc(len) : apop_nul_string);
 
 typedef struct {int ct; int eof;} line_parse_t;
+
+typedef struct text_decoder_t text_decoder_t;
+
+/* The readers pull characters from either a FILE via a block buffer, or from a block of
+   memory (infile==NULL) that has already been read in or mapped. If dec is set, the
+   blocks come from dec, which decompresses the FILE. */
+typedef struct {
+    FILE *infile;
+    text_decoder_t *dec;
+    char *buffer;
+    size_t ptr, len;
+    //The allocated length of each field string in the last line parsed into owner,
+    //so the next line can reuse them as they are.
+    apop_data const *owner;
+    size_t *field_caps;
+    int field_capct;
+} text_source_t;
 /** \endcond */
 
-static line_parse_t parse_a_fixed_line(FILE *infile, apop_data *fn, int const *field_ends){
-    int c = fgetc(infile);
-    int ct = 0, posn=0, thisflen=0, needfield=1;
-    while(c!='\n' && c !=EOF){
-        posn++;
-        if (needfield){//start a new field
-            if (++ct > fn->textsize[0])
-                apop_text_alloc(fn, ct, 1);//realloc text portion.
-            thisflen = 
-            needfield = 0;
+static const size_t bs=1e5;
+
+#ifdef _OPENMP
+static int get_shared(int *x){
+    int out;
+    #pragma omp atomic read
+    out = *x;
+    #pragma omp flush
+    return out;
+}
+
+static void set_shared(int *x, int val){
+    #pragma omp flush
+    #pragma omp atomic write
+    *x = val;
+}
+#endif
+
+/** \cond doxy_ignore */
+/* Compressed input is decompressed a block at a time as the parser asks for more text.
+   The raw input is read into in; type is 'g' for gzip, 'z' for zstd, or 'p' for plain
+   text from a pipe, whose first bytes were read to check for a compression header and so
+   are handed over from in before the rest of the pipe. Once a compressed stream ends
+   cleanly, type is 'e'.
+
+   Given a second thread, the decoder can also run ahead of the parser: the helper
+   thread runs decoder_read_ahead to fill the blocks of the ring in turn, and the parser
+   copies them out in the same order. */
+struct text_decoder_t {
+    FILE *infile;
+    char type, error;
+    unsigned char *in;
+    size_t in_ptr, in_len;
+    bool in_eof, out_eof;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    z_stream gz;
+    bool gz_open;
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+    ZSTD_DStream *zs;
+#endif
+    struct {char *data; size_t len; int full;} *ring;
+    int ring_ct, next, quit;
+};
+/** \endcond */
+
+//Make sure there is raw input to decompress, unless we're at the end of the file.
+static bool decoder_has_input(text_decoder_t *dec){
+    if (dec->in_ptr < dec->in_len) return true;
+    if (dec->in_eof) return false;
+    dec->in_len = fread(dec->in, 1, bs, dec->infile);
+    dec->in_ptr = 0;
+    dec->in_eof = !dec->in_len;
+    return dec->in_len;
+}
+
+//Decompress up to max bytes into out. Returns the number of bytes written; zero at the end of the input or on error.
+static size_t decode_block(text_decoder_t *dec, char *out, size_t max){
+    size_t len = 0;
+    while (!len && !dec->out_eof){
+        if (!decoder_has_input(dec)){
+            Apop_stopif(dec->type != 'p' && dec->type != 'e', dec->error='t', 0,
+                    "The compressed input ends mid-stream; it may be truncated.");
+            dec->out_eof = true;
+            break;
         }
+        if (dec->type == 'p'){
+            len = GSL_MIN(max, dec->in_len - dec->in_ptr);
+            memcpy(out, dec->in + dec->in_ptr, len);
+            dec->in_ptr += len;
+        }
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+        else if (dec->type == 'g'){
+            dec->gz.next_in = dec->in + dec->in_ptr;
+            dec->gz.avail_in = dec->in_len - dec->in_ptr;
+            dec->gz.next_out = (unsigned char*)out;
+            dec->gz.avail_out = max;
+            int status = inflate(&dec->gz, Z_NO_FLUSH);
+            dec->in_ptr = dec->in_len - dec->gz.avail_in;
+            len = max - dec->gz.avail_out;
+            Apop_stopif(status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR,
+                    dec->error='t'; dec->out_eof=true; break, 0,
+                    "gzip decompression failed: %s", dec->gz.msg ? dec->gz.msg : "unknown error");
+            if (status == Z_STREAM_END){ //A file may be several gzip streams end to end.
+                if (decoder_has_input(dec)) inflateReset(&dec->gz);
+                else dec->type = 'e';
+            }
+        }
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+        else if (dec->type == 'z'){
+            ZSTD_inBuffer in = {.src=dec->in, .size=dec->in_len, .pos=dec->in_ptr};
+            ZSTD_outBuffer o = {.dst=out, .size=max};
+            size_t status = ZSTD_decompressStream(dec->zs, &o, &in);
+            Apop_stopif(ZSTD_isError(status), dec->error='t'; dec->out_eof=true; break, 0,
+                    "zstd decompression failed: %s", ZSTD_getErrorName(status));
+            dec->in_ptr = in.pos;
+            len = o.pos;
+            if (!status && !decoder_has_input(dec)) dec->type = 'e'; //frame done, no more input.
+        }
+#endif
+    }
+    return len;
+}
 
-        //extend field:
-        thisflen++;
-        Textrealloc(*fn->text[ct-1], thisflen);
-        fn->text[ct-1][0][thisflen-1] = c;
-
-        if (posn==*field_ends){ //close off this field.
-            Textrealloc(*fn->text[ct-1], thisflen+1);
-            fn->text[ct-1][0][thisflen] = '\0';
-            thisflen = 0;
-            field_ends++;
-            needfield=1;
-        } 
-        c = fgetc(infile);
+#ifdef _OPENMP
+static const int decoder_ring_size = 4;
+
+//The helper thread's side of a read-ahead: fill the ring with blocks until the end of
+//the input, or until the parser sets dec->quit.
+static void decoder_read_ahead(text_decoder_t *dec){
+    for (int i=0; ; i = (i+1) % dec->ring_ct){
+        while (get_shared(&dec->ring[i].full))
+            if (get_shared(&dec->quit)) return;
+            else sched_yield();
+        dec->ring[i].len = decode_block(dec, dec->ring[i].data, bs);
+        set_shared(&dec->ring[i].full, 1);
+        if (!dec->ring[i].len) return;
+    }
+}
+
+/* Set up the decoder to decompress ahead of the parser. The caller has to run
+   decoder_read_ahead on another thread, and set dec->quit when it is done reading. */
+static void decoder_start_read_ahead(text_decoder_t *dec){
+    dec->ring_ct = decoder_ring_size;
+    dec->ring = calloc(dec->ring_ct, sizeof(*dec->ring));
+    dec->ring[0].data = malloc(bs * dec->ring_ct);
+    for (int i=1; i< dec->ring_ct; i++) dec->ring[i].data = dec->ring[0].data + i*bs;
+}
+#endif
+
+//Undo decoder_start_read_ahead, if it turns out there is no thread to run decoder_read_ahead.
+static void decoder_stop_read_ahead(text_decoder_t *dec){
+    if (dec->ring) free(dec->ring[0].data);
+    free(dec->ring);
+    dec->ring = NULL;
+}
+
+//The parser's side: fill out with the next block of text.
+static size_t decoder_read(text_decoder_t *dec, char *out){
+#ifdef _OPENMP
+    if (dec->ring){
+        if (dec->next < 0) return 0; //the helper already hit the end.
+        while (!get_shared(&dec->ring[dec->next].full)) sched_yield();
+        size_t len = dec->ring[dec->next].len;
+        memcpy(out, dec->ring[dec->next].data, len);
+        set_shared(&dec->ring[dec->next].full, 0);
+        dec->next = len ? (dec->next+1) % dec->ring_ct : -1;
+        return len;
     }
-    if (needfield==0){//user didn't give last field end.
-        Textrealloc(*fn->text[ct-1], thisflen+1);
-        fn->text[ct-1][0][thisflen] = '\0';
+#endif
+    return decode_block(dec, out, bs);
+}
+
+/* If the file begins with a gzip or zstd header, return a decoder for it. If it is
+   plain text, return NULL, and the caller reads it directly---unless it's a pipe, where
+   we can't put back the bytes we read to check, so return a pass-through decoder. Set
+   *failed if the file is compressed in a format this build can't read. */
+static text_decoder_t *open_decoder(FILE *infile, char const *text_file, int *failed){
+    unsigned char magic[4];
+    long posn = ftell(infile);
+    size_t n = fread(magic, 1, 4, infile);
+    char type = (n >= 2 && magic[0]==0x1f && magic[1]==0x8b) ? 'g'
+              : (n == 4 && !memcmp(magic, (unsigned char[]){0x28, 0xb5, 0x2f, 0xfd}, 4)) ? 'z'
+              : 'p';
+    if (type == 'p' && posn >= 0 && !fseek(infile, posn, SEEK_SET)) return NULL;
+#if !defined(HAVE_ZLIB_H) || !defined(HAVE_LIBZ)
+    Apop_stopif(type == 'g', *failed=1; return NULL, 0, "%s is gzip-compressed, but Apophenia "
+                            "was compiled without zlib, so I can't read it.", text_file);
+#endif
+#if !defined(HAVE_ZSTD_H) || !defined(HAVE_LIBZSTD)
+    Apop_stopif(type == 'z', *failed=1; return NULL, 0, "%s is zstd-compressed, but Apophenia "
+                            "was compiled without libzstd, so I can't read it.", text_file);
+#endif
+    text_decoder_t *dec = malloc(sizeof(text_decoder_t));
+    *dec = (text_decoder_t){.infile=infile, .type=type, .in=malloc(bs), .in_len=n, .in_eof=!n};
+    memcpy(dec->in, magic, n);
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    if (type == 'g'){ //15+32: any window size, and a gzip or zlib header.
+        dec->gz_open = (inflateInit2(&dec->gz, 15+32) == Z_OK);
+        Apop_stopif(!dec->gz_open, *failed=1, 0, "Couldn't set up gzip decompression for %s.", text_file);
     }
-    return (line_parse_t) {.ct=ct, .eof= (c == EOF)};
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+    if (type == 'z'){
+        dec->zs = ZSTD_createDStream();
+        Apop_stopif(!dec->zs || ZSTD_isError(ZSTD_initDStream(dec->zs)), *failed=1,
+                0, "Couldn't set up zstd decompression for %s.", text_file);
+    }
+#endif
+    return dec;
+}
+
+static void close_decoder(text_decoder_t *dec){
+    if (!dec) return;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    if (dec->gz_open) inflateEnd(&dec->gz);
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+    ZSTD_freeDStream(dec->zs);
+#endif
+    decoder_stop_read_ahead(dec);
+    free(dec->in);
+    free(dec);
+}
+
+/* Open the file, or use stdin if text_file is "-", and set up a decoder if it's compressed. */
+static int prep_text_reading(char const *text_file, FILE **infile, text_decoder_t **dec){
+    *infile = !strcmp(text_file, "-")
+                    ? stdin
+	                : fopen(text_file, "r");
+    Apop_assert_c(*infile, 1,  0, "Trouble opening %s. Returning NULL.", text_file);
+    int failed = 0;
+    *dec = open_decoder(*infile, text_file, &failed);
+    if (failed){
+        close_decoder(*dec);
+        if (*infile != stdin) fclose(*infile);
+    }
+    return failed;
+}
+
+//Read the next block from the file or decoder into src's buffer.
+static size_t fill_buffer(text_source_t *src){
+    src->ptr = 0;
+    return src->len = src->dec ? decoder_read(src->dec, src->buffer)
+                               : fread(src->buffer, 1, bs, src->infile);
+}
+
+static int get_next(text_source_t *src){
+    if (src->ptr >= src->len){
+        if (!src->infile || !fill_buffer(src)) return EOF;
+    }
+    int r = src->buffer[src->ptr++];
+    return r == (char)-1 ? EOF : r;
+}
+
+//Make sure that field number ct-1 of fn can hold len characters plus the '\0'.
+//Capacities are kept in src, as for parse_a_line.
+static char *fixed_field_room(text_source_t *src, apop_data *fn, int ct, size_t len){
+    if (ct > src->field_capct){
+        src->field_caps = realloc(src->field_caps, sizeof(size_t)*ct);
+        for (int i=src->field_capct; i< ct; i++) src->field_caps[i] = 0;
+        src->field_capct = ct;
+    }
+    size_t cap = src->field_caps[ct-1];
+    if (len+1 > cap){
+        cap = GSL_MAX(cap*2, GSL_MAX(len+1, 16));
+        Textrealloc(*fn->text[ct-1], cap);
+        src->field_caps[ct-1] = cap;
+    }
+    return *fn->text[ct-1];
+}
+
+/* Cut the next line into fields at the given ends. Each stretch of the line in the
+   read buffer is copied into the fields with one memcpy per field, into strings that are
+   reused from line to line. Whatever follows the last field end (or a nonincreasing
+   entry in field_ends, like a terminating zero) is one last field. */
+static line_parse_t parse_a_fixed_line(text_source_t *src, apop_data *fn, int const *field_ends){
+    if (src->owner != fn){
+        src->owner = fn;
+        src->field_capct = 0;
+    }
+    int ct = 0, posn = 0, end = 0, infield = 0, eof = 0, eol = 0;
+    size_t flen = 0;
+    while (!eol){
+        if (src->ptr >= src->len){
+            if (src->infile) fill_buffer(src);
+            if (src->ptr >= src->len) {eof = 1; break;}
+        }
+        char *start = src->buffer + src->ptr;
+        size_t span = src->len - src->ptr;
+        char *stop = memchr(start, '\n', span);
+        char *ff = memchr(start, (char)-1, stop ? stop-start : span); //get_next reads this as EOF.
+        if (ff) stop = ff;
+        if (stop){
+            span = stop - start;
+            eol = 1;
+            eof = !!ff;
+        }
+        src->ptr += span + !!stop;
+        for (size_t i=0; i< span; ){
+            if (!infield){//start a new field
+                if (++ct > fn->textsize[0])
+                    apop_text_alloc(fn, ct, 1);//realloc text portion.
+                end = *field_ends > posn ? *field_ends : INT_MAX;
+                flen = 0;
+                infield = 1;
+            }
+            size_t take = GSL_MIN((size_t)(end - posn), span - i);
+            char *field = fixed_field_room(src, fn, ct, flen+take);
+            memcpy(field+flen, start+i, take);
+            flen += take;
+            posn += take;
+            i += take;
+            if (posn == end){ //close off this field.
+                field[flen] = '\0';
+                field_ends++;
+                infield = 0;
+            }
+        }
+    }
+    if (infield) //user didn't give last field end.
+        fn->text[ct-1][0][flen] = '\0';
+    return (line_parse_t) {.ct=ct, .eof=eof};
 }
 
 /** \cond doxy_ignore */
 typedef struct{
     char c, type;
 } apop_char_info;
-/** \endcond */
 
-static const size_t bs=1e5;
-static int get_next(char *buffer, size_t *ptr, FILE *infile){
-    int r;
-    if (*ptr>=bs){
-        size_t len=fread(buffer, 1, bs, infile);
-        if (len < bs) buffer[len]=(char)-1;
-        *ptr=0;
-    }
-    r = buffer[(*ptr)++];
-    return r == (char)-1 ? EOF : r;
-}
+//A list of bytes to stop at when skimming over plain text.
+typedef struct {
+    unsigned char list[40];
+    int ct;
+    bool is[256];
+    bool scalar;  //skip the SIMD loops in plain_run; see scalar_scan.
+} stop_set_t;
+
+/* The type of every byte given the delimiters, so parsing a character is a table lookup.
+   plain_stops are the bytes that aren't type 'r'; quoted_stops are the bytes that
+   aren't read as plain text inside quotation marks. */
+typedef struct {
+    char type[256];
+    stop_set_t plain_stops, quoted_stops;
+} char_classes_t;
+/** \endcond */
 
-static apop_char_info parse_next_char(char *buffer, size_t *ptr, FILE *f, char const *delimiters){
-    int c = get_next(buffer, ptr, f);
+static char classify(int c, char const *delimiters){
     int is_delimiter = !!strchr(delimiters, c);
-    return (apop_char_info){.c=c, 
-            .type = (c==' '||c=='\r' ||c=='\t' || c==0)? (is_delimiter ? 'W'  : 'w')
+    return (c==' '||c=='\r' ||c=='\t' || c==0)? (is_delimiter ? 'W'  : 'w')
                     :is_delimiter    ? 'd'
                     :(c == '\n')     ? 'n'
                     :(c == '"')      ? '"'
                     :(c == '\\')     ? '\\'
                     :(c == EOF)      ? 'E'
                     :(c == '#')      ? '#'
-                                     : 'r'
-            };
+                                     : 'r';
+}
+
+static void add_stop(stop_set_t *s, unsigned char c){
+    if (s->is[c]) return;
+    s->is[c] = true;
+    s->list[s->ct++] = c;
+}
+
+/* If the environment variable APOP_SCALAR_SCAN is set (and not "0"), plain_run checks
+   one byte at a time even where it could use SIMD compares, so the test suite can
+   check that the two give the same results. */
+static bool scalar_scan(void){
+    char const *e = getenv("APOP_SCALAR_SCAN");
+    return e && *e && strcmp(e, "0");
+}
+
+static void set_char_classes(char_classes_t *cc, char const *delimiters){
+    *cc = (char_classes_t){ };
+    cc->plain_stops.scalar = cc->quoted_stops.scalar = scalar_scan();
+    for (int b=0; b < 256; b++){
+        int c = (char)b;  //as get_next returns it.
+        cc->type[b] = classify(c == (char)-1 ? EOF : c, delimiters);
+        if (cc->type[b] != 'r') add_stop(&cc->plain_stops, b);
+        if (strchr("\"\\E", cc->type[b])) add_stop(&cc->quoted_stops, b);
+    }
+}
+
+/* Return the length of the run of bytes at the head of the block that aren't in the stop
+   set. Where available, check 32 or 16 bytes at a time with SIMD compares. */
+static size_t plain_run(char const *block, size_t len, stop_set_t const *stops){
+    size_t i = 0;
+#if defined(__AVX2__) && defined(__GNUC__)
+    for (; !stops->scalar && i+32 <= len; i += 32){
+        __m256i chunk = _mm256_loadu_si256((__m256i const *)(block+i));
+        __m256i hits = _mm256_setzero_si256();
+        for (int k=0; k < stops->ct; k++)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(stops->list[k])));
+        unsigned int mask = _mm256_movemask_epi8(hits);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__) && defined(__GNUC__)
+    for (; !stops->scalar && i+16 <= len; i += 16){
+        __m128i chunk = _mm_loadu_si128((__m128i const *)(block+i));
+        __m128i hits = _mm_setzero_si128();
+        for (int k=0; k < stops->ct; k++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(stops->list[k])));
+        unsigned int mask = _mm_movemask_epi8(hits);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < len; i++)
+        if (stops->is[(unsigned char)block[i]]) return i;
+    return len;
+}
+
+static apop_char_info parse_next_char(text_source_t *src, char_classes_t const *classes){
+    int c = get_next(src);
+    return (apop_char_info){.c=c, .type=classes->type[(unsigned char)c]};
 }
 
 //fills fn with a list of strings.
 //returns the count of elements. Negate the count if we're at EOF.
 //fn must already be allocated via apop_data_alloc() [no args].
-static line_parse_t parse_a_line(FILE *infile, char *buffer, size_t *ptr, apop_data *fn, int const *field_ends, char const *delimiters){
+static line_parse_t parse_a_line(text_source_t *src, apop_data *fn, int const *field_ends, char_classes_t const *classes){
     int ct=0, thisflen=0, inqq=0, infield=0, mlen=5,
             lastwhite=0, lastnonwhite=0; 
-    if (field_ends) return parse_a_fixed_line(infile, fn, field_ends);
+    if (field_ends) return parse_a_fixed_line(src, fn, field_ends);
+    if (src->owner != fn){
+        src->owner = fn;
+        src->field_capct = 0;
+    }
     apop_char_info ci;
     do {
-        ci = parse_next_char(buffer, ptr, infile, delimiters);
+        ci = parse_next_char(src, classes);
         //comments are to end of line, so they're basically a newline.
         if (ci.type=='#' && !inqq){
             for(int c='x'; (c!='\n' && c!=EOF); )
-                c = get_next(buffer, ptr, infile);
+                c = get_next(src);
             ci.type='n';
         }
 
         //The escape-type cases: \\ and "".
         //If one applies, set the type to regular
         if (ci.type=='\\'){
-            ci=parse_next_char(buffer, ptr, infile, delimiters);
+            ci=parse_next_char(src, classes);
             if (ci.type!='E')
                 ci.type='r';
         }
@@ -534,9 +970,17 @@ static line_parse_t parse_a_line(FILE *infile, char *buffer, size_t *ptr, apop_d
             if (ci.type=='r' || ci.type=='d'             //new field; if 'dnE', blank field. 
                    || (strchr("nE", ci.type) && ct>0)){  //Blank fields only at end of lines that already have data; else all-blank line to ignore.
                 if (++ct > fn->textsize[0]) apop_text_alloc(fn, ct, 1);//realloc text portion.
-                Textrealloc(*fn->text[ct-1], 5);
+                if (ct > src->field_capct){
+                    src->field_caps = realloc(src->field_caps, sizeof(size_t)*ct);
+                    src->field_caps[ct-1] = 0;
+                    src->field_capct = ct;
+                }
+                mlen = src->field_caps[ct-1];
+                if (mlen < 5){
+                    Textrealloc(*fn->text[ct-1], 5);
+                    mlen = src->field_caps[ct-1] = 5;
+                }
                 thisflen = 0;
-                mlen=5;
                 infield=1;
             } 
         } 
@@ -552,10 +996,26 @@ static line_parse_t parse_a_line(FILE *infile, char *buffer, size_t *ptr, apop_d
                 if (thisflen+2 > mlen){
                     mlen *=2; //length of allocated memory
                     Textrealloc(*fn->text[ct-1], mlen);
+                    src->field_caps[ct-1] = mlen;
                 }
                 fn->text[ct-1][0][thisflen-1] = ci.c;
                 if (ci.type!='w')
                     lastnonwhite = thisflen;
+                if (ci.type=='r' && src->ptr < src->len){
+                    //Copy the run of plain characters that follows in one step.
+                    size_t run = plain_run(src->buffer+src->ptr, src->len-src->ptr,
+                                        inqq ? &classes->quoted_stops : &classes->plain_stops);
+                    if (run){
+                        if (thisflen+run+2 > mlen){
+                            while (thisflen+run+2 > mlen) mlen *=2;
+                            Textrealloc(*fn->text[ct-1], mlen);
+                            src->field_caps[ct-1] = mlen;
+                        }
+                        memcpy(fn->text[ct-1][0]+thisflen, src->buffer+src->ptr, run);
+                        src->ptr += run;
+                        lastnonwhite = thisflen += run;
+                    }
+                }
             }
         }
     } while (ci.type != 'n' && ci.type != 'E');
@@ -563,14 +1023,14 @@ static line_parse_t parse_a_line(FILE *infile, char *buffer, size_t *ptr, apop_d
 }
 
 //On return, fn has copies of the field names, and add_this_line has the first data line.
-static void get_field_names(int has_col_names, char **field_names, FILE *infile, char *buffer, size_t *ptr,
-                                apop_data *add_this_line, apop_data *fn, int const *field_ends, char const *delimiters){
+static void get_field_names(int has_col_names, char **field_names, text_source_t *src,
+                                apop_data *add_this_line, apop_data *fn, int const *field_ends, char_classes_t const *classes){
     if (has_col_names && field_names == NULL){
-        while (fn->textsize[0] ==0) parse_a_line(infile, buffer, ptr, fn, field_ends, delimiters);
-        while (add_this_line->textsize[0] ==0) parse_a_line(infile, buffer, ptr, add_this_line, field_ends, delimiters);
+        while (fn->textsize[0] ==0) parse_a_line(src, fn, field_ends, classes);
+        while (add_this_line->textsize[0] ==0) parse_a_line(src, add_this_line, field_ends, classes);
     } else{
         while (add_this_line->textsize[0] ==0) 
-            parse_a_line(infile, buffer, ptr, add_this_line, field_ends, delimiters);
+            parse_a_line(src, add_this_line, field_ends, classes);
         fn	= apop_text_alloc(fn, add_this_line->textsize[0], 1);
         for (int i=0; i< fn->textsize[0]; i++)
             if (field_names) apop_text_set(fn, i, 0, field_names[i]);
@@ -578,6 +1038,230 @@ static void get_field_names(int has_col_names, char **field_names, FILE *infile,
     }
 }
 
+/** \cond doxy_ignore */
+//A piece of a file, parsed on its own thread into its own block of rows.
+typedef struct {
+    text_source_t src;
+    double *data;
+    char **rownames;
+    size_t rows, capacity;
+    int bad_ct;     //If nonzero, the last row has this many fields, which is too many.
+    char error;
+    struct {size_t row; int col; char *text;} *notes; //conversion failures, reported in order after the join.
+    size_t note_ct;
+} text_chunk_t;
+/** \endcond */
+
+static const size_t parallel_min_size = 1<<20;
+
+/* If the input is a sizable regular file and there are threads to spare, map it into
+   memory so it can be cut into pieces and parsed in parallel. Else, return NULL and
+   the caller reads the file serially. If a delimiter is one of the characters that the
+   line-splitter needs to track, just read serially. */
+static char *map_text_file(FILE *infile, char const *delimiters, size_t *len){
+#if defined(Use_mmap) && defined(_OPENMP)
+    struct stat info;
+    if (infile == stdin || omp_get_max_threads() < 2 || strpbrk(delimiters, "\n\"\\#")
+            || fstat(fileno(infile), &info) || !S_ISREG(info.st_mode) 
+            || info.st_size < parallel_min_size)
+        return NULL;
+    char *out = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+    if (out == MAP_FAILED) return NULL;
+    *len = info.st_size;
+    return out;
+#else
+    return NULL;
+#endif
+}
+
+/* Cut the block into at most chunk_ct pieces, each starting at the head of a line.
+   Uses parse_a_line's rules: a newline ends a line unless it is quoted or escaped, and an
+   unquoted # comments out everything to the next newline. Fixed-width lines end at
+   every newline. */
+static int split_at_lines(char *start, size_t len, int chunk_ct, text_chunk_t *chunks, bool fixed_width){
+    int ct = 0;
+    size_t chunk_start = 0;
+    bool inqq = false;
+    stop_set_t stops = {.scalar = scalar_scan()};
+    add_stop(&stops, '\n');
+    if (!fixed_width) for (char const *c="\\\"#"; *c; c++) add_stop(&stops, *c);
+    for (size_t i=0; i < len && ct < chunk_ct-1; i++){
+        i += plain_run(start+i, len-i, &stops);
+        if (i >= len) break;
+        if (!fixed_width){
+            if (start[i] == '\\') {i++; continue;}
+            if (start[i] == '"') inqq = !inqq;
+            if (inqq) continue;
+            if (start[i] == '#'){
+                char *nl = memchr(start+i, '\n', len-i);
+                if (!nl) break;
+                i = nl - start;
+            }
+        }
+        if (start[i] == '\n' && i+1 >= (ct+1)*(len/chunk_ct)){
+            chunks[ct++] = (text_chunk_t){.src={.buffer=start+chunk_start, .len=i+1-chunk_start}};
+            chunk_start = i+1;
+        }
+    }
+    chunks[ct++] = (text_chunk_t){.src={.buffer=start+chunk_start, .len=len-chunk_start}};
+    return ct;
+}
+
+static void parse_a_chunk(text_chunk_t *chunk, size_t cols, int hasrows, int const *field_ends, char_classes_t const *classes){
+    apop_data *line = apop_data_alloc();
+    bool keep_notes = apop_opts.verbose != -1 && apop_opts.verbose >= 1;
+    line_parse_t L;
+    do {
+        L = parse_a_line(&chunk->src, line, field_ends, classes);
+        if (!L.ct) continue;
+        if (chunk->rows == chunk->capacity){
+            chunk->capacity = chunk->capacity ? chunk->capacity*2 : 1024;
+            chunk->data = realloc(chunk->data, sizeof(double)*chunk->capacity*cols);
+            if (hasrows) chunk->rownames = realloc(chunk->rownames, sizeof(char*)*chunk->capacity);
+            if ((cols && !chunk->data) || (hasrows && !chunk->rownames)) {
+                chunk->error = 'a';
+                break;
+            }
+        }
+        double *thisrow = chunk->data + cols*chunk->rows++;
+        if (hasrows) chunk->rownames[chunk->rows-1] = strdup(*line->text[0]);
+        if (L.ct - hasrows > cols) {
+            chunk->bad_ct = L.ct;
+            break;
+        }
+        for (int col=hasrows; col < L.ct; col++){
+            char *thisstr = *line->text[col], *str;
+            if (!strlen(thisstr)) {
+                thisrow[col-hasrows] = GSL_NAN;
+                continue;
+            }
+            thisrow[col-hasrows] = apop_strtod(thisstr, &str);
+            if (thisstr != str) continue;
+            thisrow[col-hasrows] = GSL_NAN;
+            if (keep_notes){
+                chunk->notes = realloc(chunk->notes, sizeof(*chunk->notes)*++chunk->note_ct);
+                chunk->notes[chunk->note_ct-1].row = chunk->rows-1;
+                chunk->notes[chunk->note_ct-1].col = col;
+                chunk->notes[chunk->note_ct-1].text = strdup(thisstr);
+            }
+        }
+    } while (!L.eof);
+    apop_data_free(line);
+    free(chunk->src.field_caps);
+}
+
+#define Row_length_check(ct, row, onfail)                                                      \
+    if (hasrows) Apop_stopif((ct)-1 > set->matrix->size2, onfail, 1,                            \
+                 "row %i (not counting rownames) has %i elements (not counting the rowname), "  \
+                 "but I thought this was a data set with %zu elements per row. "               \
+                 "Stopping the file read; returning what I have so far.", (int)(row), (ct)-1, set->matrix->size2); \
+    else Apop_stopif((ct) > set->matrix->size2, onfail, 1,                                     \
+                 "row %i has %i elements, "                                                     \
+                 "but I thought this was a data set with %zu elements per row. "               \
+                 "Stopping the file read; returning what I have so far. Set has_row_names?", (int)(row), (ct), set->matrix->size2);
+
+//Convert the fields of a parsed line to numbers in the given row of the matrix.
+//line_no is the data line number, for the error message.
+static void line_to_row(gsl_matrix *m, size_t row, apop_data const *line, int ct, int hasrows, int line_no){
+    char *str;
+    for (int col=hasrows; col < ct; col++){
+        char *thisstr = *line->text[col];
+        if (strlen(thisstr)){
+            double val = apop_strtod(thisstr, &str);
+            if (thisstr != str)
+                gsl_matrix_set(m, row, col-hasrows, val);
+            else {
+                gsl_matrix_set(m, row, col-hasrows, GSL_NAN);
+                Apop_notify(1, "trouble converting data item %i on data line %i [%s]; writing NaN.", col, line_no, thisstr);
+            }
+        } else gsl_matrix_set(m, row, col-hasrows, GSL_NAN);
+    }
+}
+
+/* Read the rest of a mapped file, from src's current position, in parallel, and append
+   the rows to set, which already has row rows. Notices and errors are reported as the
+   serial reader would have, in order. Returns the new row count. */
+static int text_to_data_parallel(apop_data *set, int row, text_source_t *src, int hasrows, int const *field_ends, char_classes_t const *classes){
+#ifdef _OPENMP
+    size_t cols = set->matrix->size2;
+    int chunk_ct = omp_get_max_threads();
+    text_chunk_t chunks[chunk_ct];
+    char *start = src->buffer + src->ptr;
+    size_t len = src->len - src->ptr;
+    char *stop = memchr(start, (char)-1, len); //get_next reads this as EOF.
+    if (stop) len = stop - start;
+    chunk_ct = split_at_lines(start, len, chunk_ct, chunks, !!field_ends);
+    OMP_for (int i=0; i< chunk_ct; i++)
+        parse_a_chunk(chunks+i, cols, hasrows, field_ends, classes);
+
+    size_t total = row;
+    for (int i=0; i< chunk_ct; i++) total += chunks[i].rows;
+    set->matrix = apop_matrix_realloc(set->matrix, total, cols);
+    Apop_stopif(!set->matrix, set->error='a', 0, "allocation error.");
+    for (int i=0; i< chunk_ct; i++){
+        text_chunk_t *c = chunks+i;
+        if (!set->error){
+            if (c->rows) memcpy(gsl_matrix_ptr(set->matrix, row, 0), c->data, sizeof(double)*cols*c->rows);
+            for (size_t j=0; j< c->note_ct; j++)
+                Apop_notify(1, "trouble converting data item %i on data line %zu [%s]; writing NaN.", 
+                                c->notes[j].col, row+c->notes[j].row+1, c->notes[j].text);
+            if (hasrows) for (size_t j=0; j< c->rows; j++)
+                apop_name_add(set->names, c->rownames[j], 'r');
+            row += c->rows;
+            Apop_stopif(c->error, set->error=c->error, 0, "allocation error.");
+            if (c->bad_ct) {Row_length_check(c->bad_ct, row, set->error='t');}
+            if (set->error) set->matrix = apop_matrix_realloc(set->matrix, row, cols);
+        }
+        for (size_t j=0; j< c->note_ct; j++) free(c->notes[j].text);
+        if (hasrows) for (size_t j=0; j< c->rows; j++) free(c->rownames[j]);
+        free(c->notes);
+        free(c->rownames);
+        free(c->data);
+    }
+#endif
+    return row;
+}
+
+/* Read the data lines from src into *setp, which is allocated here if there was no
+   header line to size it. L describes the first line, which is already parsed into
+   add_this_line. If the source is a mapped file, all but the first line are parsed in
+   parallel. Returns the row count. */
+static int text_lines_to_data(apop_data **setp, text_source_t *src, apop_data *add_this_line, line_parse_t L,
+                    int hasrows, int const *field_ends, char_classes_t const *classes, bool mapped){
+    apop_data *set = *setp;
+    int row = 0;
+    size_t capacity = 0; //rows allocated in set->matrix, which grows by doubling and is trimmed at the end.
+	while(!set || !L.eof || L.ct){
+        if (!L.ct) { //skip blank lines
+            L=parse_a_line(src, add_this_line, field_ends, classes);
+            continue;
+        }
+        if (!set) set = apop_data_alloc(0, 1, L.ct-hasrows); //for .has_col_names=='n'.
+        row++;
+        int cols = set->matrix  ? set->matrix->size2 : L.ct - hasrows;
+        if (row > capacity){
+            capacity = capacity ? capacity*2 : 1024;
+            set->matrix = apop_matrix_realloc(set->matrix, capacity, cols);
+            Apop_stopif(!set->matrix, set->error='a', 0, "allocation error.");
+            if (set->error) break;
+        }
+        if (hasrows) apop_name_add(set->names, *add_this_line->text[0], 'r');
+        Row_length_check(L.ct, row, set->error='t');
+        if (set->error) break;
+        line_to_row(set->matrix, row-1, add_this_line, L.ct, hasrows, row);
+        if (L.eof) break;//hit when the last line has elements and is terminated by EOF.
+        if (mapped){ //We have the first row and the column count; parse the rest in parallel.
+            row = text_to_data_parallel(set, row, src, hasrows, field_ends, classes);
+            break;
+        }
+        L=parse_a_line(src, add_this_line, field_ends, classes);
+	}
+    if (row && set->matrix && set->matrix->size1 > row)
+        set->matrix = apop_matrix_realloc(set->matrix, row, set->matrix->size2);
+    *setp = set;
+    return row;
+}
+
 /** Read a delimited or fixed-wisdth text file into the matrix element of an \ref apop_data set.
 
 See \ref text_format.
@@ -595,6 +1279,11 @@ See also \ref apop_text_to_db, which handles text data, and may othewise be a pe
 
 <b>example:</b> See \ref apop_ols.
 
+\li If Apophenia was compiled with OpenMP and the input is a regular file of a megabyte
+or more, the file is mapped into memory, cut at line breaks, and the pieces parsed on
+separate threads. The output is the same as for a serial read. Set the thread count
+via the usual \c OMP_NUM_THREADS environment variable, or <tt>omp_set_num_threads(1)</tt>
+for a serial read. For compressed input, one thread decompresses while another parses.
 \li This function uses the \ref designated syntax for inputs.
 */
 APOP_VAR_HEAD apop_data * apop_text_to_data(char const*text_file, int has_row_names, int has_col_names, int const *field_ends, char const *delimiters){
@@ -608,20 +1297,28 @@ APOP_VAR_HEAD apop_data * apop_text_to_data(char const*text_file, int has_row_na
 APOP_VAR_ENDHEAD
     apop_data *set = NULL;
     FILE *infile = NULL;
-    char *str;
+    text_decoder_t *dec = NULL;
     char buffer[bs];
-    size_t ptr=bs;
-    apop_data *add_this_line= apop_data_alloc();
-    int row = 0,
-        hasrows = (has_row_names == 'y');
-    Apop_stopif(prep_text_reading(text_file, &infile), apop_return_data_error(t),
+    text_source_t src = {.buffer=buffer};
+    int hasrows = (has_row_names == 'y');
+    Apop_stopif(prep_text_reading(text_file, &infile, &dec), apop_return_data_error(t),
             0, "trouble opening %s", text_file);
+    apop_data *add_this_line= apop_data_alloc();
+    char_classes_t classes;
+    set_char_classes(&classes, delimiters);
+    size_t maplen = 0;
+    char *map = dec ? NULL : map_text_file(infile, delimiters, &maplen);
+    if (map) src = (text_source_t){.buffer=map, .len=maplen};
+    else {
+        src.infile = infile;
+        src.dec = dec;
+    }
 
     line_parse_t L={ };
     //First, handle the top line, if we're told that it has column names.
     if (has_col_names=='y'){
         apop_data *field_names = apop_data_alloc();
-        get_field_names(1, NULL, infile, buffer, &ptr, add_this_line, field_names, field_ends, delimiters);
+        get_field_names(1, NULL, &src, add_this_line, field_names, field_ends, &classes);
         L.ct = *add_this_line->textsize;
         set = apop_data_alloc(0,1, L.ct - hasrows);
 	    set->names->colct = 0;
@@ -632,46 +1329,173 @@ APOP_VAR_ENDHEAD
     } 
 
     //Now do the body.
-	while(!set || !L.eof || L.ct){
-        if (!L.ct) { //skip blank lines
-            L=parse_a_line(infile,buffer, &ptr,  add_this_line, field_ends, delimiters);
-            continue;
-        }
-        if (!set) set = apop_data_alloc(0, 1, L.ct-hasrows); //for .has_col_names=='n'.
-        row++;
-        int cols = set->matrix  ? set->matrix->size2 : L.ct - hasrows;
-        set->matrix = apop_matrix_realloc(set->matrix, row, cols);
-        Apop_stopif(!set->matrix, set->error='a'; return set, 0, "allocation error.");
-        if (hasrows) {
-            apop_name_add(set->names, *add_this_line->text[0], 'r');
-            Apop_stopif(L.ct-1 > set->matrix->size2, set->error='t'; return set, 1,
-                 "row %i (not counting rownames) has %i elements (not counting the rowname), "
-                 "but I thought this was a data set with %zu elements per row. "
-                 "Stopping the file read; returning what I have so far.", row, L.ct-1, set->matrix->size2);
-        } else Apop_stopif(L.ct > set->matrix->size2, set->error='t'; return set, 1,
-                 "row %i has %i elements, "
-                 "but I thought this was a data set with %zu elements per row. "
-                 "Stopping the file read; returning what I have so far. Set has_row_names?", row, L.ct, set->matrix->size2);
-        for (int col=hasrows; col < L.ct; col++){
-            char *thisstr = *add_this_line->text[col];
-            if (strlen(thisstr)){
-                double val = strtod(thisstr, &str);
-                if (thisstr != str)
-                    gsl_matrix_set(set->matrix, row-1, col-hasrows, val);
-                else {
-                    gsl_matrix_set(set->matrix, row-1, col-hasrows, GSL_NAN);
-                    Apop_notify(1, "trouble converting data item %i on data line %i [%s]; writing NaN.", col, row, thisstr);
-                }
-            } else gsl_matrix_set(set->matrix, row-1, col-hasrows, GSL_NAN);
+#ifdef _OPENMP
+    if (dec && omp_get_max_threads() > 1 && !omp_in_parallel()){
+        //Decompress on one thread while parsing on the other.
+        decoder_start_read_ahead(dec);
+        #pragma omp parallel num_threads(2)
+        {
+            if (omp_get_thread_num() == 1) decoder_read_ahead(dec);
+            else {
+                if (omp_get_num_threads() < 2) decoder_stop_read_ahead(dec); //no helper after all.
+                text_lines_to_data(&set, &src, add_this_line, L, hasrows, field_ends, &classes, false);
+                set_shared(&dec->quit, 1);
+            }
         }
-        if (L.eof) break;//hit when the last line has elements and is terminated by EOF.
-        L=parse_a_line(infile, buffer, &ptr, add_this_line, field_ends, delimiters);
-	}
+    } else
+#endif
+    text_lines_to_data(&set, &src, add_this_line, L, hasrows, field_ends, &classes, map);
+    if (dec && dec->error && set) set->error = 't';
     apop_data_free(add_this_line);
+    free(src.field_caps);
+#ifdef Use_mmap
+    if (map) munmap(map, maplen);
+#endif
+    close_decoder(dec);
     if (strcmp(text_file,"-")) fclose(infile);
 	return set;
 }
 
+/** \cond doxy_ignore */
+struct apop_text_stream {
+    FILE *infile;
+    bool is_stdin, done;
+    text_source_t src;
+    char_classes_t classes;
+    int const *field_ends;
+    int hasrows, row;
+    line_parse_t L;           //The state of the lookahead line, which is already parsed into line.
+    apop_data *line, *block;
+};
+/** \endcond */
+
+/** Open a delimited or fixed-width text file for reading in blocks of rows via \ref
+apop_text_stream_next. The file is read the same way that \ref apop_text_to_data reads
+it (see \ref text_format), but only as much of it as is needed to fill the next block is
+in memory at any time, so you can calculate summary statistics over a file too large to
+read in whole.
+
+\code
+apop_text_stream *s = apop_text_stream_open("big_data.csv");
+double total = 0;
+size_t n = 0;
+for (apop_data *block; (block = apop_text_stream_next(s, 10000)); ){
+    total += apop_vector_sum(Apop_cv(block, 0));
+    n += block->matrix->size1;
+}
+apop_text_stream_close(s);
+printf("mean of the first column: %g\n", total/n);
+\endcode
+
+\param text_file  = "-"  The name of the text file to be read in. If "-" (the default), use stdin.
+\param has_row_names Does the lines of data have row names? \c 'y' =yes; \c 'n' =no (default: 'n')
+\param has_col_names  Is the top line a list of column names? (default: 'y')
+\param field_ends If fields have a fixed size, give the end of each field, e.g. <tt>.field_ends=(int[]){3, 8 11}</tt>. The stream refers to this list until it is closed, so it must not be freed before then. (default: \c NULL, indicating not fixed width)
+\param delimiters A string listing the characters that delimit fields. (default: <tt>"|,\t"</tt>)
+\return A stream to hand to \ref apop_text_stream_next and eventually \ref apop_text_stream_close, or \c NULL if the file could not be opened.
+
+\li This function uses the \ref designated syntax for inputs.
+*/
+APOP_VAR_HEAD apop_text_stream * apop_text_stream_open(char const *text_file, int has_row_names, int has_col_names, int const *field_ends, char const *delimiters){
+    char const *apop_varad_var(text_file, "-")
+    int apop_varad_var(has_row_names, 'n')
+    int apop_varad_var(has_col_names, 'y')
+    if (has_row_names==1||has_row_names=='Y') has_row_names ='y';
+    if (has_col_names==1||has_col_names=='Y') has_col_names ='y';
+    int const * apop_varad_var(field_ends, NULL);
+    const char * apop_varad_var(delimiters, apop_opts.input_delimiters);
+APOP_VAR_ENDHEAD
+    FILE *infile = NULL;
+    text_decoder_t *dec = NULL;
+    Apop_stopif(prep_text_reading(text_file, &infile, &dec), return NULL, 0, "trouble opening %s", text_file);
+    apop_text_stream *s = malloc(sizeof(apop_text_stream));
+    char *buffer = malloc(bs);
+    Apop_stopif(!s || !buffer, free(s); free(buffer); close_decoder(dec); if (infile!=stdin) fclose(infile); return NULL,
+            0, "malloc failed. Probably out of memory.");
+    *s = (apop_text_stream){.infile=infile, .is_stdin=(infile==stdin),
+                    .src=(text_source_t){.infile=infile, .dec=dec, .buffer=buffer},
+                    .field_ends=field_ends, .hasrows=(has_row_names=='y'),
+                    .line=apop_data_alloc()};
+    set_char_classes(&s->classes, delimiters);
+    if (has_col_names=='y'){
+        apop_data *field_names = apop_data_alloc();
+        get_field_names(1, NULL, &s->src, s->line, field_names, field_ends, &s->classes);
+        s->L.ct = *s->line->textsize;
+        s->block = apop_data_alloc(0,1, s->L.ct - s->hasrows);
+	    s->block->names->colct = 0;
+	    s->block->names->col = malloc(sizeof(char*));
+        for (int j=0; j< s->L.ct - s->hasrows; j++)
+            apop_name_add(s->block->names, *field_names->text[j], 'c');
+        apop_data_free(field_names);
+    } else s->L = parse_a_line(&s->src, s->line, field_ends, &s->classes);
+    return s;
+}
+
+/** Read the next block of rows from a stream opened via \ref apop_text_stream_open.
+
+\param stream The stream. If \c NULL, return \c NULL.
+\param max_rows The most rows to read into the block. Every block but the last will have
+exactly this many rows. If zero, return \c NULL.
+\return An \ref apop_data set whose matrix holds the next rows of the file, with column
+names and (if requested) row names as \ref apop_text_to_data would give them. At the end of the file, return \c NULL.
+\exception out->error=='a' allocation error
+\exception out->error=='t' text-reading error; the block has the rows read before the error, and the next call will return \c NULL.
+
+\li The returned set belongs to the stream, and its matrix is reused by the next
+call, so the next call overwrites it. Use \ref apop_data_copy or \ref apop_data_share
+to keep a block past that; if the block is shared, the next call gives the stream its
+own copy before overwriting it. Do not free it; \ref apop_text_stream_close does that.
+*/
+apop_data *apop_text_stream_next(apop_text_stream *s, size_t max_rows){
+    if (!s || !max_rows || s->done) return NULL;
+    apop_data *set = s->block;
+    int hasrows = s->hasrows;
+    size_t n = 0;
+    if (set){
+        apop_page_unshare(set); //in case the caller kept the last block via apop_data_share.
+        apop_name_trim_rows(set->names, 0); //the rows are refilled from the top.
+    }
+    while (n < max_rows){
+        if (!s->L.ct){ //skip blank lines
+            if (s->L.eof) {s->done = true; break;}
+            s->L = parse_a_line(&s->src, s->line, s->field_ends, &s->classes);
+            continue;
+        }
+        if (!set) set = s->block = apop_data_alloc(0, 1, s->L.ct-hasrows); //for .has_col_names=='n'.
+        int cols = set->matrix ? set->matrix->size2 : s->L.ct - hasrows;
+        set->matrix = apop_matrix_room_for_row(set->matrix, n, cols, max_rows);
+        Apop_stopif(!set->matrix, set->error='a'; s->done=true; return set, 0, "allocation error.");
+        s->row++;
+        if (hasrows) apop_name_add(set->names, *s->line->text[0], 'r');
+        Row_length_check(s->L.ct, s->row, set->error='t'; s->done=true);
+        if (set->error) break;
+        line_to_row(set->matrix, n++, s->line, s->L.ct, hasrows, s->row);
+        if (s->L.eof) {s->done = true; break;}
+        s->L = parse_a_line(&s->src, s->line, s->field_ends, &s->classes);
+    }
+    if (set && s->src.dec && s->src.dec->error) set->error = 't';
+    if (!n && !(set && set->error)) return NULL;
+    if (set->matrix->size1 > n) //a short last block
+        set->matrix = apop_matrix_realloc(set->matrix, n, set->matrix->size2);
+    return set;
+}
+
+/** Close a stream opened via \ref apop_text_stream_open, and free it and the block it
+last returned.
+
+\param stream The stream. If \c NULL, do nothing.
+*/
+void apop_text_stream_close(apop_text_stream *s){
+    if (!s) return;
+    close_decoder(s->src.dec);
+    if (!s->is_stdin) fclose(s->infile);
+    apop_data_free(s->block);
+    apop_data_free(s->line);
+    free(s->src.buffer);
+    free(s->src.field_caps);
+    free(s);
+}
+
 /** This is the complement to \ref apop_data_pack, qv. It writes the \c gsl_vector
     produced by that function back to the \ref apop_data set you provide. It overwrites
     the data in the vector and matrix elements and, if present, the \c weights (and
@@ -938,7 +1762,6 @@ apop_data *apop_text_fill_base(apop_data *data, char* text[]){
 
 
 ///////The rest of this file is for apop_text_to_db
-extern sqlite3 *db;
 
 static char *get_field_conditions(char *var, apop_data *field_params){
     if (field_params)
@@ -994,8 +1817,7 @@ char *prep_string_for_sqlite(int prepped_statements, char const *astring){
 
     char *out  = NULL,
 		 *tail = NULL;
-	if(strtod(astring, &tail)) 
-        /*do nothing.*/;
+    double val = apop_strtod(astring, &tail);
     if (*tail!='\0'){	//then it's not a number.
         if (!prepped_statements){
             if (strchr(astring, '\''))
@@ -1005,11 +1827,9 @@ char *prep_string_for_sqlite(int prepped_statements, char const *astring){
         } else  out = strdup(astring);
 	} else {	    //number, maybe INF or NAN. Also, sqlite wants 0.1, not .1
 		assert(*astring!='\0');
-        if (isinf(atof(astring))==1)
-			out = strdup("9e9999999");
-        else if (isinf(atof(astring))==-1)
-			out = strdup("-9e9999999");
-        else if (gsl_isnan(atof(astring)))
+        if (isinf(val))
+			out = strdup(val > 0 ? "9e9999999" : "-9e9999999");
+        else if (gsl_isnan(val))
 			out = strdup("0.0/0.0");
         else if (astring[0]=='.')
 			Asprintf(&out, "0%s",astring);
@@ -1018,33 +1838,224 @@ char *prep_string_for_sqlite(int prepped_statements, char const *astring){
     return out;
 }
 
-static void line_to_insert(line_parse_t L, apop_data const*addme, char const *tabname, 
-                             sqlite3_stmt *p_stmt, int row){
-    if (!L.ct) return;
-    int field = 1;
+/* SQLite's affinity for a column with the given declared type, per the rules in its
+   "Datatypes" documentation: 'i'nteger, 't'ext, 'b'lob (i.e., none), 'r'eal, or 'n'umeric. */
+static char column_affinity(char const *type){
+    if (!type || !*type)             return 'b';
+    if (apop_regex(type, "int"))     return 'i';
+    if (apop_regex(type, "char|clob|text")) return 't';
+    if (apop_regex(type, "blob"))    return 'b';
+    if (apop_regex(type, "real|floa|doub")) return 'r';
+    return 'n';
+}
+
+/* One affinity per column of the insert, from the declared types: the ones we are about
+   to give the new table, or the ones the existing table already has. */
+static char *get_affinities(char const *tabname, bool tab_exists, int has_row_names,
+                                    apop_data *field_params, apop_data const *fn, int col_ct){
+    char *out = malloc(col_ct);
+    if (tab_exists){
+        apop_data *types = apop_query_to_text("pragma table_info(%s)", tabname);
+        for (int i=0; i< col_ct; i++)
+            out[i] = column_affinity(types && i < *types->textsize && types->textsize[1] > 2
+                                        ? types->text[i][2] : NULL);
+        apop_data_free(types);
+    } else for (int i=0; i< col_ct; i++)
+        out[i] = (has_row_names && i==0) ? 'b'
+                    : column_affinity(get_field_conditions(*fn->text[i-has_row_names], field_params));
+    return out;
+}
+
+/* Bind one field of the prepared insert statement. This stores what binding the text
+   from prep_string_for_sqlite stored, but numbers headed for a numeric column are
+   bound as numbers, and other text is bound in place, so the usual field needs no
+   copying and SQLite has nothing to re-parse. */
+static int bind_field(sqlite3_stmt *p_stmt, int field, char *text, char affinity){
+    if (!*text || (apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, text)))
+        return SQLITE_OK; //leave NULL and cleared
+    char *tail;
+    double val = apop_strtod(text, &tail);
+    if (*tail) //not a number.
+        return sqlite3_bind_text(p_stmt, field, text, -1, SQLITE_STATIC);
+    if (isinf(val))
+        return sqlite3_bind_text(p_stmt, field, val > 0 ? "9e9999999" : "-9e9999999", -1, SQLITE_STATIC);
+    if (gsl_isnan(val))
+        return sqlite3_bind_text(p_stmt, field, "0.0/0.0", -1, SQLITE_STATIC);
+
+    bool negative = (*text=='-');
+    char const *digits = text + (negative || *text=='+');
+    bool is_decimal = (isdigit((unsigned char)*digits) && !(digits[0]=='0' && (digits[1]=='x' || digits[1]=='X')))
+                        || *digits=='.'; //SQLite won't convert hex or anything else strtod allows.
+    if (!is_decimal || affinity=='t' || affinity=='b'){
+        if (*text=='.') return sqlite3_bind_text(p_stmt, field, sqlite3_mprintf("0%s", text), -1, sqlite3_free);
+        return sqlite3_bind_text(p_stmt, field, text, -1, SQLITE_STATIC);
+    }
+    //Integer text that fits in 64 bits stays exact; the rest goes in as a double, which
+    //the column's affinity treats the same way it would treat the text.
+    uint64_t n = 0, limit = (uint64_t)INT64_MAX + negative;
+    for ( ; isdigit((unsigned char)*digits) && n <= (limit - (*digits-'0'))/10; digits++)
+        n = 10*n + (*digits - '0');
+    if (!*digits)
+        return sqlite3_bind_int64(p_stmt, field, negative ? (sqlite3_int64)(0-n) : (sqlite3_int64)n);
+    return sqlite3_bind_double(p_stmt, field, val);
+}
+
+/** \cond doxy_ignore */
+//Where the lines of apop_text_to_db go, and how many have gone there.
+typedef struct {
+    char const *tabname;
+    sqlite3_stmt *statement; //NULL if not using prepared statements.
+    char const *affinity;    //one per column of the table.
+    int col_ct;
+    apop_db_load_state load;
+    int ct;
+} inserter_t;
+/** \endcond */
+
+static void line_to_insert(char *const *fields, int field_ct, inserter_t const *ins, int row){
     char comma = ' ';
     char *q = NULL;
-    if (!p_stmt) Asprintf(&q, "INSERT INTO %s VALUES (", tabname);
-    for (int col=0; col < L.ct; col++){
-        char *prepped = prep_string_for_sqlite(!!p_stmt, *addme->text[col]);
-        if (p_stmt){
-            if (!prepped || !strlen(prepped))
-                field++; //leave NULL and cleared
-            else 
-               Apop_stopif(sqlite3_bind_text(p_stmt, field++, prepped, -1, SQLITE_TRANSIENT)!=SQLITE_OK,
+    if (ins->statement){
+        for (int col=0; col < field_ct; col++)
+            Apop_stopif(bind_field(ins->statement, col+1, fields[col],
+                                      col < ins->col_ct ? ins->affinity[col] : 'b')!=SQLITE_OK,
                 /*keep going */, 0, "Something wrong on line %i, field %i [%s].\n"
-                                            , row, field-1, *addme->text[col]);
-        } else {
-            xprintf(&q, "%s%c %s", q, comma,  (prepped && strlen(prepped) ? prepped : " NULL"));
-            comma = ',';
-        }
+                                            , row, col+1, fields[col]);
+        return;
+    }
+    Asprintf(&q, "INSERT INTO %s VALUES (", ins->tabname);
+    for (int col=0; col < field_ct; col++){
+        char *prepped = prep_string_for_sqlite(0, fields[col]);
+        xprintf(&q, "%s%c %s", q, comma,  (prepped && strlen(prepped) ? prepped : " NULL"));
+        comma = ',';
         free(prepped);
     }
-    if (!p_stmt){
-        apop_query("%s)",q); 
-        free (q);
+    apop_query("%s)",q); 
+    free (q);
+}
+
+//Insert one line (number row of the file). Returns 0 on success, 1 if the statement broke.
+static int insert_a_line(char *const *fields, int field_ct, inserter_t *ins, int row){
+    int batch_size = 10000;
+    bool failed = false;
+    line_to_insert(fields, field_ct, ins, row);
+    if (apop_opts.verbose > 1 && !(ins->ct++ % batch_size)) 
+        {fprintf(stderr, "."); fflush(NULL);}
+    if (ins->statement){
+        int err = sqlite3_step(ins->statement);
+        if (err!=0 && err != 101) //0=ok, 101=done
+            Apop_notify(0, "sqlite insert query gave error code %i.\n", err);
+        Apop_stopif(sqlite3_reset(ins->statement), failed=true, apop_errorlevel, "SQLite error.");
+#if SQLITE_VERSION_NUMBER >= 3003009
+        Apop_stopif(sqlite3_clear_bindings(ins->statement), failed=true, apop_errorlevel, "SQLite error."); //needed for NULLs
+#endif
+    }
+    apop_db_load_row(&ins->load);
+    return failed;
+}
+
+#ifdef _OPENMP
+/* With a spare thread, apop_text_to_db runs as a pipeline: the calling thread parses
+   lines into a ring of batches, and the other thread, the only one to touch the
+   database, inserts them in order. Only the prepared-statement path is pipelined; SQLite
+   does the parsing of the one-query-per-line path. */
+
+/** \cond doxy_ignore */
+typedef struct {int row, field_ct; size_t first_field;} batch_line_t;
+
+typedef struct {
+    char *text;        //every field of every line, each null-terminated
+    size_t text_len, text_cap;
+    size_t *starts;    //where each field begins in text
+    size_t field_ct, field_cap;
+    batch_line_t *lines;
+    int line_ct, line_cap;
+    bool last;         //no more batches after this one.
+} line_batch_t;
+/** \endcond */
+
+static const int batch_lines = 1024, ring_size = 4;
+
+static void batch_add_line(line_batch_t *b, apop_data const *line, int field_ct, int row){
+    if (b->line_ct == b->line_cap){
+        b->line_cap = b->line_cap ? b->line_cap*2 : batch_lines;
+        b->lines = realloc(b->lines, sizeof(*b->lines)*b->line_cap);
+    }
+    b->lines[b->line_ct++] = (batch_line_t){.row=row, .field_ct=field_ct, .first_field=b->field_ct};
+    for (int i=0; i< field_ct; i++){
+        size_t len = strlen(*line->text[i])+1;
+        if (b->field_ct == b->field_cap){
+            b->field_cap = b->field_cap ? b->field_cap*2 : batch_lines*field_ct;
+            b->starts = realloc(b->starts, sizeof(size_t)*b->field_cap);
+        }
+        if (b->text_len + len > b->text_cap){
+            while (b->text_len + len > b->text_cap) b->text_cap = b->text_cap ? b->text_cap*2 : 1<<16;
+            b->text = realloc(b->text, b->text_cap);
+        }
+        b->starts[b->field_ct++] = b->text_len;
+        memcpy(b->text + b->text_len, *line->text[i], len);
+        b->text_len += len;
+    }
+}
+
+/* The parser fills a batch when there is a free slot in the ring, and the writer drains
+   one when there is a full one. Each runs on its own thread, or if the team turns out to
+   have only one thread, that thread takes turns. Returns the line count, as per the
+   serial loop; sets *failed if an insert broke. */
+static int text_to_db_pipelined(text_source_t *src, apop_data *line, line_parse_t L, int rows,
+                int const *field_ends, char_classes_t const *classes, inserter_t *ins, bool *failed){
+    line_batch_t ring[ring_size];
+    memset(ring, 0, sizeof(ring));
+    int produced = 0, consumed = 0, stop = 0;
+    apop_db_handle *handle = apop_db_thread_handle(); //The writer inserts via the caller's connection.
+    #pragma omp parallel num_threads(2)
+    {
+        int threads = omp_get_num_threads(), me = omp_get_thread_num();
+        apop_db_handle *prior = apop_db_use(handle);
+        bool parsing = (threads == 1 || me == 0), writing = (threads == 1 || me == 1);
+        while (parsing || writing){
+            bool idle = true;
+            if (parsing && get_shared(&stop)) parsing = false;
+            if (parsing && produced - get_shared(&consumed) < ring_size){
+                line_batch_t *b = ring + produced % ring_size;
+                b->text_len = b->field_ct = b->line_ct = 0;
+                while (L.ct && !L.eof && b->line_ct < batch_lines){
+                    batch_add_line(b, line, L.ct, rows);
+                    do {
+                        L = parse_a_line(src, line, field_ends, classes);
+                        rows ++;
+                    } while (!L.ct && !L.eof); //skip blank lines
+                }
+                b->last = !(L.ct && !L.eof);
+                if (b->last) parsing = false;
+                set_shared(&produced, produced+1);
+                idle = false;
+            }
+            if (writing && consumed < get_shared(&produced)){
+                line_batch_t *b = ring + consumed % ring_size;
+                for (int i=0; i< b->line_ct && !*failed; i++){
+                    char *fields[b->lines[i].field_ct];
+                    for (int j=0; j< b->lines[i].field_ct; j++)
+                        fields[j] = b->text + b->starts[b->lines[i].first_field + j];
+                    *failed = insert_a_line(fields, b->lines[i].field_ct, ins, b->lines[i].row);
+                }
+                if (*failed) set_shared(&stop, 1);
+                if (b->last || *failed) writing = false;
+                set_shared(&consumed, consumed+1);
+                idle = false;
+            }
+            if (idle) sched_yield();
+        }
+        apop_db_use(prior);
+    }
+    for (int i=0; i< ring_size; i++){
+        free(ring[i].text);
+        free(ring[i].starts);
+        free(ring[i].lines);
     }
+    return rows;
 }
+#endif
 
 int apop_use_sqlite_prepared_statements(size_t col_ct){
     #if SQLITE_VERSION_NUMBER < 3003009
@@ -1056,17 +2067,35 @@ int apop_use_sqlite_prepared_statements(size_t col_ct){
     #endif
 }
 
-int apop_prepare_prepared_statements(char const *tabname, size_t col_ct, sqlite3_stmt **statement){
+//INSERT INTO tabname VALUES (?,?,?),(?,?,?), with rows parenthesized lists of col_ct blanks.
+char *apop_insert_statement(char const *tabname, size_t col_ct, size_t rows){
+    size_t len = strlen(tabname) + 21 + rows*(2*col_ct + 2);
+    char *q = malloc(len);
+    Apop_stopif(!q, return NULL, 0, "Allocation error.");
+    char *c = q + sprintf(q, "INSERT INTO %s VALUES ", tabname);
+    for (size_t r = 0; r < rows; r++){
+        if (r) *c++ = ',';
+        *c++ = '(';
+        for (size_t i = 0; i < col_ct; i++){
+            if (i) *c++ = ',';
+            *c++ = '?';
+        }
+        *c++ = ')';
+    }
+    *c = '\0';
+    return q;
+}
+
+int apop_prepare_prepared_statements(char const *tabname, size_t col_ct, size_t rows, sqlite3_stmt **statement){
     #if SQLITE_VERSION_NUMBER < 3003009
         Apop_stopif(1, return -1, 0, "Attempting to prepapre prepared statements, but using a version of SQLite that doesn't support them.");
     #else
-        char *q=NULL;
-        Asprintf(&q, "INSERT INTO %s VALUES (", tabname);
-        for (size_t i = 0; i < col_ct; i++)
-            xprintf(&q, "%s?%c", q, i==col_ct-1 ? ')' : ',');
-        Apop_stopif(!db, return -1, 0, "The database should be open by now but isn't.");
+        char *q = apop_insert_statement(tabname, col_ct, rows);
+        Apop_stopif(!q, return -1, 0, "Trouble writing the insert statement.");
+        sqlite3 *db = apop_sqlite_db();
+        Apop_stopif(!db, free(q); return -1, 0, "The database should be open by now but isn't.");
         Apop_stopif(sqlite3_prepare_v2(db, q, -1, statement, NULL) != SQLITE_OK, 
-                    return -1, apop_errorlevel, "Failure preparing prepared statement: %s", sqlite3_errmsg(db));
+                    free(q); return -1, apop_errorlevel, "Failure preparing prepared statement: %s", sqlite3_errmsg(db));
         free(q);
         return 0;
     #endif
@@ -1090,12 +2119,19 @@ See the \ref apop_ols page for an example that uses this function to read in sam
 
 Apophenia ships with an \c apop_text_to_db command-line utility, which is a wrapper for this function.
 
-Especially if you are using a pre-2007 version of SQLite, there may be a speedup to putting this function in a begin/commit wrapper:
+By default, each row is inserted in its own autocommitted transaction, which for a large
+file means a disk sync per row. Use the \c load argument (or set \ref apop_opts_type
+"apop_opts.db_load" for every load) to commit in batches, relax the journal and sync
+pragmas for the duration, and build indexes after the data is in:
 \code
-apop_query("begin;");
-apop_data_print(dataset, .output_name="dbtab", .output_type='d');
-apop_query("commit;");
+apop_text_to_db("survey.csv", .load=&(apop_db_load_type){.rows_per_commit=10000,
+                        .journal_mode="memory", .synchronous="off", .indexes=(char*[]){"age", NULL}});
 \endcode
+You can still wrap the call in your own <tt>begin;</tt>/<tt>commit;</tt> pair; if a
+transaction is open, the rows go into it. If an insertion fails partway through a load in
+batches, the batch in progress is rolled back, but the earlier batches are already
+committed, so the table holds the rows up to the last full batch. To load all or nothing,
+use your own transaction and roll it back on error.
 
 \param text_file    The name of the text file to be read in. If \c "-", then read from \c STDIN. (default: "-")
 \param tabname      The name to give the table in the database
@@ -1113,12 +2149,13 @@ apop_query("commit;");
 \c 'd' Retain the table but delete all data; refill with the new data (i.e., call <tt>"delete * from your_table"</tt>).<br>
 \c 'o' Overwrite the table from scratch; deleting the previous table entirely.<br>
 \c 'a' Append new data to the existing table.
+\param load Transaction, pragma, and index settings for the load; see \ref apop_db_load_type. (default: <tt>&apop_opts.db_load</tt>, which is all zeros unless you changed it, meaning one autocommitted insert per row and no indexes)
 
 \return Returns the number of rows on success, -1 on error.
 
 \li This function uses the \ref designated syntax for inputs.
 */
-APOP_VAR_HEAD int apop_text_to_db(char const *text_file, char *tabname, int has_row_names, int has_col_names, char **field_names, int const *field_ends, apop_data *field_params, char *table_params, char const *delimiters, char if_table_exists){
+APOP_VAR_HEAD int apop_text_to_db(char const *text_file, char *tabname, int has_row_names, int has_col_names, char **field_names, int const *field_ends, apop_data *field_params, char *table_params, char const *delimiters, char if_table_exists, apop_db_load_type const *load){
     char const *apop_varad_var(text_file, "-")
     char *apop_varad_var(tabname, cut_at_dot(text_file))
     int apop_varad_var(has_row_names, 'n')
@@ -1131,12 +2168,13 @@ APOP_VAR_HEAD int apop_text_to_db(char const *text_file, char *tabname, int has_
     char * apop_varad_var(table_params, NULL)
     const char * apop_varad_var(delimiters, apop_opts.input_delimiters);
     char apop_varad_var(if_table_exists, 'n')
+    apop_db_load_type const * apop_varad_var(load, &apop_opts.db_load)
 APOP_VAR_ENDHEAD
-    int  batch_size  = 10000,
-      	 col_ct, ct = 0, rows = 1;
+    int col_ct, rows = 1;
     FILE *infile;
+    text_decoder_t *dec;
     char buffer[bs];
-    size_t ptr = bs;
+    text_source_t src = {.buffer=buffer};
     apop_data *add_this_line = apop_data_alloc();
     sqlite3_stmt *statement = NULL;
     line_parse_t L = {1,0};
@@ -1153,10 +2191,14 @@ APOP_VAR_ENDHEAD
     }
 
     //get names and the first row.
-    if (prep_text_reading(text_file, &infile)) return -1;
+    char_classes_t classes;
+    set_char_classes(&classes, delimiters);
+    if (prep_text_reading(text_file, &infile, &dec)) return -1;
+    src.infile = infile;
+    src.dec = dec;
     apop_data *fn = apop_data_alloc();
-    get_field_names(has_col_names=='y', field_names, infile, buffer, &ptr,
-                                    add_this_line, fn, field_ends, delimiters);
+    get_field_names(has_col_names=='y', field_names, &src,
+                                    add_this_line, fn, field_ends, &classes);
     col_ct = L.ct = *add_this_line->textsize;
     Apop_stopif(!col_ct, return -1, 0, "counted zero columns in the input file (%s).", tabname);
     if (!tab_exists)
@@ -1168,35 +2210,42 @@ APOP_VAR_ENDHEAD
                     "so if errors crop up please see about installing a more recent version of SQLite's library.");
 #endif
     int use_sqlite_prepared_statements = apop_use_sqlite_prepared_statements(col_ct);
-    if (use_sqlite_prepared_statements)
-        Apop_stopif(apop_prepare_prepared_statements(tabname, col_ct, &statement), 
+    char *affinity = NULL;
+    if (use_sqlite_prepared_statements){
+        Apop_stopif(apop_prepare_prepared_statements(tabname, col_ct, 1, &statement), 
                 return -1, 0, "Trouble preparing the prepared statement for SQLite.");
+        affinity = get_affinities(tabname, tab_exists, has_row_names=='y', field_params, fn, col_ct);
+    }
     //done with table & query setup.
     //convert a data line into SQL: insert into TAB values (0.3, 7, "et cetera");
-	while(L.ct && !L.eof){
-        line_to_insert(L, add_this_line, tabname, statement, rows);
-        if (apop_opts.verbose > 1 && !(ct++ % batch_size)) 
-            {fprintf(stderr, "."); fflush(NULL);}
-        if (use_sqlite_prepared_statements){
-            int err = sqlite3_step(statement);
-            if (err!=0 && err != 101) //0=ok, 101=done
-                Apop_notify(0, "sqlite insert query gave error code %i.\n", err);
-            Apop_assert_c(!sqlite3_reset(statement), -1, apop_errorlevel, "SQLite error.");
-#if SQLITE_VERSION_NUMBER >= 3003009
-            Apop_assert_c(!sqlite3_clear_bindings(statement), -1, apop_errorlevel, "SQLite error."); //needed for NULLs
+    inserter_t ins = {.tabname=tabname, .statement=statement, .affinity=affinity,
+                      .col_ct=col_ct, .load=apop_db_load_begin(load)};
+    bool failed = false;
+#ifdef _OPENMP
+    if (statement && omp_get_max_threads() > 1 && !omp_in_parallel())
+        rows = text_to_db_pipelined(&src, add_this_line, L, rows, field_ends, &classes, &ins, &failed);
+    else
 #endif
-        }
+	while(L.ct && !L.eof){
+        char *fields[L.ct];
+        for (int i=0; i< L.ct; i++) fields[i] = *add_this_line->text[i];
+        if ((failed = insert_a_line(fields, L.ct, &ins, rows))) break;
         do {
-            L = parse_a_line(infile, buffer, &ptr, add_this_line, field_ends, delimiters);
+            L = parse_a_line(&src, add_this_line, field_ends, &classes);
             rows ++;
         } while (!L.ct && !L.eof); //skip blank lines
 	}
+    if (dec && dec->error) failed = true;
+    apop_db_load_end(&ins.load, failed ? NULL : tabname);
     apop_data_free(add_this_line);
+    free(src.field_caps);
+    free(affinity);
 #if SQLITE_VERSION_NUMBER >= 3003009
 	if (use_sqlite_prepared_statements){
         Apop_assert_c(sqlite3_finalize(statement) ==SQLITE_OK, -1, apop_errorlevel, "SQLite error.");
     }
 #endif
+    close_decoder(dec);
     if (strcmp(text_file,"-")) fclose(infile);
-	return rows;
+	return failed ? -1 : rows;
 }
@@ -3,6 +3,7 @@ The apop_data structure joins together a gsl_matrix, apop_name, and a table of s
 /* Copyright (c) 2006--2009 by Ben Klemens.  Licensed under the GPLv2; see COPYING.  */
 
 #include "apop_internal.h"
+#include <stdint.h>
 //apop_gsl_error is in apop_linear_algebra.c
 #define Set_gsl_handler gsl_error_handler_t *prior_handler = gsl_set_error_handler(apop_gsl_error);
 #define Unset_gsl_handler gsl_set_error_handler(prior_handler);
@@ -22,7 +23,7 @@ The \c weights vector is set to \c NULL. If you need it, allocate it via
 \return The \ref apop_data structure, allocated and ready to be populated with data.
 \exception out->error=='a'  Allocation error. The matrix, vector, or names couldn't be <tt>malloc</tt>ed, which probably means that you requested a very large data set.
 
-\li An \ref apop_data struct, by itself, is about 72 bytes. If I can't allocate that much memory, I return \c NULL.
+\li An \ref apop_data struct, by itself, is about 80 bytes. If I can't allocate that much memory, I return \c NULL.
                 But if even this much fails, your computer may be on fire and you should go put it out. 
 
 \li This function uses the \ref designated syntax for inputs.
@@ -110,11 +111,136 @@ APOP_VAR_ENDHEAD
 all point to the same nul string. */
 char *apop_nul_string = "";
 
+/* A text arena: rather than mallocing each cell, a data set may keep its text in a list
+   of large blocks, in which case d->textarena is not NULL. Query output gets an arena if
+   apop_opts.text_arena=='y', and copies of a set with an arena get one too. A cell in a
+   block is never freed on its own: apop_text_set writes the new text at the end of the
+   newest block and repoints the cell, and the old text stays until the set (and its
+   arena) is freed. Any cell that is not in one of the set's blocks was malloced by
+   somebody, and is freed as usual.
+
+   Blocks double in size from Text_block_min up to Text_block_max, so even a large set
+   has few blocks, and checking whether a cell is in one means checking each of them.
+   Each arena has only its own blocks; nothing keeps track of all arenas. */
+#define Text_block_min 4096
+#define Text_block_max (1<<24)
+
+typedef struct text_block {
+    struct text_block *next; //the next-older block of the same arena.
+    size_t size, used;
+    char data[];
+} text_block;
+
+struct apop_text_arena {
+    text_block *blocks; //newest first.
+    size_t next_size;
+};
+
+static int in_arena(struct apop_text_arena const *a, char const *p){
+    if (!a) return 0;
+    text_block const *b;
+    OMP_atomic(read seq_cst)
+    b = a->blocks;
+    for ( ; b; b = b->next)
+        if (p >= b->data && p < b->data + b->size) return 1;
+    return 0;
+}
+
+static void text_cell_free(struct apop_text_arena const *a, char *cell){
+    if (cell != apop_nul_string && !in_arena(a, cell)) free(cell);
+}
+
+/* Allocate an arena whose first block will hold at least size_hint bytes. The arena is
+   freed with the data set holding it; see apop_data_free. */
+struct apop_text_arena *apop_text_arena_alloc(size_t size_hint){
+    struct apop_text_arena *out = malloc(sizeof(struct apop_text_arena));
+    Apop_stopif(!out, return NULL, 0, "malloc failed. Probably out of memory.");
+    *out = (struct apop_text_arena){.next_size = size_hint ? size_hint : Text_block_min};
+    return out;
+}
+
+static void text_arena_free(struct apop_text_arena *a){
+    if (!a) return;
+    for (text_block *b = a->blocks, *next; b; b = next){
+        next = b->next;
+        free(b);
+    }
+    free(a);
+}
+
+//Start a new block in the arena with room for at least len bytes. Returns 1 on malloc failure.
+static int text_block_new(struct apop_text_arena *a, size_t len){
+    size_t size = GSL_MAX(len, a->next_size);
+    text_block *b = malloc(sizeof(text_block) + size);
+    if (!b) return 1;
+    *b = (text_block){.next=a->blocks, .size=size};
+    a->next_size = GSL_MIN(2*size, Text_block_max);
+    OMP_atomic(write seq_cst)
+    a->blocks = b;
+    return 0;
+}
+
+/* Set aside len bytes in the arena, starting a new block if need be. Returns NULL on
+   malloc failure. Threads writing to different cells of one set share its arena, so
+   they claim room in the newest block by an atomic add to its used count, and only
+   starting a block takes the lock. A claim that runs past the end of the block is
+   dropped, leaving the block marked as full. Blocks are started rarely (their sizes
+   double), so the lock taken to start one is shared by all arenas. */
+static char *text_arena_take(struct apop_text_arena *a, size_t len){
+    while (1){
+        text_block *b;
+        OMP_atomic(read seq_cst)
+        b = a->blocks;
+        if (b){
+            size_t at;
+            OMP_atomic(capture)
+            {at = b->used; b->used += len;}
+            if (at <= b->size && len <= b->size - at) return b->data + at;
+        }
+        int failed = 0;
+        OMP_critical(apop_text_block)
+        {
+            text_block *newest;
+            OMP_atomic(read seq_cst)
+            newest = a->blocks;
+            if (newest == b) failed = text_block_new(a, len); //else another thread just did.
+        }
+        Apop_stopif(failed, return NULL, 0, "malloc failed getting %zu bytes for text. Probably out of memory.", len);
+    }
+}
+
+//Copy the first len bytes of text into the arena, plus a terminating '\0'.
+char *apop_text_arena_copy(struct apop_text_arena *a, char const *text, size_t len){
+    char *out = text_arena_take(a, len+1);
+    if (!out) return NULL;
+    memcpy(out, text, len);
+    out[len] = '\0';
+    return out;
+}
+
+/* A copy of cell in the set's storage. A cell already in the set's arena can just be
+   shared, because it will never be freed on its own. */
+static char *text_cell_dup(apop_data *d, char *cell){
+    if (cell == apop_nul_string || in_arena(d->textarena, cell)) return cell;
+    return d->textarena ? apop_text_arena_copy(d->textarena, cell, strlen(cell)) : strdup(cell);
+}
+
 static void apop_text_blank(apop_data *in, const size_t row, const size_t col){
-    if (in->text[row][col] != apop_nul_string) free(in->text[row][col]);
+    text_cell_free(in->textarena, in->text[row][col]);
     in->text[row][col] = apop_nul_string;
 }
 
+//Free a text grid whose cells may be in the given arena (which may be NULL).
+static void text_grid_free(char ***freeme, int rows, int cols, struct apop_text_arena const *a){
+    if (rows && cols)
+        for (int i=0; i < rows; i++){
+            for (int j=0; j < cols; j++)
+                text_cell_free(a, freeme[i][j]);
+            free(freeme[i]);
+        }
+    free(freeme);
+}
+
 /** Free a matrix of chars* (i.e., a char***).
 This is what \c apop_data_free uses internally to deallocate the \c text element of
 an \ref apop_data set. You may never need to use it directly.
@@ -123,16 +249,194 @@ Sample usage:
 \code
 apop_text_free(yourdata->text, yourdata->textsize[0], yourdata->textsize[1]);
 \endcode
+
+\li This frees every cell, so don't use it on the text of a set whose text is in a
+text arena (see \ref apop_text_set); \ref apop_data_free and \ref apop_text_alloc know
+which cells to free.
 */
 void apop_text_free(char ***freeme, int rows, int cols){
-    if (rows && cols)
-        for (int i=0; i < rows; i++){
-            for (int j=0; j < cols; j++)
-                if(freeme[i][j]!=apop_nul_string) 
-                    free(freeme[i][j]);
-            free(freeme[i]);
+    text_grid_free(freeme, rows, cols, NULL);
+}
+
+/* A matrix or vector with room reserved past its last element (see apop_matrix_reserve),
+   or whose data is shared with other sets (see apop_data_share), has an apop_block in
+   place of its gsl_block, marked by an owner element of Apop_block_owner. The gsl_block
+   comes first and describes only the elements in use, so the GSL sees an ordinary owned
+   block, and gsl_block_free frees the data and the whole apop_block.
+
+   Every matrix or vector using an apop_block is counted in its holders, which is
+   changed atomically, so sets sharing a block can be written to or freed from different
+   threads. A holder that isn't the last to let go sets its owner to zero, so the GSL's
+   free functions leave the block to the others; a holder that is about to write or
+   resize first takes its own copy (see vector_unshare). */
+#define Apop_block_owner 2
+
+/** \cond doxy_ignore */
+typedef struct {
+    gsl_block block;
+    size_t capacity; //elements allocated at block.data, counting those in use.
+    int holders;     //matrices or vectors using this block.
+} apop_block;
+/** \endcond */
+
+static size_t block_capacity(gsl_block const *b, int owner){
+    return owner == Apop_block_owner ? ((apop_block const*)b)->capacity : b->size;
+}
+
+//Swap the gsl_block of an owned matrix or vector for an apop_block, if it isn't one already.
+static apop_block *block_for_room(gsl_block **b, int *owner){
+    if (*owner == Apop_block_owner) return (apop_block*)*b;
+    apop_block *out = malloc(sizeof(apop_block));
+    Apop_stopif(!out, return NULL, 0, "malloc failed. Probably out of memory.");
+    *out = (apop_block){.block=**b, .capacity=(*b)->size, .holders=1};
+    free(*b);
+    *b = &out->block;
+    *owner = Apop_block_owner;
+    return out;
+}
+
+static int block_holders(gsl_block const *b, int owner){
+    if (owner != Apop_block_owner) return 1;
+    int out;
+    OMP_atomic(read)
+    out = ((apop_block const*)b)->holders;
+    return out;
+}
+
+/* A matrix or vector is letting go of its block. If it wasn't the last holder, its owner
+   is set to zero, so gsl_*_free frees only the matrix or vector. */
+static void block_release(gsl_block *b, int *owner){
+    if (*owner != Apop_block_owner) return;
+    int left;
+    OMP_atomic(capture)
+    left = --((apop_block*)b)->holders;
+    if (left) *owner = 0;
+}
+
+//If other sets hold v's block, give v its own copy of the data.
+static void vector_unshare(gsl_vector *v){
+    if (!v || block_holders(v->block, v->owner) < 2) return;
+    gsl_block *was = v->block;
+    gsl_block *b = gsl_block_alloc(v->size);
+    Apop_stopif(!b, return, 0, "Allocation error on vector of size %zu.", v->size);
+    for (size_t i=0; i< v->size; i++)
+        b->data[i] = gsl_vector_get(v, i);
+    v->block = b;
+    v->data = b->data;
+    v->stride = 1;
+    block_release(was, &v->owner);
+    if (v->owner) gsl_block_free(was); //the other holders let go in the meantime.
+    v->owner = 1;
+}
+
+static void matrix_unshare(gsl_matrix *m){
+    if (!m || block_holders(m->block, m->owner) < 2) return;
+    gsl_block *was = m->block;
+    gsl_block *b = gsl_block_alloc(m->size1*m->size2);
+    Apop_stopif(!b, return, 0, "Allocation error on matrix of size %zu X %zu.", m->size1, m->size2);
+    for (size_t i=0; i< m->size1; i++)
+        memcpy(b->data + i*m->size2, m->data + i*m->tda, sizeof(double)*m->size2);
+    m->block = b;
+    m->data = b->data;
+    m->tda = m->size2;
+    block_release(was, &m->owner);
+    if (m->owner) gsl_block_free(was);
+    m->owner = 1;
+}
+
+/* Text and names shared among data sets by apop_data_share. Each has a count of the
+   sets holding it, and each holder points to that count: an apop_data set via its
+   ->shared element for its text, and an apop_name via its ->shared element for its
+   lists. A NULL pointer means the part is not shared. As with blocks, the counts are
+   changed atomically. */
+
+/* Count one more holder of the part whose count is *count, starting the count if the
+   part wasn't shared yet. Returns the count, or NULL on malloc failure. */
+int *apop_share_add(int **count){
+    if (!*count){
+        *count = malloc(sizeof(int));
+        Apop_stopif(!*count, return NULL, 0, "malloc failed. Probably out of memory.");
+        **count = 1;
+    }
+    OMP_atomic(update)
+    ++**count;
+    return *count;
+}
+
+//The number of holders of the part, or -1 if it is not shared.
+int apop_share_holders(int const *count){
+    if (!count) return -1;
+    int out;
+    OMP_atomic(read)
+    out = *count;
+    return out;
+}
+
+/* A holder is letting go of its part, and its pointer to the count is set to NULL.
+   Returns the number of holders left; at zero, the caller was the last holder and
+   should free the part. Returns -1 if the part was not shared, in which case the caller
+   owns it as usual. */
+int apop_share_release(int **count){
+    if (!*count) return -1;
+    int out;
+    OMP_atomic(capture)
+    out = --**count;
+    if (!out) free(*count);
+    *count = NULL;
+    return out;
+}
+
+/* One block sized to fit the text of d, for a copy of d's text. Text that was replaced
+   in d's arena is thereby dropped. */
+static struct apop_text_arena *text_arena_to_fit(apop_data const *d){
+    size_t total = 0;
+    for (size_t i=0; i< d->textsize[0]; i++)
+        for(size_t j=0; j < d->textsize[1]; j ++)
+            if (d->text[i][j] != apop_nul_string) total += strlen(d->text[i][j])+1;
+    return apop_text_arena_alloc(total);
+}
+
+static void text_unshare(apop_data *d){
+    if (!d->shared) return;
+    int ct = apop_share_holders(d->shared->text);
+    if (ct < 1) return;
+    if (ct > 1){
+        char ***was = d->text;
+        struct apop_text_arena *wasarena = d->textarena;
+        struct apop_text_arena *arena = wasarena ? text_arena_to_fit(d) : NULL;
+        char ***text = malloc(sizeof(char**) * d->textsize[0]);
+        Apop_stopif(!text || (wasarena && !arena), free(text); text_arena_free(arena); d->error='a'; return,
+                0, "Allocation error on text grid of size %zu X %zu.", d->textsize[0], d->textsize[1]);
+        for (size_t i=0; i< d->textsize[0]; i++){
+            text[i] = malloc(sizeof(char*) * d->textsize[1]);
+            Apop_stopif(!text[i], d->error='a'; return,
+                    0, "malloc failed setting up row %zu (with %zu columns). Probably out of memory.", i, d->textsize[1]);
+            for (size_t j=0; j< d->textsize[1]; j++){
+                char *cell = was[i][j];
+                text[i][j] = cell == apop_nul_string ? apop_nul_string
+                           : arena ? apop_text_arena_copy(arena, cell, strlen(cell))
+                           : strdup(cell);
+            }
         }
-    free(freeme);
+        d->text = text;
+        d->textarena = arena;
+        if (!apop_share_release(&d->shared->text)){
+            text_grid_free(was, d->textsize[0], d->textsize[1], wasarena);
+            text_arena_free(wasarena);
+        }
+        return;
+    }
+    apop_share_release(&d->shared->text);
+}
+
+//Give every part of this page (but not the later pages) its own copy, as apop_data_make_writable does.
+void apop_page_unshare(apop_data *d){
+    if (!d) return;
+    apop_name_unshare(d->names);
+    vector_unshare(d->vector);
+    vector_unshare(d->weights);
+    matrix_unshare(d->matrix);
+    if (d->shared) text_unshare(d);
 }
 
 /** Free the elements of the given \ref apop_data set and then the \ref apop_data set
@@ -146,6 +450,9 @@ For typical cases, that's slightly more useful than this function.
 I set <tt>freeme.error='c'</tt> and return. If you send in a structure like A -> B ->
 B, then both data sets A and B will be marked.
 
+\li For a set made by \ref apop_data_share, or the set it was made from, parts still
+held by other sets are left for them; the last set to let go of a part frees it.
+
 \return \c 0 on OK, \c 'c' on error.
 */
 char apop_data_free_base(apop_data *freeme){
@@ -158,6 +465,15 @@ char apop_data_free_base(apop_data *freeme){
             Apop_stopif(freeme->more->error == 'c', freeme->error='c'; return 'c', 
                                 1, "Propogating error code to parent data set");
     } 
+    //A part's data is freed only with its last holder.
+    if (freeme->vector)  block_release(freeme->vector->block, &freeme->vector->owner);
+    if (freeme->matrix)  block_release(freeme->matrix->block, &freeme->matrix->owner);
+    if (freeme->weights) block_release(freeme->weights->block, &freeme->weights->owner);
+    int text_holders = -1;
+    if (freeme->shared){
+        text_holders = apop_share_release(&freeme->shared->text);
+        free(freeme->shared);
+    }
     if (freeme->vector)  
         gsl_vector_free(freeme->vector);
     if (freeme->matrix)  
@@ -165,7 +481,10 @@ char apop_data_free_base(apop_data *freeme){
     if (freeme->weights)
         gsl_vector_free(freeme->weights);
     apop_name_free(freeme->names);
-    apop_text_free(freeme->text, freeme->textsize[0] , freeme->textsize[1]);
+    if (text_holders < 1){ //else other sets still hold the text.
+        text_grid_free(freeme->text, freeme->textsize[0] , freeme->textsize[1], freeme->textarena);
+        text_arena_free(freeme->textarena);
+    }
     free(freeme);
     return 0;
 }
@@ -204,6 +523,7 @@ void apop_data_memcpy(apop_data *out, const apop_data *in){
     if (!out && !in) return;
     Apop_stopif(!out, return, 0, "you are copying to a NULL matrix. Do you mean to use apop_data_copy instead?");
     Apop_stopif(out==in, return, 1, "out==in. Doing nothing.");
+    apop_page_unshare(out);
     if (in->matrix){
         Apop_stopif(!out->matrix, out->error='p'; return, 1, "in->matrix exists but out->matrix does not.");
         Apop_stopif(in->matrix->size1 != out->matrix->size1 || in->matrix->size2 != out->matrix->size2, 
@@ -231,6 +551,7 @@ void apop_data_memcpy(apop_data *out, const apop_data *in){
     }
     if (in->names){
         if (!out->names) out->names = apop_name_alloc();
+        apop_name_drop_index(out->names, 'a'); //names may be rewritten in place below.
         Asprintf(&out->names->title, "%s", in->names->title);
         if (out->names->vector && in->names->vector) {Asprintf(&out->names->vector, "%s", in->names->vector);}
         for (int i=0; i< in->names->rowct; i++)
@@ -242,6 +563,7 @@ void apop_data_memcpy(apop_data *out, const apop_data *in){
         for (int i=0; i< in->names->textct; i++)
             if (i< out->names->textct) {Asprintf(out->names->text+i, "%s", in->names->text[i]);}
             else  apop_name_add(out->names, in->names->text[i], 't');
+        apop_name_reindex(out->names, 'a');
     }
     out->textsize[0] = in->textsize[0]; 
     out->textsize[1] = in->textsize[1]; 
@@ -256,6 +578,11 @@ void apop_data_memcpy(apop_data *out, const apop_data *in){
             for(size_t j=0; j < in->textsize[1]; j ++)
                 if (in->text[i][j] == apop_nul_string)
                      apop_text_blank(out, i, j);
+                else if (out->textarena && out->textarena == in->textarena
+                            && in_arena(in->textarena, in->text[i][j])){
+                    text_cell_free(out->textarena, out->text[i][j]);
+                    out->text[i][j] = in->text[i][j]; //e.g., Apop_r views of one set.
+                }
                 else apop_text_set(out, i, j, "%s", in->text[i][j]);
     }
     if (in->more && out->more) apop_data_memcpy(out->more, in->more);
@@ -265,6 +592,8 @@ void apop_data_memcpy(apop_data *out, const apop_data *in){
 
 Basically a front-end for \ref apop_data_memcpy for those who prefer this sort of syntax. 
 
+If the copy will mostly be read, \ref apop_data_share is faster and takes less memory.
+
 If the data set has a \c more pointer, that will be followed and subsequent pages copied as well.
  
   \param in    the input data
@@ -312,11 +641,155 @@ apop_data *apop_data_copy(const apop_data *in){
     if (in->textsize[0] && in->textsize[1]){
         apop_text_alloc(out, in->textsize[0], in->textsize[1]);
         Apop_stopif(out->error, return out, 0, "Allocation error on text grid of size %zu X %zu.", in->textsize[0], in->textsize[1]);
+        if (in->textarena) out->textarena = text_arena_to_fit(in);
     }
     apop_data_memcpy(out, in);
     return out;
 }
 
+//A new vector using the same block as in, which stays owned by in as well.
+static gsl_vector *vector_share(gsl_vector *in){
+    gsl_vector *out = malloc(sizeof(gsl_vector));
+    apop_block *b = out ? block_for_room(&in->block, &in->owner) : NULL;
+    Apop_stopif(!b, free(out); return NULL, 0, "Allocation error.");
+    OMP_atomic(update)
+    b->holders++;
+    *out = *in;
+    return out;
+}
+
+static gsl_matrix *matrix_share(gsl_matrix *in){
+    gsl_matrix *out = malloc(sizeof(gsl_matrix));
+    apop_block *b = out ? block_for_room(&in->block, &in->owner) : NULL;
+    Apop_stopif(!b, free(out); return NULL, 0, "Allocation error.");
+    OMP_atomic(update)
+    b->holders++;
+    *out = *in;
+    return out;
+}
+
+/* A part that doesn't own its data is a view of something else (e.g., from Apop_r),
+   which we can't share; the page is copied instead. Name lists with no allocated
+   capacity are likewise someone else's. */
+static int page_is_shareable(apop_data const *d){
+    #define Shareable_part(p) (!d->p || d->p->owner)
+    if (!Shareable_part(vector) || !Shareable_part(weights) || !Shareable_part(matrix))
+        return 0;
+    apop_name const *n = d->names;
+    return !n || ((!n->rowct || n->rowcap) && (!n->colct || n->colcap) && (!n->textct || n->textcap));
+}
+
+static apop_data *page_copy(apop_data const *in){
+    apop_data page = *in;
+    page.more = NULL;
+    return apop_data_copy(&page);
+}
+
+/** Make a copy of a data set that shares the vector, matrix, weights, text, and names
+of the original, instead of duplicating them. A part is copied only when one of the sets
+holding it writes to it, so for a large data set that will be only read, or written to
+in only a few places, this is much faster than \ref apop_data_copy and takes almost no
+additional memory.
+
+The original and the new set are on equal footing: either can be written to, resized,
+or freed first, and the other is unaffected. The original still owns its vector,
+matrix, and weights, as does the new set.
+
+\li Writing via \ref apop_data_set, \ref apop_data_ptr, \ref apop_text_set, \ref
+apop_text_alloc, or \ref apop_name_add first gives the set being written to its own
+copy of the part being written. So does resizing a vector or matrix via \ref
+apop_vector_realloc, \ref apop_matrix_realloc, \ref apop_vector_reserve, or \ref
+apop_matrix_reserve. Other functions of the library that modify their inputs, like
+\ref apop_data_stack with <tt>.inplace='y'</tt>, \ref apop_data_reserve, \ref
+apop_data_sort, \ref apop_data_rm_rows, \ref apop_data_memcpy, or \ref apop_map with
+<tt>.inplace='y'</tt>, first give the page their own copy of all of its parts.
+
+\li This is copy-on-write only for writes via Apophenia's functions. Views like \ref
+Apop_r and \ref Apop_c, and the GSL's own functions, know nothing of sharing, so
+writing through them, to the original or the new set, writes to every set holding the
+part. Before writing to a set that way, call \ref apop_data_make_writable on it.
+For this reason, the functions of the library that copy their inputs in order to write
+to the copy, like \ref apop_data_sort with <tt>.inplace='n'</tt>, \ref
+apop_bootstrap_cov, or \ref apop_model_copy, still make a full copy via \ref
+apop_data_copy.
+
+\li Each set counts the other sets holding its parts, and the counts are updated
+atomically, so sets sharing parts can be written to or freed in different threads. But
+sharing the same input set from two threads at once is not safe.
+
+\li Free shared sets with \ref apop_data_free, which frees a part along with the last set
+holding it. While parts are shared, do not free or replace a part of either set (e.g.,
+<tt>gsl_vector_free(d->vector)</tt>) directly; call \ref apop_data_make_writable first.
+
+\li If the input has pages that are views of other data (e.g., the output of \ref Apop_r),
+they are copied as per \ref apop_data_copy.
+
+\li The \c more pages are shared as well.
+
+  \param in    the input data
+  \return       a new \ref apop_data set sharing the parts of the input. If input is NULL, then this will be NULL.
+
+\exception out.error='a'  Allocation error.
+\exception out.error='c'  Cyclic link: <tt>D->more == D</tt>. You'll have only a partial copy.
+*/
+apop_data *apop_data_share(apop_data *in){
+    if (!in) return NULL;
+    apop_data *out = NULL;
+    if (page_is_shareable(in)){
+        out = malloc(sizeof(apop_data));
+        Apop_stopif(!out, return NULL, 0, "malloc failed. Probably out of memory.");
+        *out = (apop_data){.textsize = {in->textsize[0], in->textsize[1]}, .error = in->error,
+                           .shared = calloc(1, sizeof(struct apop_data_shares))};
+        if (!in->shared) in->shared = calloc(1, sizeof(struct apop_data_shares));
+        struct apop_data_shares *ins = in->shared, *outs = out->shared;
+        if (!ins || !outs
+                || (in->vector && !(out->vector = vector_share(in->vector)))
+                || (in->weights && !(out->weights = vector_share(in->weights)))
+                || (in->matrix && !(out->matrix = matrix_share(in->matrix)))
+                || (in->names && !(out->names = apop_name_share(in->names)))
+                || (in->text && !(outs->text = apop_share_add(&ins->text)))){
+            out->textsize[0] = out->textsize[1] = 0;
+            apop_data_free(out);
+        } else {
+            out->text = in->text;
+            out->textarena = in->textarena;
+        }
+    }
+    if (!out){
+        out = page_copy(in);
+        Apop_stopif(!out || (out->error && out->error != in->error), return out, 0, "Allocation error.");
+    }
+    if (in->more){
+        Apop_stopif(in == in->more, out->error='c'; return out,
+                0, "the ->more element of this data set equals the "
+                                        "data set itself. This is not healthy. Made a partial copy and set out.error='c'.");
+        out->more = apop_data_share(in->more);
+        Apop_stopif(!out->more || out->more->error, out->error=out->more ? out->more->error : 'a'; return out,
+                0, "propagating an error in the ->more element to the parent apop_data set. Only a partial copy made.");
+    }
+    return out;
+}
+
+/** Give a data set made by \ref apop_data_share, or a data set that has been shared,
+its own copy of every part it shares with other sets, so it can be modified in any way
+without affecting the others. For parts that no other set holds anymore, the data set
+just takes ownership, with no copying. For a set that shares nothing, this does nothing.
+
+\param d The data set. All pages are made writable.
+\return \c d
+\exception d->error=='a'  Allocation error.
+\exception d->error=='c'  Cyclic link: <tt>D->more == D</tt>.
+*/
+apop_data *apop_data_make_writable(apop_data *d){
+    for (apop_data *p = d; p; p = p->more){
+        apop_page_unshare(p);
+        Apop_stopif(p->error, d->error = p->error; return d, 0, "Allocation error.");
+        Apop_stopif(p == p->more, d->error='c'; return d, 1, "the ->more element of this data set equals the "
+                "data set itself. This is not healthy. Setting error='c'.");
+    }
+    return d;
+}
+
 /** Put the first data set either on top of or to the left of the second data set.
 
 For the opposite operation, see \ref apop_data_split.
@@ -326,7 +799,7 @@ For the opposite operation, see \ref apop_data_split.
 \param  posn    If 'r', stack rows of m1 above rows of m2<br>
     if 'c', stack columns of m1 to left of m2's<br>
     (default = 'r')
-\param  inplace If \c 'y', use \ref apop_matrix_realloc and \ref apop_vector_realloc to modify \c m1 in place. Otherwise, allocate a new \ref apop_data set, leaving \c m1 undisturbed. (default='n')
+\param  inplace If \c 'y', use \ref apop_matrix_realloc and \ref apop_vector_realloc to modify \c m1 in place. Otherwise, allocate a new \ref apop_data set, leaving \c m1 undisturbed. When stacking rows in place, room for more rows is set aside as the parts grow, doubling each time it runs out, so a loop that appends one row at a time takes time linear in the final row count; see \ref apop_data_shrink_to_fit. (default='n')
 \return         The stacked data, either in a new \ref apop_data set or \c m1
 \exception out->error=='a' Allocation error.
 \exception out->error=='d'  Dimension error; couldn't make a complete copy.
@@ -361,9 +834,10 @@ APOP_VAR_ENDHEAD
     if (!m1) return apop_data_copy(m2);
     if (!m2) return inplace ? m1 : apop_data_copy(m1);
     apop_data *out = NULL;
-    if (inplace)
+    if (inplace){
+        apop_page_unshare(m1);
         out = m1;
-    else {
+    } else {
         apop_data *m = m1->more; //not following the more pointer.
         m1->more =NULL;
         out = apop_data_copy(m1);
@@ -608,11 +1082,14 @@ allocation:
             apop_text_alloc(out[1], in->textsize[0]-splitpoint, in->textsize[1]);
             Apop_stopif(out[1]->error, return out, 0, "Allocation error.");
         }
+        if (in->textarena)
+            for (int k=0; k< 2; k++)
+                if (out[k] && out[k]->textsize[0]) out[k]->textarena = apop_text_arena_alloc(0);
         for (int i=0; i< in->textsize[0]; i++)
             for (int j=0; j< in->textsize[1]; j++){
                 int whichtext = (i >= splitpoint);
                 int row = whichtext ? i - splitpoint : i;
-                Asprintf(&(out[whichtext]->text[row][j]), "%s", in->text[i][j]);
+                apop_text_set(out[whichtext], row, j, "%s", in->text[i][j]);
             }
     }
     return out;
@@ -625,6 +1102,7 @@ allocation:
 \see \ref apop_data_prune_columns
 */
 static void apop_name_rm_columns(apop_name *n, int *drop){
+    apop_name_drop_index(n, 'c');
     apop_name *newname = apop_name_alloc();
     size_t initial_colct = n->colct;
     for (size_t i=0; i< initial_colct; i++){
@@ -633,10 +1111,16 @@ static void apop_name_rm_columns(apop_name *n, int *drop){
         free(n->col[i]);
     }
     free(n->col);
+    free(n->colhash);
     n->col = newname->col;
+    n->colhash = newname->colhash;
+    n->colcap = newname->colcap;
+    n->colindex = newname->colindex;
 
     //we need to free the newname struct, but leave the column intact.
     newname->col = NULL;
+    newname->colhash = NULL;
+    newname->colindex = NULL;
     newname->colct  = 0;
     apop_name_free(newname);
 }
@@ -677,7 +1161,9 @@ quickly fill an array of ints with nonzero values.
 void apop_data_rm_columns(apop_data *d, int *drop){
     gsl_matrix *freeme = d->matrix;
     d->matrix = apop_matrix_rm_columns(d->matrix, drop);
-    gsl_matrix_free(freeme); 
+    block_release(freeme->block, &freeme->owner);
+    gsl_matrix_free(freeme);
+    apop_name_unshare(d->names);
     apop_name_rm_columns(d->names, drop);
 }
 
@@ -787,9 +1273,11 @@ APOP_VAR_HEAD double * apop_data_ptr(apop_data *data, int row, int col, const ch
 APOP_VAR_ENDHEAD
     if (col == -1 || (col == 0 && !data->matrix && data->vector)){
         Apop_stopif(!data->vector, return NULL, 1, "You asked for the vector element (col=-1) but it is NULL. Returning NULL.");
+        vector_unshare(data->vector);
         return gsl_vector_ptr(data->vector, row);
     } else {
         Apop_stopif(!data->matrix, return NULL, 1, "You asked for the matrix element (%i, %i) but the matrix is NULL Returning NULL..", row, col);
+        matrix_unshare(data->matrix);
         return gsl_matrix_ptr(data->matrix, row,col);
     }
     return NULL;//the main function is blank.
@@ -904,9 +1392,11 @@ APOP_VAR_ENDHEAD
     Set_gsl_handler
     if (col==-1 || (col == 0 && !data->matrix && data->vector)){
         Apop_stopif(!data->vector, return -1, 1, "You're trying to set a vector element (row=-1) but the vector is NULL.");
+        vector_unshare(data->vector);
         gsl_vector_set(data->vector, row, val);
     } else {
         Apop_stopif(!data->matrix, return -1, 1, "You're trying to set the matrix element (%zu, %i) but the matrix is NULL.", row, col);
+        matrix_unshare(data->matrix);
         gsl_matrix_set(data->matrix, row, col, val);
     }
     Unset_gsl_handler
@@ -944,10 +1434,11 @@ height = Lookup(list, height);
 void apop_data_add_named_elmt(apop_data *d, char *name, double val){
     Apop_stopif(!d, return, 0, "You sent me a NULL apop_data set. "
                                "Maybe allocate with apop_data_alloc() to start.");
+    apop_page_unshare(d);
     apop_name_add(d->names, name, 'r');
     if (!d->vector) d->vector = gsl_vector_alloc(1);
     if (d->vector->size < d->names->rowct)
-        apop_vector_realloc(d->vector, d->names->rowct);
+        apop_vector_grow(d->vector, d->names->rowct);
     gsl_vector_set(d->vector, d->names->rowct-1, val);
 }
 
@@ -979,6 +1470,16 @@ then I display an error rather than reallocating the text matrix.
   \li If there had been a string at the grid point you are writing to,
 the old one is freed to prevent leaks. Remember this if you had other pointers aliasing
 that string.
+  \li If <tt>apop_opts.text_arena=='y'</tt>, the output of \ref apop_query_to_text and
+\ref apop_query_to_mixed_data, and copies of such sets, keep their text in a few large
+blocks owned by the data set (and <tt>in->textarena</tt> is not \c NULL), which is much
+faster to allocate and free than a separate string per cell. For such a set, this
+function writes the new text to the set's blocks, and the old text is not freed until
+the whole set is. So if you are replacing many cells many times over, you may want to
+occasionally swap in an \ref apop_data_copy, which keeps only the current text. Never
+\c free a cell of such a set yourself; use this function, \ref apop_text_alloc, or \ref
+apop_data_free. Sets without a text arena (the default) have one malloced string per
+cell, which you may free and replace as you like.
   \li If an element is \c NULL, write <tt>apop_opts.nan_string</tt> at that point. You
 may prefer to use <tt>""</tt> to express a blank.
   \li \ref apop_text_alloc will reallocate to a new size if you need. For example,
@@ -997,15 +1498,34 @@ int apop_text_set(apop_data *in, const size_t row, const size_t col, const char
     Apop_stopif((in->textsize[0] < (int)row+1) || (in->textsize[1] < (int)col+1), return -1, 0, "You asked me to put the text "
                             " '%s' at position (%zu, %zu), but the text array has size (%zu, %zu)\n", 
                                fmt,             row, col,                  in->textsize[0], in->textsize[1]);
-    if (in->text[row][col] != apop_nul_string) free(in->text[row][col]);
+    text_unshare(in);
+    char *was = in->text[row][col]; //freed after writing, in case it is one of the inputs.
     if (!fmt){
-        Asprintf(&(in->text[row][col]), "%s", apop_opts.nan_string);
+        if (in->textarena)
+             in->text[row][col] = apop_text_arena_copy(in->textarena, apop_opts.nan_string, strlen(apop_opts.nan_string));
+        else Asprintf(&(in->text[row][col]), "%s", apop_opts.nan_string);
+        text_cell_free(in->textarena, was);
         return 0;
     }
     va_list argp;
 	va_start(argp, fmt);
-    Apop_stopif(vasprintf(&(in->text[row][col]), fmt, argp)==-1, , 0, "Trouble writing to a string.");
+    if (!in->textarena)
+        Apop_stopif(vasprintf(&(in->text[row][col]), fmt, argp)==-1, , 0, "Trouble writing to a string.");
+    else if (!strcmp(fmt, "%s")){
+        char const *str = va_arg(argp, char const*);
+        in->text[row][col] = apop_text_arena_copy(in->textarena, str, strlen(str));
+    } else {
+        va_list argcopy;
+        va_copy(argcopy, argp);
+        int len = vsnprintf(NULL, 0, fmt, argcopy);
+        va_end(argcopy);
+        char *cell = len < 0 ? NULL : text_arena_take(in->textarena, len+1);
+        Apop_stopif(!cell, va_end(argp); return -1, 0, "Trouble writing to a string.");
+        vsnprintf(cell, len+1, fmt, argp);
+        in->text[row][col] = cell;
+    }
 	va_end(argp);
+    text_cell_free(in->textarena, was);
     return 0;
 }
 
@@ -1039,13 +1559,13 @@ apop_data * apop_text_alloc(apop_data *in, const size_t row, const size_t col){
                     in->text[i][j] = apop_nul_string;
             }
     } else { //realloc
+        text_unshare(in);
         size_t rows_now = in->textsize[0];
         size_t cols_now = in->textsize[1];
         if (rows_now > row){
             for (int i=row; i < rows_now; i++){
                 for (int j=0; j < cols_now; j++)
-                    if (in->text[i][j] != apop_nul_string) 
-                        free(in->text[i][j]);
+                    text_cell_free(in->textarena, in->text[i][j]);
                 free(in->text[i]);
             }
             in->text = realloc(in->text, sizeof(char**)*row);
@@ -1068,8 +1588,7 @@ apop_data * apop_text_alloc(apop_data *in, const size_t row, const size_t col){
         if (cols_now > col)
             for (int i=0; i < row; i++)
                 for (int j=col; j < cols_now; j++)
-                    if (in->text[i][j]!=apop_nul_string) 
-                        free(in->text[i][j]);
+                    text_cell_free(in->textarena, in->text[i][j]);
         if (cols_now != col)
             for (int i=0; i < row; i++){
                 in->text[i] = realloc(in->text[i], sizeof(char*)*col);
@@ -1120,6 +1639,7 @@ APOP_VAR_ENDHEAD
                                     : apop_data_alloc(0, in->matrix ? in->matrix->size2 : 0
                                                        , in->matrix ? in->matrix->size1 : 0);
     if (inplace=='y'){
+        apop_page_unshare(in);
         if (in->matrix) {
             if (in->matrix->size1 == in->matrix->size2)
                 gsl_matrix_transpose(in->matrix);
@@ -1134,9 +1654,18 @@ APOP_VAR_ENDHEAD
             char **tmp = out->names->col;
             out->names->col = out->names->row;
             out->names->row = tmp;
+            unsigned long *tmphash = out->names->colhash;
+            out->names->colhash = out->names->rowhash;
+            out->names->rowhash = tmphash;
             int tmpct = out->names->colct;
             out->names->colct = out->names->rowct;
             out->names->rowct = tmpct;
+            tmpct = out->names->colcap;
+            out->names->colcap = out->names->rowcap;
+            out->names->rowcap = tmpct;
+            struct apop_name_index *tmpindex = out->names->colindex;
+            out->names->colindex = out->names->rowindex;
+            out->names->rowindex = tmpindex;
         }
     } else if (inplace!='y' && in->matrix){
         if (in->matrix) gsl_matrix_transpose_memcpy(out->matrix, in->matrix);
@@ -1153,9 +1682,7 @@ APOP_VAR_ENDHEAD
                 Apop_stopif(!in->text[i], in->error='a'; return in, 
                         0, "malloc failed setting up row %zu (with %zu columns). Probably out of memory.", i, orows);
                 for (int j=ocols; j < orows; j++)
-                    in->text[i][j] = in->text[j][i] == apop_nul_string
-                                        ? apop_nul_string
-                                        : strdup(in->text[j][i]);
+                    in->text[i][j] = text_cell_dup(in, in->text[j][i]);
             }
         }
         if (ocols > orows){ //add rows.
@@ -1167,9 +1694,7 @@ APOP_VAR_ENDHEAD
                 Apop_stopif(!in->text[i], in->error='a'; return in, 
                         0, "malloc failed setting up row %zu (with %zu columns). Probably out of memory.", i, orows);
                 for (int j=0; j < orows; j++)
-                    in->text[i][j] = in->text[j][i] == apop_nul_string
-                                        ? apop_nul_string
-                                        : strdup(in->text[j][i]);
+                    in->text[i][j] = text_cell_dup(in, in->text[j][i]);
             }
         }
         size_t squaresize = GSL_MIN(orows, ocols);
@@ -1183,11 +1708,12 @@ APOP_VAR_ENDHEAD
         in->textsize[1] = orows;
     } else {
         apop_text_alloc(out, in->textsize[1], in->textsize[0]);
+        if (in->textarena) out->textarena = apop_text_arena_alloc(0);
         for (int r=0; r< in->textsize[0]; r++)
             for (int c=0; c< in->textsize[1]; c++)
                 if (in->text[r][c] == apop_nul_string)
                      apop_text_blank(out, c, r);
-                else apop_text_set(out, c, r, in->text[r][c]);
+                else apop_text_set(out, c, r, "%s", in->text[r][c]);
     }
     if (in->names && in->names->textct && !in->names->colct)
         apop_name_stack(out->names, in->names, 't', 'r');
@@ -1201,6 +1727,9 @@ Data in the matrix will be retained. If the new height or width is smaller than
   \li A large number of <tt>realloc</tt>s can take a noticeable amount of time. You
 are encouraged to determine the size of your data beforehand and avoid writing \c for
 loops that reallocate the matrix at every iteration.
+  \li If you know roughly how many rows are coming, use \ref apop_matrix_reserve to
+set aside room for them. Adding rows that fit in the reserved room takes no reallocation.
+Resizing to fewer rows, or to the current height, releases the reserved room.
   \li The <tt>gsl_matrix</tt> is a versatile struct that can represent submatrices and
 other cuts from parent data. Resizing a subset of a parent matrix makes no sense,
 so return \c NULL and print a warning if asked to resize a view of a matrix.
@@ -1215,7 +1744,14 @@ gsl_matrix * apop_matrix_realloc(gsl_matrix *m, size_t newheight, size_t newwidt
     size_t i, oldoffset=0, newoffset=0, realloced = 0;
     Apop_stopif(m->block->data!=m->data || !m->owner || m->tda != m->size2,
             return NULL, 0, "I can't resize submatrices or other subviews.");
+    matrix_unshare(m);
+    if (newwidth == m->size2 && newheight > m->size1 && newheight*newwidth <= block_capacity(m->block, m->owner)){
+        m->size1 = newheight; //fits in the reserved room.
+        m->block->size = newheight * newwidth;
+        return m;
+    }
     m->block->size = newheight * newwidth;
+    if (m->owner == Apop_block_owner) ((apop_block*)m->block)->capacity = m->block->size;
     if (m->size2 > newwidth)
         for (i=1; i< GSL_MIN(m->size1, newheight); i++){
             oldoffset +=m->size2;
@@ -1250,6 +1786,9 @@ to zero out or otherwise fill them before use.
   \li A large number of <tt>realloc</tt>s can take a noticeable amount of time. You
 are thus encouraged to make an effort to determine the size of your data and do one
 allocation, rather than writing \c for loops that resize a vector at every increment.
+  \li As with \ref apop_matrix_realloc, growing into room set aside by \ref
+apop_vector_reserve takes no reallocation, and resizing to the current length or
+shorter releases the reserved room.
   \li The <tt>gsl_vector</tt> is a versatile struct that
 can represent subvectors, matrix columns and other cuts from parent data. 
 Resizing a portion of a parent matrix makes no sense, so
@@ -1263,13 +1802,140 @@ gsl_vector * apop_vector_realloc(gsl_vector *v, size_t newheight){
     if (!v) return newheight ? gsl_vector_alloc(newheight) : NULL;
     Apop_stopif(v->block->data!=v->data || !v->owner || v->stride != 1,
                     return NULL, 0, "I can't resize subvectors or other views.");
+    vector_unshare(v);
+    if (newheight > v->size && newheight <= block_capacity(v->block, v->owner)){
+        v->size = v->block->size = newheight; //fits in the reserved room.
+        return v;
+    }
     v->block->size = newheight;
+    if (v->owner == Apop_block_owner) ((apop_block*)v->block)->capacity = newheight;
     v->size = newheight;
     v->block->data = 
     v->data        = realloc(v->data, sizeof(double) * v->block->size);
     return v;
 }
 
+/** Set aside room for a matrix to grow to the given number of rows, so that later calls
+to \ref apop_matrix_realloc (or \ref apop_matrix_stack with <tt>.inplace='y'</tt>) that
+add rows up to that count take no reallocation. The height of the matrix, \c size1, is
+unchanged, as is the matrix's \c block, which still describes only the elements in use
+(<tt>block->size == size1*size2</tt>), so the matrix works with the GSL and views as
+before. The room is tracked separately, and \c gsl_matrix_free or \ref apop_data_free
+frees it along with the matrix.
+
+\param m The already-allocated matrix. If \c NULL, return \c NULL.
+\param rows The number of rows to make room for. If the matrix already has room for
+this many rows, do nothing.
+\return \c m, or \c NULL if \c m is a view of another matrix.
+
+\li Resize to the current height, <tt>apop_matrix_realloc(m, m->size1, m->size2)</tt>,
+to release the room again. See also \ref apop_data_shrink_to_fit.
+ */
+gsl_matrix * apop_matrix_reserve(gsl_matrix *m, size_t rows){
+    if (!m) return NULL;
+    Apop_stopif(m->block->data!=m->data || !m->owner || m->tda != m->size2,
+            return NULL, 0, "I can't reserve room in submatrices or other subviews.");
+    matrix_unshare(m);
+    if (rows*m->size2 <= block_capacity(m->block, m->owner)) return m;
+    apop_block *b = block_for_room(&m->block, &m->owner);
+    double *data = b ? realloc(m->data, sizeof(double) * rows*m->size2) : NULL;
+    Apop_stopif(!data, return m, 0, "realloc failed reserving %zu rows. Probably out of memory.", rows);
+    b->block.data = m->data = data;
+    b->capacity = rows*m->size2;
+    return m;
+}
+
+/** Set aside room for a vector to grow to the given length, so that later calls to \ref
+apop_vector_realloc (or \ref apop_vector_stack with <tt>.inplace='y'</tt>) up to that
+length take no reallocation. See \ref apop_matrix_reserve for details.
+
+\param v The already-allocated vector. If \c NULL, return \c NULL.
+\param size The length to make room for.
+\return \c v, or \c NULL if \c v is a view.
+ */
+gsl_vector * apop_vector_reserve(gsl_vector *v, size_t size){
+    if (!v) return NULL;
+    Apop_stopif(v->block->data!=v->data || !v->owner || v->stride != 1,
+                    return NULL, 0, "I can't reserve room in subvectors or other views.");
+    vector_unshare(v);
+    if (size <= block_capacity(v->block, v->owner)) return v;
+    apop_block *b = block_for_room(&v->block, &v->owner);
+    double *data = b ? realloc(v->data, sizeof(double) * size) : NULL;
+    Apop_stopif(!data, return v, 0, "realloc failed reserving %zu elements. Probably out of memory.", size);
+    b->block.data = v->data = data;
+    b->capacity = size;
+    return v;
+}
+
+/* For appends: resize as apop_*_realloc does, but when adding rows past the reserved
+   room, reserve at least double the old room, so n one-row appends cost O(n) copying
+   in total, not O(n^2). */
+gsl_matrix * apop_matrix_grow(gsl_matrix *m, size_t newheight, size_t newwidth){
+    if (m && m->owner && newwidth == m->size2 && newheight*newwidth > block_capacity(m->block, m->owner))
+        apop_matrix_reserve(m, GSL_MAX(newheight, 2*(block_capacity(m->block, m->owner)/m->size2)));
+    return apop_matrix_realloc(m, newheight, newwidth);
+}
+
+/* For a block of rows that is refilled from the top on each call, like those from
+   apop_text_stream_next: make sure m (of width cols) has a row n, growing into reserved
+   room that doubles, up to max_rows rows, as it runs out. Existing rows are kept, so
+   refilling a block of the same height takes no reallocation. */
+gsl_matrix * apop_matrix_room_for_row(gsl_matrix *m, size_t n, size_t cols, size_t max_rows){
+    if (!m) return apop_matrix_realloc(NULL, GSL_MAX(n+1, GSL_MIN(1024, max_rows)), cols);
+    if (n < m->size1) return m;
+    if ((n+1)*cols > block_capacity(m->block, m->owner) && !apop_matrix_reserve(m, GSL_MAX(n+1, GSL_MIN(GSL_MAX(2*n, 1024), max_rows))))
+        return NULL;
+    return apop_matrix_realloc(m, n+1, cols);
+}
+
+gsl_vector * apop_vector_grow(gsl_vector *v, size_t newheight){
+    if (v && v->owner && newheight > block_capacity(v->block, v->owner))
+        apop_vector_reserve(v, GSL_MAX(newheight, 2*block_capacity(v->block, v->owner)));
+    return apop_vector_realloc(v, newheight);
+}
+
+/** Set aside room for the given number of rows in the vector, matrix, and weights of a
+data set, so that stacking rows onto it via <tt>apop_data_stack(d, new_rows,
+.inplace='y')</tt> takes no reallocation of those parts until the room runs out. Row
+sizes are unchanged.
+
+\param d The data set. The \c more pages are ignored.
+\param rows The number of rows to make room for.
+\return \c d
+\exception d->error=='a' Allocation error; one of the parts is a view.
+
+\li Text and names are not reserved.
+\li Stacking rows in place already sets aside room as it goes, doubling it each time it
+runs out, so you need this only if you know the final count beforehand.
+\li Use \ref apop_data_shrink_to_fit to release any room left over.
+ */
+apop_data * apop_data_reserve(apop_data *d, size_t rows){
+    Apop_stopif(!d, return NULL, 1, "You sent me a NULL data set. Returning NULL.");
+    apop_page_unshare(d);
+    Apop_stopif((d->vector && !apop_vector_reserve(d->vector, rows))
+                || (d->weights && !apop_vector_reserve(d->weights, rows))
+                || (d->matrix && !apop_matrix_reserve(d->matrix, rows)),
+                d->error='a', 0, "Couldn't reserve rows in a view.");
+    return d;
+}
+
+/** Release any room set aside for more rows in the vector, matrix, and weights of a data
+set, by \ref apop_data_reserve, or by stacking rows in place.
+
+\param d The data set. The \c more pages are ignored.
+\return \c d
+ */
+apop_data * apop_data_shrink_to_fit(apop_data *d){
+    Apop_stopif(!d, return NULL, 1, "You sent me a NULL data set. Returning NULL.");
+    if (d->vector && d->vector->owner == Apop_block_owner)
+        apop_vector_realloc(d->vector, d->vector->size);
+    if (d->weights && d->weights->owner == Apop_block_owner)
+        apop_vector_realloc(d->weights, d->weights->size);
+    if (d->matrix && d->matrix->owner == Apop_block_owner)
+        apop_matrix_realloc(d->matrix, d->matrix->size1, d->matrix->size2);
+    return d;
+}
+
 /** It's good form to get a page from your data set by name, because you
   may not know the order for the pages, and the stepping through makes
   for dull code anyway (<tt>apop_data *page = dataset; while (page->more) page= page->more;</tt>).
@@ -1420,6 +2086,7 @@ APOP_VAR_HEAD apop_data* apop_data_rm_rows(apop_data *in, int *drop, apop_fn_ir
             "indicating which rows to drop, nor a drop_fn I can use to test "
             "each row. Returning with no changes made.");
 APOP_VAR_ENDHEAD
+    apop_page_unshare(in);
     //First, shift columns down to the nearest not-freed row.
     int outlength = 0;
     Get_vmsizes(in); //vsize, msize1, maxsize
@@ -1447,10 +2114,6 @@ APOP_VAR_ENDHEAD
     if (in->weights) apop_vector_realloc(in->weights, GSL_MIN(in->weights->size, outlength));
     if (in->matrix)  apop_matrix_realloc(in->matrix, GSL_MIN(in->matrix->size1, outlength), in->matrix->size2);
     if (in->text)    apop_text_alloc(in, GSL_MIN(outlength, in->textsize[0]), in->textsize[1]);
-    if (in->names && in->names->rowct > outlength){
-        for (int k=outlength; k< in->names->rowct; k++)
-            free(in->names->row[k]);
-        in->names->rowct = outlength;
-    }
+    apop_name_trim_rows(in->names, outlength); //also drops the index, as the rows were shifted in place.
     return in;
 }
@@ -3,6 +3,7 @@ features like a variance, skew, and kurtosis aggregator for SQL. */
 /* Copyright (c) 2006--2009 by Ben Klemens.  Licensed under the GPLv2; see COPYING.  */
 
 #include "apop_internal.h"
+#include <ctype.h>
 
 /** Here are where the options are initially set. See the \ref apop_opts_type
     documentation for details.
@@ -14,13 +15,81 @@ apop_opts_type apop_opts	=
             .db_name_column = "row_names", .nan_string = "NaN", 
             .db_engine = '\0',             .db_user = "\0", 
             .db_pass = "\0",               .stop_on_warning = 'n',
-            .log_file = NULL,
+            .log_file = NULL,              .text_arena = 'n',
             .rng_seed = 479901,            .version = m4_apop_version };
 
 #define ERRCHECK {Apop_stopif(err, return 1, 0, "%s: %s",query, err); }
 #define ERRCHECK_NR {Apop_stopif(err, return NULL, 0, "%s: %s",query, err); }
 #define ERRCHECK_SET_ERROR(outdata) {Apop_stopif(err, if (!(outdata)) (outdata)=apop_data_alloc(); (outdata)->error='q'; sqlite3_free(err); return outdata, 0, "%s: %s",query, err); }
 
+/** \cond doxy_ignore */
+struct apop_db_handle {
+    char engine;          //'s' or 'm', as per apop_opts.db_engine when the handle was opened.
+    void *connection;     //The sqlite3 or MYSQL connection.
+    unsigned long serial; //SQLite: tags this connection's entries in the statement cache.
+    struct vtab_registry *vtabs; //SQLite: the data sets registered as virtual tables; see apop_data_register_vtab.
+};
+
+struct apop_query_cursor {
+    char engine, error, *query;
+    void *connection;      //The sqlite3 or MYSQL connection the query was sent to.
+    void *result;          //The sqlite3_stmt or MYSQL_RES now being read.
+    char const *tail;      //SQLite: the statements not yet prepared.
+    int namecol, done;
+    size_t cols;           //Columns of page->matrix.
+    apop_data *page;
+};
+/** \endcond */
+
+//The handle this thread's queries go to, as set by apop_db_use; if NULL, they go to the shared connection.
+static threadlocal apop_db_handle *thread_handle = NULL;
+
+//Make sure the page has a row n; see apop_matrix_room_for_row.
+static int cursor_has_room(apop_query_cursor *c, size_t n, size_t max_rows){
+    if (!c->cols) return 1;
+    c->page->matrix = apop_matrix_room_for_row(c->page->matrix, n, c->cols, max_rows);
+    Apop_stopif(!c->page->matrix, c->error='a'; c->done=1; return 0, 0, "allocation error.");
+    return 1;
+}
+
+/* apop_data_to_db writes each row as the row name, vector, matrix columns, text columns,
+   and weight, leaving out whichever parts the data set lacks. */
+typedef struct {
+    apop_data const *set;
+    int use_row;
+    size_t msize1, msize2, cols;
+} insert_layout_t;
+
+/* Cell k of the given row: return 'n' and fill *num, return 't' and fill *txt, or return
+   0 for a NULL (a NaN, a blank or NaN-string text element, or a cell past the end of its part). */
+static char insert_cell(insert_layout_t const *L, size_t row, size_t k, double *num, char const **txt){
+    apop_data const *set = L->set;
+    if (L->use_row && !k--){
+        if (row >= set->names->rowct) return 0;
+        *txt = set->names->row[row];
+        return **txt ? 't' : 0;
+    }
+    if (set->vector && !k--){
+        if (row >= set->vector->size) return 0;
+        *num = gsl_vector_get(set->vector, row);
+        return isnan(*num) ? 0 : 'n';
+    }
+    if (k < L->msize2){
+        if (row >= L->msize1) return 0;
+        *num = gsl_matrix_get(set->matrix, row, k);
+        return isnan(*num) ? 0 : 'n';
+    }
+    k -= L->msize2;
+    if (k < set->textsize[1]){
+        if (row >= *set->textsize) return 0;
+        *txt = set->text[row][k];
+        return (!**txt || (apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, *txt))) ? 0 : 't';
+    }
+    if (!set->weights || row >= set->weights->size) return 0;
+    *num = gsl_vector_get(set->weights, row);
+    return isnan(*num) ? 0 : 'n';
+}
+
 #include "apop_db_sqlite.c" // callback_t is defined here, btw.
 
 
@@ -64,10 +133,10 @@ memory is faster, but the database is destroyed when the program exits.
 
 MySQL users: either set the environment variable APOP_DB_ENGINE=mysql or set \c apop_opts.db_engine = 'm'.
 
-The Apophenia package assumes you are only using a single database at a time. You
-can use the SQL <tt>attach</tt> function to load other databases, or see <a
-href="http://modelingwithdata.org/arch/00000142.htm">this blog post</a> for further
-suggestions and sample code.
+This opens the connection that all threads share by default. You can use the SQL
+<tt>attach</tt> function to load other databases into it. To give a thread a
+connection of its own, so that several threads can query at once, see \ref
+apop_db_handle_open and \ref apop_db_use.
 
 When you are done doing your database manipulations, call \ref apop_db_close if writing to disk.
 
@@ -84,18 +153,116 @@ don't need to bother).
 */
 int apop_db_open(char const *filename){
     if (!apop_opts.db_engine) get_db_type();
-    if (!db) //check the environment.
+    if (!shared_db) //check the environment.
 #ifdef HAVE_MYSQL
-       if(!mysql_db)  
+       if(!shared_mysql_db)  
 #endif
 
     if (apop_opts.db_engine == 'm')
 #ifdef HAVE_MYSQL
-        return apop_mysql_db_open(filename);
+        return apop_mysql_db_open(filename, &shared_mysql_db);
 #else
         {Apop_stopif(1, return -1, 0, "Apophenia was compiled without mysql support.");}
 #endif
-        return apop_sqlite_db_open(filename);
+    {
+        int status = apop_sqlite_db_open(filename, &shared_db);
+        if (!status) shared_serial = new_serial();
+        return status;
+    }
+}
+
+/** Open a new connection to a database, to be used by the threads that select it via
+\ref apop_db_use. Where \ref apop_db_open opens the one connection that all threads share
+by default, you can open as many of these as you like, so that, e.g., each thread of an
+OpenMP loop can query its own shard of the data without waiting on the others.
+
+\code
+#pragma omp parallel for
+for (int i=0; i< shard_ct; i++){
+    char *name;
+    asprintf(&name, "shard%i.db", i);
+    apop_db_handle *h = apop_db_handle_open(name);
+    apop_db_use(h);
+    apop_data *d = apop_query_to_data("select avg(income) from people");
+    //... use d ...
+    apop_data_free(d);
+    apop_db_use(NULL);
+    apop_db_handle_close(h);
+    free(name);
+}
+\endcode
+
+\param filename The name of the database to open. For SQLite, if \c NULL, you get a new,
+empty in-memory database, which the shared in-memory database can't see. For mySQL/mariaDB,
+the database on the server.
+\return The handle, or \c NULL if the database did not open.
+
+\li The connection is to whichever engine \ref apop_opts_type "apop_opts.db_engine"
+specifies at the time of the call, and has all the usual SQLite extensions (\c stddev,
+\c var, \c ran, ...) added to it. Don't switch engines while a handle is in use.
+\li A handle is a connection, and a connection should be used by one thread at a time.
+*/
+apop_db_handle *apop_db_handle_open(char const *filename){
+    if (!apop_opts.db_engine) get_db_type();
+    apop_db_handle *h = malloc(sizeof(apop_db_handle));
+    Apop_stopif(!h, return NULL, 0, "malloc failed. Probably out of memory.");
+    *h = (apop_db_handle){.engine=apop_opts.db_engine};
+    int status;
+    if (h->engine == 'm'){
+#ifdef HAVE_MYSQL
+        MYSQL *conn = NULL;
+        status = apop_mysql_db_open(filename, &conn);
+        h->connection = conn;
+#else
+        Apop_notify(0, "Apophenia was compiled without mysql support.");
+        status = 1;
+#endif
+    } else {
+        sqlite3 *conn = NULL;
+        status = apop_sqlite_db_open(filename, &conn);
+        h->connection = conn;
+        h->serial = new_serial();
+    }
+    if (status){
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+/** Send the queries made by the calling thread to the given handle, or with \c NULL,
+back to the shared connection opened by \ref apop_db_open. Every thread starts out using
+the shared connection. All of the database functions, from \ref apop_query to \ref
+apop_text_to_db, use the connection selected here.
+
+\param handle A handle from \ref apop_db_handle_open, or \c NULL.
+\return The handle this thread was using before the call (\c NULL for the shared connection), so you can restore it when you are done.
+
+\li The choice is per-thread, and OpenMP reuses its threads, so set the thread back
+with <tt>apop_db_use(NULL)</tt> (or the return value) when it is done with the handle.
+*/
+apop_db_handle *apop_db_use(apop_db_handle *handle){
+    apop_db_handle *prior = thread_handle;
+    thread_handle = handle;
+    return prior;
+}
+
+apop_db_handle *apop_db_thread_handle(void){ return thread_handle; }
+
+/** Close a handle opened via \ref apop_db_handle_open, and free it. If the calling
+thread was using it, the thread goes back to the shared connection.
+
+\param handle The handle. If \c NULL, do nothing.
+*/
+void apop_db_handle_close(apop_db_handle *handle){
+    if (!handle) return;
+    if (thread_handle == handle) thread_handle = NULL;
+    if (handle->engine == 'm'){
+#ifdef HAVE_MYSQL
+        apop_mysql_db_close(handle->connection);
+#endif
+    } else apop_sqlite_db_close(handle->connection, handle->serial);
+    free(handle);
 }
 
 /** \cond doxy_ignore */
@@ -142,9 +309,9 @@ APOP_VAR_END_HEAD
     char *err=NULL, *q2;
     tab_exists_t te = { .name = name };
     tab_exists_t tev = { .name = name };
-	if (db==NULL) return 0;
-	sqlite3_exec(db, "select name from sqlite_master where type='table'", tab_exists_callback, &te, &err); 
-	sqlite3_exec(db, "select name from sqlite_master where type='view'", tab_exists_callback, &tev, &err); 
+	if (!apop_sqlite_db()) return 0;
+	sqlite3_exec(apop_sqlite_db(), "select name from sqlite_master where type='table'", tab_exists_callback, &te, &err); 
+	sqlite3_exec(apop_sqlite_db(), "select name from sqlite_master where type='view'", tab_exists_callback, &tev, &err); 
     char query[]="Selecting names from sqlite_master";//for ERRCHECK.
 	ERRCHECK
 	if ((remove==1|| remove=='d') && (te.isthere||tev.isthere)){
@@ -152,7 +319,7 @@ APOP_VAR_END_HEAD
             Asprintf(&q2, "drop table %s;", name);
         else
             Asprintf(&q2, "drop view %s;", name);
-		sqlite3_exec(db, q2, NULL, NULL, &err); 
+		sqlite3_exec(apop_sqlite_db(), q2, NULL, NULL, &err); 
         free(q2);
         ERRCHECK
     }
@@ -174,7 +341,8 @@ APOP_VAR_HEAD int apop_db_close(char vacuum){
 APOP_VAR_END_HEAD
     if (apop_opts.db_engine == 'm') //assume this is set by now...
 #ifdef HAVE_MYSQL
-        {apop_mysql_db_close(0);
+        {apop_mysql_db_close(shared_mysql_db);
+        shared_mysql_db = NULL;
         return 0;}
 #else
         {Apop_stopif(1, return -1, 0, "Apophenia was compiled without mysql support.");}
@@ -182,12 +350,12 @@ APOP_VAR_END_HEAD
     else {
         char *err, *query = "db close";//for errcheck.
         if (vacuum==1 || vacuum=='v') {
-            sqlite3_exec(db, "VACUUM", NULL, NULL, &err);
+            sqlite3_exec(shared_db, "VACUUM", NULL, NULL, &err);
             ERRCHECK
         }
-        sqlite3_close(db);
-    	//ERRCHECK
-        db  = NULL;
+        apop_sqlite_db_close(shared_db, shared_serial);
+        shared_db  = NULL;
+        shared_vtabs = NULL; //freed by SQLite along with the connection.
     }
     return 0;
 }
@@ -198,27 +366,30 @@ APOP_VAR_END_HEAD
 printf-style format specifiers, such as <tt>apop_query("create table %s(id, name,
 age);", tablename)</tt>.
 
+\li With SQLite, each thread keeps the last 64 single-statement queries it ran as
+compiled statements, so running the same query again skips SQLite's parsing and planning.
+Queries are matched after stripping comments and extra white space. To run one query
+many times with different values, write it with <tt>?</tt> placeholders and use \ref
+apop_query_bind, which hits the cache every time, rather than printing the values into
+the query text, which gives a new query every time.
+
 \param fmt A <tt>printf</tt>-style SQL query.
 \return 0 on success, 1 on failure.
 */
 int apop_query(const char *fmt, ...){
-    char *err=NULL;
     Fillin(query, fmt)
     if (!apop_opts.db_engine) get_db_type();
     if (apop_opts.db_engine == 'm')
 #ifdef HAVE_MYSQL
-        {Apop_stopif(!mysql_db, return 1, 0, "No mySQL database is open.");
+        {Apop_stopif(!apop_mysql_db(), return 1, 0, "No mySQL database is open.");
         return apop_mysql_query(query);}
 #else
         Apop_stopif(1, return 1, 0, "Apophenia was compiled without mysql support.");
 #endif
-    else 
-        {if (!db) apop_db_open(NULL);
-        sqlite3_exec(db, query, NULL,NULL, &err);
-	    ERRCHECK
-        }
+    if (!apop_sqlite_db()) apop_db_open(NULL);
+    int out = apop_sqlite_query(query, 0, NULL, NULL, 0);
 	free(query);
-	return 0;
+	return out;
 }
 
 /** Dump the results of a query into an array of strings.
@@ -242,6 +413,10 @@ int apop_query(const char *fmt, ...){
 \li Returns \c NULL if your query is valid but returns zero rows.
 \li The query can include printf-style format specifiers, such as
     <tt>apop_query_to_text("select name from %s where id=%i;", tablename, id_number)</tt>.
+\li The cells of the text grid are not separately allocated strings: they point into a
+    few large blocks owned by the output set (see \ref apop_text_set). So never \c free
+    a cell or replace it via <tt>free(out->text[i][j]); out->text[i][j] = strdup(...)</tt>,
+    which will crash. Write to cells via \ref apop_text_set.
 
 For example, the following function will list the tables in an SQLite database (much like you
 could do from the command line using <tt>sqlite3 dbname.db ".table"</tt>).
@@ -263,42 +438,6 @@ apop_data * apop_query_to_text(const char * fmt, ...){
     return out;
 }
 
-//apop_query_to_data callback.
-static int db_to_table(void *qinfo, int argc, char **argv, char **column){
-    Apop_stopif(!argv, return -1, apop_errorlevel, "Got NULL data from SQLite.");
-    int i, ncfound = 0;
-    callback_t *qi= qinfo;
-    if (qi->firstcall){
-        qi->firstcall--;
-        for(i=0; i<argc; i++)
-            if (apop_opts.db_name_column && !strcasecmp(column[i], apop_opts.db_name_column)){
-                qi->namecol = i;
-                ncfound = 1;
-                break;
-            }
-	    qi->outdata = argc-ncfound ? apop_data_alloc(1, argc-ncfound) : apop_data_alloc( );
-        for(i=0; i<argc; i++)
-            if (qi->namecol != i)
-                apop_name_add(qi->outdata->names, column[i], 'c');
-    } else 
-        if (qi->outdata->matrix)
-            apop_matrix_realloc(qi->outdata->matrix, qi->currentrow+1, qi->outdata->matrix->size2);
-    ncfound =0;
-    for (int jj=0;jj<argc;jj++)
-        if (jj != qi->namecol){
-            double valor = 
-                !argv[jj] || !strcmp(argv[jj], "NULL")|| 
-                (apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, argv[jj]))
-                 ? GSL_NAN : atof(argv[jj]);
-            gsl_matrix_set(qi->outdata->matrix,qi->currentrow,jj-ncfound, valor);
-        } else {
-            apop_name_add(qi->outdata->names, argv[jj], 'r');
-            ncfound = 1;
-        }
-    (qi->currentrow)++;
-	return 0;
-}
-
 /** Queries the database and dumps the result into an \ref apop_data set.
 
 \param fmt A <tt>printf</tt>-style SQL query.
@@ -328,13 +467,79 @@ apop_data * apop_query_to_data(const char * fmt, ...){
 #endif
 
     //else
-    char *err=NULL;
-    callback_t qinfo = {.firstcall = 1, .namecol=-1};
-	if (db==NULL) apop_db_open(NULL);
-    sqlite3_exec(db, query,db_to_table,&qinfo, &err); 
-    free (query);
-    ERRCHECK_SET_ERROR(qinfo.outdata)
-	return qinfo.outdata;
+    apop_data *out = apop_sqlite_query_to_data(query);
+    free(query);
+	return out;
+}
+
+/** Run a query with <tt>?</tt> placeholders, binding values to them first. This is the
+fast way to run one query many times with different values: the query is compiled once
+and then reused from the statement cache (see \ref apop_query), where printing the values
+into the query text gives SQLite a new query to parse and plan every time.
+
+\code
+apop_query("create table draws(id, x, y)");
+apop_query("begin");
+for (int i=0; i< 1e6; i++)
+    apop_query_bind("insert into draws values(?, ?, ?)", .values=(double[]){i, gsl_ran_gaussian(r, 1), gsl_rng_uniform(r)});
+apop_query("commit");
+\endcode
+
+\param query The query, which must be a single statement. Unlike \ref apop_query, this is not a <tt>printf</tt>-style format. (No default, must not be \c NULL.)
+\param values An array with one value for each placeholder. NaNs are bound as SQL \c NULL.
+\param data Or, bind the values in one row of this data set to the placeholders, in the
+order \ref apop_data_to_db would write them: vector, matrix columns, text columns, weights.
+Row names are not bound. NaNs, and text that is blank or matches \ref apop_opts_type
+"apop_opts.nan_string", are bound as \c NULL.
+\param row The row of \c data to bind. (default: 0)
+\return 0 on success, 1 on failure, including a query with more than one statement, or a data row with a different count of elements than the query has placeholders.
+
+\li If both \c values and \c data are given, \c data is used.
+\li SQLite only. With mySQL/mariaDB, this prints an error and returns 1.
+\li This function uses the \ref designated syntax for inputs.
+*/
+APOP_VAR_HEAD int apop_query_bind(char const *query, double const *values, apop_data const *data, int row){
+    char const *apop_varad_var(query, NULL)
+    Apop_stopif(!query, return 1, 0, "You gave me a NULL query. I can't work with that.");
+    double const *apop_varad_var(values, NULL)
+    apop_data const *apop_varad_var(data, NULL)
+    int apop_varad_var(row, 0)
+APOP_VAR_END_HEAD
+    Apop_notify(2, "%s", query);
+    if (!apop_opts.db_engine) get_db_type();
+    Apop_stopif(apop_opts.db_engine == 'm', return 1, 0, "Binding values to queries is only implemented for SQLite.");
+    if (!apop_sqlite_db()) apop_db_open(NULL);
+    return apop_sqlite_query(query, 1, values, data, row);
+}
+
+/** Query to an \ref apop_data set as per \ref apop_query_to_data, but bind values to
+<tt>?</tt> placeholders in the query first, as per \ref apop_query_bind.
+
+\code
+apop_data *obs = apop_data_alloc(1, 2);
+//...fill obs...
+apop_data *near = apop_query_to_data_bind("select * from draws where abs(x - ?) < 0.1 and abs(y - ?) < 0.1", .data=obs);
+\endcode
+
+\param query The query, which must be a single statement and is not a <tt>printf</tt>-style format. (No default, must not be \c NULL.)
+\param values An array with one value for each placeholder.
+\param data Or, bind the values in one row of this data set. See \ref apop_query_bind for the order.
+\param row The row of \c data to bind. (default: 0)
+\return As per \ref apop_query_to_data: \c NULL if no rows are returned, else the rows in the matrix.
+\exception out->error=='q' Query error, including a query with more than one statement, values that couldn't be bound, or an attempt to use this with mySQL/mariaDB.
+\li This function uses the \ref designated syntax for inputs.
+*/
+APOP_VAR_HEAD apop_data * apop_query_to_data_bind(char const *query, double const *values, apop_data const *data, int row){
+    char const *apop_varad_var(query, NULL)
+    Apop_stopif(!query, apop_return_data_error('q'), 0, "You gave me a NULL query. I can't work with that.");
+    double const *apop_varad_var(values, NULL)
+    apop_data const *apop_varad_var(data, NULL)
+    int apop_varad_var(row, 0)
+APOP_VAR_END_HEAD
+    Apop_notify(2, "%s", query);
+    if (!apop_opts.db_engine) get_db_type();
+    Apop_stopif(apop_opts.db_engine == 'm', apop_return_data_error('q'), 0, "Binding values to queries is only implemented for SQLite.");
+    return sqlite_query_to_matrix(query, 1, values, data, row);
 }
 
 
@@ -372,7 +577,7 @@ gsl_vector * apop_query_to_vector(const char * fmt, ...){
 #endif
     apop_data *d=NULL;
     gsl_vector *out;
-	if (db==NULL) apop_db_open(NULL);
+	if (!apop_sqlite_db()) apop_db_open(NULL);
     Store_settings
 	d	= apop_query_to_data("%s", query);
     Restore_settings
@@ -415,7 +620,7 @@ double apop_query_to_float(const char * fmt, ...){
 #endif
     } else {
         apop_data *d=NULL;
-        if (db==NULL) apop_db_open(NULL);
+        if (!apop_sqlite_db()) apop_db_open(NULL);
         Store_settings
         d = apop_query_to_data("%s", query);
         Restore_settings
@@ -434,12 +639,20 @@ If you are querying to a matrix and maybe a name, use \c
 apop_query_to_data (and set \ref apop_opts_type "apop_opts.db_name_column" if desired). If querying only text, use \ref apop_query_to_text. But
 if your data is a mix of text and numbers, use this.
 
-The first argument is a character string consisting of the letters \c nvmtw, one for each column of the SQL output, indicating whether the column is a name, vector, matrix column, text column, or weight vector. You can have only one \c n, one \c v, and one \c w. 
+The first argument is a character string consisting of the letters \c nvmtwf, one for each column of the SQL output, indicating whether the column is a name, vector, matrix column, text column, weight vector, or factor. You can have only one \c n, one \c v, and one \c w. 
+
+A factor column is a column of categories, like a text column that you would send
+to \ref apop_data_to_factors. It takes a matrix column (counting with the \c m
+columns) and holds each row's category number, and the list of categories goes on a
+page named <tt>"<categories for your_var>"</tt>, which you can get via \ref
+apop_data_get_factor_names. The output is as if you had used \c t and then \ref
+apop_data_to_factors, but no text is stored per row, and each row's category is found
+via a hash instead of a search over the list of categories. 
 
 If the query produces more columns than there are elements in the column specification, then the remainder are dumped into the text section. If there are fewer columns produced than given in the spec, the additional elements will be allocated but not filled (i.e., they are uninitialized and will have garbage).
 
 
-\param typelist A string consisting of the letters \c nvmtw. For example, if your query columns should go into a text column, the vector, the weights, and two matrix columns, this would be "tvwmm".
+\param typelist A string consisting of the letters \c nvmtwf. For example, if your query columns should go into a text column, the vector, the weights, and two matrix columns, this would be "tvwmm".
 \param fmt A <tt>printf</tt>-style SQL query.
 \exception out->error=='d' Dimension error. Your count of matrix parts didn't match what the query returned.
 \exception out->error=='q' Query error. A valid query that returns no rows is not an error; in that case, you get \c NULL.
@@ -448,7 +661,10 @@ If the query produces more columns than there are elements in the column specifi
     to indicate the output column with row names.
 \li As with the other \c apop_query_to_... functions, the query can include printf-style
     format specifiers, such as <tt>apop_query_to_mixed_data("tv", "select name, age from
-
+    %s where id=%i;", tablename, id_number)</tt>.
+\li As with \ref apop_query_to_text, the cells of the text grid point into a few large
+    blocks owned by the output set, so never \c free or <tt>strdup</tt>-replace a cell
+    yourself; write to cells via \ref apop_text_set.
 */
 apop_data * apop_query_to_mixed_data(const char *typelist, const char * fmt, ...){
     Fillin(query, fmt)
@@ -468,6 +684,117 @@ apop_data * apop_query_to_mixed_data(const char *typelist, const char * fmt, ...
     return out;
 }
 
+/** Open a cursor to read the output of a query in pages of rows via \ref
+apop_query_cursor_next, rather than all at once. Only one page of the output is in
+memory at a time, so you can run summary or estimation passes over a table too large
+to read in whole.
+
+\code
+apop_query_cursor *c = apop_query_cursor_open("select income, age from %s", tablename);
+double total = 0;
+size_t n = 0;
+for (apop_data *page; (page = apop_query_cursor_next(c, 10000)); ){
+    total += apop_vector_sum(Apop_cv(page, 0));
+    n += page->matrix->size1;
+}
+apop_query_cursor_close(c);
+printf("mean income: %g\n", total/n);
+\endcode
+
+\param fmt A <tt>printf</tt>-style SQL query.
+\return A cursor to hand to \ref apop_query_cursor_next and eventually \ref
+apop_query_cursor_close, or \c NULL if the query could not be sent to a mySQL/mariaDB
+server. With SQLite, errors in the query are reported by \ref apop_query_cursor_next.
+
+\li The pages hold what \ref apop_query_to_data would give you: a matrix of numbers, with
+column names and, if \ref apop_opts_type "apop_opts.db_name_column" is in the output,
+row names. The column names come from the first statement that returns any rows.
+\li With SQLite, the query is run a step at a time as pages are requested, so you can
+run other queries between pages, though changing the tables you are reading while
+you read them gives whatever SQLite gives. With mySQL/mariaDB, rows are pulled from the
+server as pages are requested, and the connection can not be used for any other query
+until the cursor is closed.
+\li The query can include printf-style format specifiers, such as
+<tt>apop_query_cursor_open("select age from %s where id=%i;", tablename, id_number)</tt>.
+*/
+apop_query_cursor *apop_query_cursor_open(const char *fmt, ...){
+    Fillin(query, fmt)
+    if (!apop_opts.db_engine) get_db_type();
+    apop_query_cursor *c = malloc(sizeof(apop_query_cursor));
+    Apop_stopif(!c, free(query); return NULL, 0, "malloc failed. Probably out of memory.");
+    *c = (apop_query_cursor){.engine=apop_opts.db_engine, .query=query, .tail=query, .namecol=-1};
+    if (c->engine == 'm'){
+#ifdef HAVE_MYSQL
+        int failed = apop_mysql_cursor_open(c);
+#else
+        int failed = 1;
+        Apop_notify(0, "Apophenia was compiled without mysql support.");
+#endif
+        if (failed){
+            free(query);
+            free(c);
+            return NULL;
+        }
+    } else {
+        if (!apop_sqlite_db()) apop_db_open(NULL);
+        c->connection = apop_sqlite_db();
+    }
+    return c;
+}
+
+/** Read the next page of rows from a cursor opened via \ref apop_query_cursor_open.
+
+\param cursor The cursor. If \c NULL, return \c NULL.
+\param max_rows The most rows to put on the page. Every page but the last will have
+exactly this many rows. If zero, return \c NULL.
+\return An \ref apop_data set whose matrix holds the next rows of the query's output.
+When the output is exhausted, return \c NULL.
+\exception out->error=='a' allocation error
+\exception out->error=='q' query error; the page has the rows read before the error, and the next call will return \c NULL.
+
+\li The returned set belongs to the cursor, and its matrix is reused by the next
+call, so the next call overwrites it. Use \ref apop_data_copy or \ref apop_data_share
+to keep a page past that; if the page is shared, the next call gives the cursor its
+own copy before overwriting it. Do not free it; \ref apop_query_cursor_close does that.
+*/
+apop_data *apop_query_cursor_next(apop_query_cursor *c, size_t max_rows){
+    if (!c || !max_rows || c->done) return NULL;
+    apop_data *page = c->page;
+    if (page){
+        apop_page_unshare(page); //in case the caller kept the last page via apop_data_share.
+        apop_name_trim_rows(page->names, 0); //the rows are refilled from the top.
+    }
+    size_t n =
+#ifdef HAVE_MYSQL
+        c->engine == 'm' ? apop_mysql_cursor_fill(c, max_rows) :
+#endif
+        apop_sqlite_cursor_fill(c, max_rows);
+    if (c->error && !c->page) c->page = apop_data_alloc();
+    page = c->page;
+    if (!n && !c->error) return NULL;
+    page->error = c->error;
+    if (page->matrix && page->matrix->size1 > n) //a short last page
+        page->matrix = apop_matrix_realloc(page->matrix, n, page->matrix->size2);
+    return page;
+}
+
+/** Close a cursor opened via \ref apop_query_cursor_open, and free it and the page it
+last returned. If the output was not read to the end, the rest is discarded.
+
+\param cursor The cursor. If \c NULL, do nothing.
+*/
+void apop_query_cursor_close(apop_query_cursor *c){
+    if (!c) return;
+#ifdef HAVE_MYSQL
+    if (c->engine == 'm') apop_mysql_cursor_close(c);
+    else
+#endif
+    sqlite3_finalize(c->result);
+    apop_data_free(c->page);
+    free(c->query);
+    free(c);
+}
+
 /* Convenience function for extending a string. 
  asprintf(%q, "%s and stuff", q);
  gives you a memory leak. This takes care of that.
@@ -481,6 +808,90 @@ void qxprintf(char **q, char *format, ...){
     free(r);
 }
 
+/* Bulk loading, per apop_db_load_type: set the pragmas and save the old values, then
+   commit every rows_per_commit rows, then build the indexes and put the pragmas back.
+   A load that failed ends with a NULL tabname: the open batch is rolled back and no
+   indexes are built, but the batches committed before the failure stay in.
+
+   If the user already has a transaction open, it's theirs: we neither commit it nor
+   change the pragmas under it (SQLite can't change the journal mode inside a
+   transaction). The pragmas we wanted but couldn't set are listed in state.skipped. */
+static char *swap_pragma(char const *pragma, char const *value, apop_db_load_state *state){
+    apop_data *old = apop_query_to_text("pragma %s", pragma);
+    char *out = (old && *old->textsize) ? strdup(*old->text[0]) : NULL;
+    apop_data_free(old);
+    if (!out || apop_query("pragma %s=%s", pragma, value)){
+        Apop_notify(1, "Couldn't set pragma %s=%s for the load.", pragma, value);
+        state->skipped = pragma;
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static int in_transaction(void){
+#ifdef HAVE_MYSQL
+    if (apop_opts.db_engine == 'm') return apop_mysql_in_transaction();
+#endif
+    return !sqlite3_get_autocommit(apop_sqlite_db());
+}
+
+apop_db_load_state apop_db_load_begin(apop_db_load_type const *load){
+    apop_db_load_state state = {.load=load};
+    if (!load) return state;
+    if (!apop_opts.db_engine) get_db_type();
+    if (apop_opts.db_engine != 'm' && !apop_sqlite_db()) apop_db_open(NULL);
+    if (in_transaction()){
+        if (apop_opts.db_engine != 'm' && (load->journal_mode || load->synchronous || load->cache_size)){
+            state.skipped = "all";
+            Apop_notify(1, "A transaction is already open, so I'm loading into it without changing the pragmas.");
+        }
+        return state;
+    }
+    if (apop_opts.db_engine != 'm'){
+        if (load->journal_mode) state.journal_mode = swap_pragma("journal_mode", load->journal_mode, &state);
+        if (load->synchronous)  state.synchronous = swap_pragma("synchronous", load->synchronous, &state);
+        if (load->cache_size){
+            state.cache_size = apop_query_to_float("pragma cache_size");
+            if (apop_query("pragma cache_size=%i", load->cache_size)) state.skipped = "cache_size";
+            else state.set_cache_size = 1;
+        }
+    }
+    if (load->rows_per_commit > 0){
+        state.own_transaction = 1;
+        apop_query("begin");
+    }
+    return state;
+}
+
+void apop_db_load_row(apop_db_load_state *state){
+    if (state->own_transaction && !(++state->rows % state->load->rows_per_commit)){
+        apop_query("commit");
+        apop_query("begin");
+    }
+}
+
+void apop_db_load_end(apop_db_load_state *state, char const *tabname){
+    if (!state->load) return;
+    if (state->own_transaction) apop_query(tabname ? "commit" : "rollback");
+    state->own_transaction = 0;
+    for (char **cols = state->load->indexes; tabname && cols && *cols; cols++){
+        char *name = NULL;
+        Asprintf(&name, "%s_%s", tabname, *cols);
+        for (char *c = name; *c; c++) if (!isalnum((unsigned char)*c)) *c = '_';
+        apop_query("create index %s%s on %s(%s)", apop_opts.db_engine == 'm' ? "" : "if not exists ",
+                                                    name, tabname, *cols);
+        free(name);
+    }
+    if (state->journal_mode) apop_query("pragma journal_mode=%s", state->journal_mode);
+    if (state->synchronous)  apop_query("pragma synchronous=%s", state->synchronous);
+    if (state->set_cache_size) apop_query("pragma cache_size=%i", (int)state->cache_size);
+    free(state->journal_mode);
+    free(state->synchronous);
+    state->journal_mode = state->synchronous = NULL;
+    state->set_cache_size = 0;
+}
+
 static void add_a_number (char **q, char *comma, double v){
     if (gsl_isnan(v))
         qxprintf(q,"%s%c NULL ", *q, *comma);
@@ -493,52 +904,67 @@ static void add_a_number (char **q, char *comma, double v){
     *comma = ',';
 }
 
-static int run_prepared_statements(apop_data const *set, sqlite3_stmt *p_stmt){
+/* Insert the rows via multi-row INSERT statements, each holding as many rows as fit
+   under SQLite's limit on blanks. The text is bound in place (SQLITE_STATIC), as the
+   data set doesn't change until the statement has run. */
+static int run_prepared_statements(insert_layout_t const *L, char const *tabname, size_t maxsize, apop_db_load_state *load){
 #if SQLITE_VERSION_NUMBER < 3003009
      Apop_stopif(1, return -1, 0, "Attempting to use prepared statements, but using a version of SQLite that doesn't support them.");
 #else
-    Get_vmsizes(set) //firstcol, msize1, maxsize
-    for (size_t row=0; row < maxsize; row++){
-        size_t field =1;
-        if (set->names && set->names->rowct>row){
-            if (!strlen(set->names->row[row])) field++; //leave NULL and cleared
-            Apop_stopif(sqlite3_bind_text(p_stmt, field++, set->names->row[row], -1, SQLITE_TRANSIENT),
-                    return -1, apop_errorlevel, 
-                    "Something wrong with the row name for line %zu, [%s].\n" , row, set->names->row[row]);
+    size_t batch = 1;
+#if SQLITE_VERSION_NUMBER >= 3007011
+    if (sqlite3_libversion_number() >= 3007011){ //multi-row VALUES lists
+        sqlite3 *db = apop_sqlite_db();
+        size_t most_blanks = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+        size_t most_rows = sqlite3_limit(db, SQLITE_LIMIT_COMPOUND_SELECT, -1);
+        batch = GSL_MAX(1, GSL_MIN(most_blanks/L->cols, GSL_MIN(most_rows, 500)));
+    }
+#endif
+    sqlite3_stmt *p_stmt = NULL;
+    size_t prepared_rows = 0;
+    for (size_t start=0; start < maxsize; start += batch){
+        size_t n = GSL_MIN(batch, maxsize - start);
+        if (n != prepared_rows){ //the first batch, and maybe a shorter last one.
+            if (p_stmt) sqlite3_finalize(p_stmt);
+            Apop_stopif(apop_prepare_prepared_statements(tabname, L->cols, n, &p_stmt),
+                    return -1, 0, "Trouble preparing prepared statements.");
+            prepared_rows = n;
         }
-        if (set->vector && set->vector->size > row)
-                Apop_stopif(sqlite3_bind_double(p_stmt, field++, apop_data_get(set, row, -1)),
-                    return -1, apop_errorlevel, 
-                    "Something wrong with the vector element on line %zu, [%g].\n" ,row,  apop_data_get(set, row, -1));
-        if (msize1 > row)
-            for (size_t col=0; col < msize2; col++)
-                Apop_stopif(sqlite3_bind_double(p_stmt, field++, apop_data_get(set, row, col)),
-                    return -1, apop_errorlevel, 
-                    "Something wrong with the matrix element %zu on line %zu, [%g].\n" ,col, row,  apop_data_get(set, row, col));
-        if (*set->textsize > row)
-            for (size_t col=0; col < set->textsize[1]; col++){
-                if (!strlen(set->text[row][col]) || (apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, set->text[row][col])))
-                    {field++; continue;} //leave NULL and cleared
-                Apop_stopif(sqlite3_bind_text(p_stmt, field++, set->text[row][col], -1, SQLITE_TRANSIENT),
-                    return -1, apop_errorlevel, 
-                    "Something wrong with a text element at row %zu, col %zu [%s].\n" , row, col, set->text[row][col]);
+        int field = 1;
+        for (size_t row=start; row < start+n; row++)
+            for (size_t k=0; k < L->cols; k++, field++){
+                double num;
+                char const *txt;
+                char type = insert_cell(L, row, k, &num, &txt);
+                int err = type=='n' ? sqlite3_bind_double(p_stmt, field, num)
+                        : type=='t' ? sqlite3_bind_text(p_stmt, field, txt, -1, SQLITE_STATIC)
+                        : SQLITE_OK; //leave NULL and cleared
+                Apop_stopif(err, sqlite3_finalize(p_stmt); return -1, apop_errorlevel,
+                        "Something wrong with element %zu on line %zu.", k, row);
             }
-        if (set->weights && set->weights->size > row)
-                Apop_stopif(sqlite3_bind_double(p_stmt, field++, gsl_vector_get(set->weights, row)),
-                    return -1, apop_errorlevel, 
-                    "Something wrong with the weight element on line %zu, [%g].\n" ,row,  gsl_vector_get(set->weights, row));
         int err = sqlite3_step(p_stmt);
-        Apop_stopif(err!=0 && err != 101 //0=ok, 101=done
-                    , , 0, "prepared sqlite insert query gave error code %i.\n", err);
-        Apop_stopif(sqlite3_reset(p_stmt), return -1, apop_errorlevel, "SQLite error.");
-        Apop_stopif(sqlite3_clear_bindings(p_stmt), return -1, apop_errorlevel, "SQLite error."); //needed for NULLs
+        Apop_stopif(err!=SQLITE_OK && err != SQLITE_DONE, sqlite3_finalize(p_stmt); return -1, 0,
+                    "prepared sqlite insert query gave error code %i: %s", err, sqlite3_errmsg(apop_sqlite_db()));
+        Apop_stopif(sqlite3_reset(p_stmt), sqlite3_finalize(p_stmt); return -1, apop_errorlevel, "SQLite error.");
+        Apop_stopif(sqlite3_clear_bindings(p_stmt), sqlite3_finalize(p_stmt); return -1, apop_errorlevel, "SQLite error."); //needed for NULLs
+        for (size_t i=0; i < n; i++) apop_db_load_row(load);
     }
-    Apop_stopif(sqlite3_finalize(p_stmt)!=SQLITE_OK, return -1, apop_errorlevel, "SQLite error.");
+    Apop_stopif(p_stmt && sqlite3_finalize(p_stmt)!=SQLITE_OK, return -1, apop_errorlevel, "SQLite error.");
     return 0;
 #endif
 }
 
-//users are expected to call apop_data_print.
+/** Write a data set to a database table. Users are expected to call this via \ref
+apop_data_print with <tt>.output_type='d'</tt>; see \ref sqlsec. Loads under the
+settings in \ref apop_opts_type "apop_opts.db_load"; see \ref apop_db_load_type.
+
+\li With SQLite, the rows go in as one transaction, unless a transaction is already open
+or \c apop_opts.db_load.rows_per_commit is set. So if a row fails to go in, the
+transaction is rolled back and none of the data set's rows are in the table, including
+the rows before the failure.
+
+\return 0 on success, -1 on failure.
+*/
 int apop_data_to_db(const apop_data *set, const char *tabname, const char output_append){
     Apop_stopif(!set, return -1, 1, "you sent me a NULL data set. Database table %s will not be created.", tabname);
     int	i,j; 
@@ -583,6 +1009,7 @@ int apop_data_to_db(const apop_data *set, const char *tabname, const char output
                     qxprintf(&q, "%s%c\n %s  varchar(1000) ", q, comma, set->names->text[i]);
                 comma = ',';
             }
+            if (set->weights) qxprintf(&q, "%s%c\n weights double ", q, comma);
             apop_query("%s); ", q);
             sprintf(q, " ");
         }
@@ -590,7 +1017,7 @@ int apop_data_to_db(const apop_data *set, const char *tabname, const char output
         Apop_stopif(1, return -1, apop_errorlevel, "Apophenia was compiled without mysql support.");
 #endif
     else {
-        if (db==NULL) apop_db_open(NULL);
+        if (!apop_sqlite_db()) apop_db_open(NULL);
         if (((output_append =='a' || output_append =='A') && apop_table_exists(tabname)) )
             Asprintf(&q, " ");
         else {
@@ -625,16 +1052,23 @@ int apop_data_to_db(const apop_data *set, const char *tabname, const char output
     }
 
     Get_vmsizes(set) //firstcol, msize2, maxsize
-    int col_ct = (set->names ? !!set->names->rowct : 0) + set->textsize[1] + msize2 - firstcol + !!set->weights;
+    int col_ct = use_row + set->textsize[1] + msize2 - firstcol + !!set->weights;
     Apop_stopif(!col_ct, return -1, 0, "Input data set has zero columns of data (no rownames, text, matrix, vector, or weights). I can't create a table like that, sorry.");
-    if(apop_use_sqlite_prepared_statements(col_ct)){
-        sqlite3_stmt *statement;
-        Apop_stopif(
-            apop_prepare_prepared_statements(tabname, col_ct, &statement), 
-            return -1, 0, "Trouble preparing prepared statements.");
-        Apop_stopif(
-            run_prepared_statements(set, statement), 
-            return -1, 0, "error in insertions.");
+    insert_layout_t layout = {.set=set, .use_row=use_row, .msize1=msize1, .msize2=msize2, .cols=col_ct};
+    apop_db_load_state load = apop_db_load_begin(&apop_opts.db_load);
+    if (apop_opts.db_engine == 'm'){
+#ifdef HAVE_MYSQL
+        Apop_stopif(apop_mysql_insert_rows(&layout, tabname, maxsize, &load),
+            apop_db_load_end(&load, NULL); free(q); return -1, 0, "error in insertions.");
+#endif
+    } else if(apop_use_sqlite_prepared_statements(col_ct)){
+        //All the rows go in one transaction, unless the user or apop_opts.db_load has one open.
+        int own_transaction = sqlite3_get_autocommit(apop_sqlite_db());
+        if (own_transaction) apop_query("begin");
+        Apop_stopif(run_prepared_statements(&layout, tabname, maxsize, &load), 
+            if (own_transaction) apop_query("rollback");
+            apop_db_load_end(&load, NULL); free(q); return -1, 0, "error in insertions.");
+        if (own_transaction) apop_query("commit");
     } else {
         for(i=0; i< maxsize; i++){
             comma = ' ';
@@ -661,8 +1095,56 @@ int apop_data_to_db(const apop_data *set, const char *tabname, const char output
             qxprintf(&q,"%s);",q);
             apop_query("%s", q); 
             q[0]='\0';
+            apop_db_load_row(&load);
         }
     }
+    apop_db_load_end(&load, tabname);
 	free(q);
     return 0;
 }
+
+/** Make an \ref apop_data set in memory available to SQL queries as a (virtual) table,
+without copying it into the database. The table reads straight from the data set, so you
+can join it against tables in the database at the cost of a pointer lookup per cell.
+
+\code
+apop_data *targets = apop_query_to_data("select id, x from candidates");
+//... adjust targets in memory ...
+apop_data_register_vtab(targets, "targets");
+apop_data *matched = apop_query_to_data("select b.* from bigtable b join targets t on b.id = t.c0");
+apop_query("drop table targets");
+\endcode
+
+\param d The data set. It is not copied, so it must not be freed until the table is dropped. (No default, must not be \c NULL.)
+\param tabname The name for the table, which goes in SQLite's \c temp database, so it
+isn't saved to disk and takes precedence over a table of the same name in the main
+database. The name is quoted, so it is taken as is, even if it has spaces or other
+characters that SQL would otherwise balk at. (No default, must not be \c NULL.)
+\return 0 on success, 1 on failure.
+
+\li Drop the table before freeing the data set. The table can't know when the data set
+is freed, and a query on it after that would read freed memory. Dropping the table (or
+closing the connection) is all the cleanup needed.
+
+\li The columns are as \ref apop_data_to_db would write them: row names (if any, named
+after \ref apop_opts_type "apop_opts.db_name_column"), vector, matrix columns, text
+columns, and weights, named after the data set's names or \c vector, <tt>c0, c1, ...</tt>,
+<tt>tc0, tc1, ...</tt>, and \c weights if unnamed.
+\li The \c rowid is the row number, counting from zero. Conditions like <tt>rowid between
+1000 and 1999</tt> read only those rows.
+\li NaNs, blank text, and text matching \ref apop_opts_type "apop_opts.nan_string" read as \c NULL.
+\li Changes to the values in the data set are visible to the next query. The count of
+rows is read at the start of each query, but the list of columns is fixed when the
+table is registered; drop and re-register the table if you add columns.
+\li The table is read-only.
+\li SQLite only. The table is visible only via the connection that was in use when it
+was registered (see \ref apop_db_use).
+*/
+int apop_data_register_vtab(apop_data const *d, char const *tabname){
+    Apop_stopif(!d, return 1, 0, "You gave me a NULL data set.");
+    Apop_stopif(!tabname, return 1, 0, "You gave me a NULL table name.");
+    if (!apop_opts.db_engine) get_db_type();
+    Apop_stopif(apop_opts.db_engine == 'm', return 1, 0, "Virtual tables of apop_data sets are only implemented for SQLite.");
+    if (!apop_sqlite_db()) apop_db_open(NULL);
+    return apop_sqlite_register_vtab(d, tabname);
+}
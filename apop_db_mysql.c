@@ -8,9 +8,14 @@ This file is included directly into \ref apop_db.c. It is read only if APOP_USE_
 #include <mysql.h>
 #include <math.h>
 
-static MYSQL *mysql_db; 
+static MYSQL *shared_mysql_db; //The connection apop_db_open opens, used by every thread without a handle of its own.
 
-#define Areweconected(retval) Apop_stopif(!mysql_db, return retval, 0,  \
+//The connection this thread's queries go to.
+static MYSQL *apop_mysql_db(void){
+    return thread_handle ? thread_handle->connection : shared_mysql_db;
+}
+
+#define Areweconected(retval) Apop_stopif(!apop_mysql_db(), return retval, 0,  \
         "No connection to a mySQL/mariadb database. apop_db_open() failure?");
 
 static char *opt_host_name = NULL;      /* server host (default=localhost) */
@@ -18,45 +23,54 @@ static unsigned int opt_port_num = 0;   /* port number (use built-in value) */
 static char *opt_socket_name = NULL;    /* socket name (use built-in value) */
 static unsigned int opt_flags = 0;      /* connection flags (none) */
 
-#define Apop_mstopif(cond, returnop, str) \
+#define Apop_cstopif(conn, cond, returnop, str) \
     Apop_stopif(cond, returnop, 0,         \
-         str "\n mySQL/mariadb error %u: %s\n", mysql_errno (mysql_db), mysql_error (mysql_db));
+         str "\n mySQL/mariadb error %u: %s\n", mysql_errno (conn), mysql_error (conn));
 
-static int apop_mysql_db_open(char const *in){
+#define Apop_mstopif(cond, returnop, str) Apop_cstopif(apop_mysql_db(), cond, returnop, str)
+
+//Open a connection at *out.
+static int apop_mysql_db_open(char const *in, MYSQL **out){
     Apop_stopif(!in, return 2, 0, "MySQL needs a non-NULL db name.");
-    mysql_db = mysql_init (NULL);
-    Apop_stopif(!mysql_db, return 1, 0, "mysql_init() failed (probably out of memory)");
-    Apop_mstopif (!mysql_real_connect (mysql_db, opt_host_name, apop_opts.db_user, apop_opts.db_pass,
+    MYSQL *conn = *out = mysql_init (NULL);
+    Apop_stopif(!conn, return 1, 0, "mysql_init() failed (probably out of memory)");
+    Apop_cstopif (conn, !mysql_real_connect (conn, opt_host_name, apop_opts.db_user, apop_opts.db_pass,
                         in, opt_port_num, opt_socket_name, CLIENT_MULTI_STATEMENTS+opt_flags),
-                mysql_close (mysql_db); return 1, 
+                mysql_close (conn); *out = NULL; return 1, 
                 "mysql_real_connect() failed");
     return 0;
 }
 
-static void apop_mysql_db_close(int ignoreme){
-    if (mysql_db) mysql_close (mysql_db);
+static void apop_mysql_db_close(MYSQL *conn){
+    if (conn) mysql_close (conn);
+}
+
+//Does this thread's connection have a transaction open? The server reports this with every reply.
+static int apop_mysql_in_transaction(void){
+    MYSQL *conn = apop_mysql_db();
+    return conn && (conn->server_status & SERVER_STATUS_IN_TRANS);
 }
 
 /*
     //Cut & pasted & cleaned from the mysql manual.
 static void process_results(void){
     else                // mysql_store_result() returned nothing; should it have?
-        Apop_stopif(mysql_field_count(mysql_db) == 0,  , 0, "apop_query error");
+        Apop_stopif(mysql_field_count(apop_mysql_db()) == 0,  , 0, "apop_query error");
     //else query wasn't a select & just didn't return data.
 }
         */
 
 static double apop_mysql_query(char *query){
-    Apop_mstopif(mysql_query(mysql_db, query), return 1, "apop_mysql_query failed");
-    MYSQL_RES *result = mysql_store_result(mysql_db);
+    Apop_mstopif(mysql_query(apop_mysql_db(), query), return 1, "apop_mysql_query failed");
+    MYSQL_RES *result = mysql_store_result(apop_mysql_db());
     if (result) mysql_free_result(result);
     return 0;
 }
 
 static double apop_mysql_table_exists(char const *table, int delme){
     Areweconected(GSL_NAN);
-    MYSQL_RES *res_set = mysql_list_tables(mysql_db, table);
-    Apop_mstopif(!mysql_list_tables(mysql_db, table), return GSL_NAN,
+    MYSQL_RES *res_set = mysql_list_tables(apop_mysql_db(), table);
+    Apop_mstopif(!mysql_list_tables(apop_mysql_db(), table), return GSL_NAN,
           "show tables query failed.");
     int is_found = mysql_num_rows(res_set);
     mysql_free_result(res_set);
@@ -65,7 +79,7 @@ static double apop_mysql_table_exists(char const *table, int delme){
     if (delme =='d' || delme=='D'){
        char *a_query;
        Asprintf(&a_query, "drop table %s", table);
-       Apop_mstopif(mysql_query (mysql_db, a_query), GSL_NAN, 
+       Apop_mstopif(mysql_query (apop_mysql_db(), a_query), GSL_NAN, 
             "table exists, but table dropping failed");
     }
     return 1;
@@ -141,6 +155,7 @@ static void * process_result_set_chars (MYSQL *conn, MYSQL_RES *res_set) {
     MYSQL_FIELD *fields = mysql_fetch_fields(res_set);
     int name_row = get_name_row(&total_cols, fields);
     apop_data *out = apop_text_alloc(NULL, total_rows, total_cols);
+    if (apop_opts.text_arena=='y') out->textarena = apop_text_arena_alloc(0);
 
     for (size_t i = 0; i < total_cols + (name_row>=0); i++)
         if (i!=name_row) apop_name_add(out->names, fields[i].name, 't');
@@ -162,14 +177,14 @@ static void * process_result_set_chars (MYSQL *conn, MYSQL_RES *res_set) {
 static void * apop_mysql_query_core(char *query, void *(*callback)(MYSQL*, MYSQL_RES*)){
     Areweconected(NULL);
     apop_data *output = NULL;
-    Apop_mstopif(mysql_query (mysql_db, query), return NULL, "mysql_query() failed");
-    MYSQL_RES *res_set = mysql_store_result (mysql_db);
+    Apop_mstopif(mysql_query (apop_mysql_db(), query), return NULL, "mysql_query() failed");
+    MYSQL_RES *res_set = mysql_store_result (apop_mysql_db());
     Apop_mstopif(!res_set, 
         if (callback == process_result_set_data || callback==process_result_set_data) apop_return_data_error('q') 
             else return NULL, 
             "mysql_store_result() failed");
     if (!res_set->row_count) goto done; //just a blank table.
-    output = callback(mysql_db, res_set);
+    output = callback(apop_mysql_db(), res_set);
 
     done:
     mysql_free_result (res_set);
@@ -178,13 +193,13 @@ static void * apop_mysql_query_core(char *query, void *(*callback)(MYSQL*, MYSQL
 
 static double apop_mysql_query_to_float(char *query){
     Areweconected(GSL_NAN);
-    Apop_mstopif(mysql_query (mysql_db, query) != 0, return GSL_NAN,
+    Apop_mstopif(mysql_query (apop_mysql_db(), query) != 0, return GSL_NAN,
           "mysql_query() failed");
-    MYSQL_RES *res_set = mysql_store_result (mysql_db);
+    MYSQL_RES *res_set = mysql_store_result (apop_mysql_db());
     Apop_mstopif(!res_set, return GSL_NAN, "mysql_store_result() failed");
     if (mysql_num_rows(res_set)==0) return GSL_NAN;
     MYSQL_ROW row = mysql_fetch_row (res_set);
-    Apop_mstopif(mysql_errno (mysql_db),
+    Apop_mstopif(mysql_errno (apop_mysql_db()),
         mysql_free_result (res_set); return GSL_NAN,
         "mysql_fetch_row() failed");
     double out = atof(row[0]);
@@ -195,8 +210,8 @@ static double apop_mysql_query_to_float(char *query){
 apop_data* apop_mysql_mixed_query(char const *intypes, char const *query){
     Areweconected(NULL);
     apop_data *out = NULL;
-    Apop_mstopif(mysql_query (mysql_db, query), return NULL, "mysql_query() failed");
-    MYSQL_RES *res_set = mysql_store_result(mysql_db);
+    Apop_mstopif(mysql_query (apop_mysql_db(), query), return NULL, "mysql_query() failed");
+    MYSQL_RES *res_set = mysql_store_result(apop_mysql_db());
     MYSQL_ROW row;
     Apop_mstopif(!res_set, return NULL, "mysql_store_result() failed");
     if (!res_set->row_count) goto done; //just a blank table.
@@ -222,8 +237,12 @@ apop_data* apop_mysql_mixed_query(char const *intypes, char const *query){
       "you asked for %i columns in your list of types(%s), but your query produced %u columns. "
       "Ignoring the last %i type(s) in your list. Output data set's ->error element set to 'd'." , requested, intypes, total_cols, -excess);
 
-    if (info.intypes[3]||excess>0) apop_text_alloc(out, total_rows, info.intypes[3] + ((excess > 0) ? excess : 0));
+    if (info.intypes[3]||excess>0){
+        apop_text_alloc(out, total_rows, info.intypes[3] + ((excess > 0) ? excess : 0));
+        if (apop_opts.text_arena=='y') out->textarena = apop_text_arena_alloc(0);
+    }
     if (info.intypes[4]) out->weights = gsl_vector_alloc(total_rows);
+    apop_category_index *cats = calloc(info.intypes[2]+1, sizeof(apop_category_index));
 
     MYSQL_FIELD *fields = mysql_fetch_fields(res_set);
     for (size_t i=0; i<total_cols; i++){
@@ -232,7 +251,7 @@ apop_data* apop_mysql_mixed_query(char const *intypes, char const *query){
             apop_name_add(out->names, fields[i].name, 't');
         else if (c == 'v'|| c=='V')
             apop_name_add(out->names, fields[i].name, 'v');
-        else if (c == 'm'|| c=='M')
+        else if (c == 'm'|| c=='M' || c == 'f'|| c=='F')
             apop_name_add(out->names, fields[i].name, 'c');
     }
 
@@ -252,10 +271,141 @@ apop_data* apop_mysql_mixed_query(char const *intypes, char const *query){
                 gsl_vector_set(out->weights, i, valor);
             } else if (c == 'm'|| c=='M')
                 gsl_matrix_set(out->matrix, i , thism++, row[j] ? atof(row[j]): GSL_NAN);
+            else if (c == 'f'|| c=='F'){
+                cats[thism].own = 1;
+                gsl_matrix_set(out->matrix, i, thism, apop_category_code(cats+thism, row[j] ? row[j] : apop_opts.nan_string, 'y'));
+                thism++;
+            }
 		}
     }
+    for (int j=0; j< info.intypes[2]; j++){
+        if (cats[j].own) apop_category_add_page(out, j, cats+j);
+        apop_category_index_free(cats+j);
+    }
+    free(cats);
 
     done:
     mysql_free_result (res_set);
     return out;
 }
+
+/* For apop_data_to_db: insert the rows via the binary prepared-statement protocol, so the
+   numbers go over the wire as doubles instead of being printed and parsed again, with up
+   to 500 rows per statement (and under the protocol's 65,535 blanks). */
+static int apop_mysql_insert_rows(insert_layout_t const *L, char const *tabname, size_t maxsize, apop_db_load_state *load){
+    Areweconected(1);
+    MYSQL *conn = apop_mysql_db();
+    size_t batch = GSL_MAX(1, GSL_MIN(65535/L->cols, 500));
+    MYSQL_STMT *stmt = NULL;
+    MYSQL_BIND *binds = malloc(batch*L->cols*sizeof(MYSQL_BIND));
+    double *nums = malloc(batch*L->cols*sizeof(double));
+    unsigned long *lengths = malloc(batch*L->cols*sizeof(unsigned long));
+    size_t prepared_rows = 0;
+    int status = 0;
+    Apop_stopif(!binds || !nums || !lengths, status=1; goto done, 0, "Allocation error.");
+    for (size_t start=0; start < maxsize; start += batch){
+        size_t n = GSL_MIN(batch, maxsize - start);
+        if (n != prepared_rows){ //the first batch, and maybe a shorter last one.
+            if (stmt) mysql_stmt_close(stmt);
+            char *q = apop_insert_statement(tabname, L->cols, n);
+            stmt = mysql_stmt_init(conn);
+            Apop_cstopif(conn, !q || !stmt || mysql_stmt_prepare(stmt, q, strlen(q)),
+                    free(q); status=1; goto done, "Trouble preparing the insert statement.");
+            free(q);
+            prepared_rows = n;
+        }
+        memset(binds, 0, n*L->cols*sizeof(MYSQL_BIND));
+        for (size_t row=start, i=0; row < start+n; row++)
+            for (size_t k=0; k < L->cols; k++, i++){
+                char const *txt;
+                char type = insert_cell(L, row, k, nums+i, &txt);
+                if (type == 'n'){
+                    binds[i].buffer_type = MYSQL_TYPE_DOUBLE;
+                    binds[i].buffer = nums+i;
+                } else if (type == 't'){
+                    binds[i].buffer_type = MYSQL_TYPE_STRING;
+                    binds[i].buffer = (char*)txt;
+                    binds[i].buffer_length = lengths[i] = strlen(txt);
+                    binds[i].length = lengths+i;
+                } else binds[i].buffer_type = MYSQL_TYPE_NULL;
+            }
+        Apop_stopif(mysql_stmt_bind_param(stmt, binds) || mysql_stmt_execute(stmt),
+                status=1; goto done, 0, "Trouble inserting rows %zu--%zu.\n mySQL/mariadb error %u: %s",
+                start, start+n-1, mysql_stmt_errno(stmt), mysql_stmt_error(stmt));
+        for (size_t i=0; i < n; i++) apop_db_load_row(load);
+    }
+
+    done:
+    if (stmt) mysql_stmt_close(stmt);
+    free(binds); free(nums); free(lengths);
+    return status;
+}
+
+/* The cursor reads an unbuffered result, so rows come from the server only as the pages
+   are filled. Until the cursor is closed, the connection is busy. */
+static int apop_mysql_cursor_open(apop_query_cursor *c){
+    Areweconected(1);
+    MYSQL *conn = c->connection = apop_mysql_db();
+    Apop_cstopif(conn, mysql_query(conn, c->query), return 1, "mysql_query() failed");
+    c->result = mysql_use_result(conn);
+    Apop_cstopif(conn, !c->result && mysql_field_count(conn), return 1, "mysql_use_result() failed");
+    return 0;
+}
+
+static size_t apop_mysql_cursor_fill(apop_query_cursor *c, size_t max_rows){
+    MYSQL *conn = c->connection;
+    size_t n = 0;
+    while (n < max_rows){
+        MYSQL_RES *res_set = c->result;
+        if (!res_set){ //move on to the next statement's results, if any.
+            int more = mysql_next_result(conn);
+            Apop_cstopif(conn, more > 0, c->error='q', "mysql_next_result() failed");
+            if (more) {
+                c->done = 1;
+                break;
+            }
+            c->result = mysql_use_result(conn);
+            Apop_cstopif(conn, !c->result && mysql_field_count(conn), c->error='q'; c->done=1, "mysql_use_result() failed");
+            if (c->done) break;
+            continue;
+        }
+        MYSQL_ROW row = mysql_fetch_row(res_set);
+        if (!row){
+            Apop_cstopif(conn, mysql_errno(conn), c->error='q'; c->done=1, "mysql_fetch_row() failed");
+            mysql_free_result(res_set);
+            c->result = NULL;
+            if (c->done) break;
+            continue;
+        }
+        unsigned int argc = mysql_num_fields(res_set);
+        if (!c->page){
+            unsigned int num_fields = argc;
+            MYSQL_FIELD *fields = mysql_fetch_fields(res_set);
+            c->namecol = get_name_row(&num_fields, fields);
+            c->cols = num_fields;
+            c->page = apop_data_alloc();
+            for (size_t i = 0; i < argc; i++)
+                if (i!=c->namecol) apop_name_add(c->page->names, fields[i].name, 'c');
+        }
+        if (!cursor_has_room(c, n, max_rows)) break;
+        for (size_t i=0, j=0; i < argc; i++)
+            if (i==c->namecol) apop_name_add(c->page->names, row[i], 'r');
+            else if (j < c->cols){
+                char *end = NULL;
+                double num = row[i] ? strtod(row[i], &end) : NAN;
+                gsl_matrix_set(c->page->matrix, n, j++, (row[i] && *end) ? NAN : num);
+            }
+        n++;
+    }
+    return n;
+}
+
+//Discard whatever the cursor has not read, so the connection is free for the next query.
+static void apop_mysql_cursor_close(apop_query_cursor *c){
+    MYSQL *conn = c->connection;
+    if (c->result) mysql_free_result(c->result);
+    while (!mysql_next_result(conn)){
+        MYSQL_RES *res_set = mysql_store_result(conn);
+        if (res_set) mysql_free_result(res_set);
+    }
+}
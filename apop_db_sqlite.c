@@ -6,125 +6,520 @@ Copyright (c) 2006--2007 by Ben Klemens.  Licensed under the GPLv2; see COPYING.
 #include <sqlite3.h>
 #include <string.h>
 
-sqlite3	*db=NULL;	                //There's only one SQLite database handle. Here it is.
+extern char *apop_nul_string;
 
+static sqlite3 *shared_db = NULL; //The connection apop_db_open opens, used by every thread without a handle of its own.
 
+//The connection this thread's queries go to.
+sqlite3 *apop_sqlite_db(void){
+    return thread_handle ? thread_handle->connection : shared_db;
+}
+
+/* The statement cache. Each thread keeps its own recently used prepared statements, so a
+   statement is never stepped by two threads at once. Every connection gets a serial
+   number when it opens, and entries only match the connection they were prepared on,
+   so a new connection that happens to reuse a closed one's address can't pick up its
+   statements. Entries with a NULL stmt mark queries of several statements, which we run
+   the long way. */
+#define Stmt_cache_size 64
 
 /** \cond doxy_ignore */
-typedef struct StdDevCtx StdDevCtx;
-struct StdDevCtx {
-    double avg;     /* avg of terms */
-    double avg2;    /* avg of the squares of terms */
-    double avg3;    /* avg of the cube of terms */
-    double avg4;    /* avg of the fourth-power of terms */
-    int cnt;        /* Number of terms counted */
-};
+typedef struct {
+    char *sql;            //normalised text, as the key.
+    unsigned long hash, serial, last_used;
+    sqlite3_stmt *stmt;
+} cached_stmt_t;
 /** \endcond */
 
-static void twoStep(sqlite3_context *context, int argc, sqlite3_value **argv){
-    if (argc<1) return;
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if (p && argv[0]){
-        double x = sqlite3_value_double(argv[0]);
-        double ratio = p->cnt/(p->cnt+1.0);
-        p->cnt++;
-        p->avg	*= ratio;
-        p->avg2	*= ratio;
-        p->avg += x/(p->cnt +0.0);
-        p->avg2 += gsl_pow_2(x)/(p->cnt +0.0);
-    }
-}
-
-static void threeStep(sqlite3_context *context, int argc, sqlite3_value **argv){
-    if (argc<1) return;
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if (p && argv[0]){
-        double x = sqlite3_value_double(argv[0]);
-        double ratio =  p->cnt/(p->cnt+1.0);
-        p->cnt++;
-        p->avg	*= ratio;
-        p->avg2	*= ratio;
-        p->avg3	*= ratio;
-        p->avg += x/p->cnt;
-        p->avg2 += gsl_pow_2(x)/p->cnt;
-        p->avg3 += gsl_pow_3(x)/p->cnt;
-    }
-}
-
-static void fourStep(sqlite3_context *context, int argc, sqlite3_value **argv){
-    if( argc<1 ) return;
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if (p && argv[0]){
-        double x = sqlite3_value_double(argv[0]);
-        p->cnt++;
-        p->avg = (x + p->avg * (p->cnt-1.))/p->cnt;
-        p->avg2 = (gsl_pow_2(x)+ p->avg2 * (p->cnt-1.))/p->cnt;
-        p->avg3 = (gsl_pow_3(x)+ p->avg3 * (p->cnt-1.))/p->cnt;
-        p->avg4 = (gsl_pow_4(x)+ p->avg4 * (p->cnt-1.))/p->cnt;
+static threadlocal cached_stmt_t stmt_cache[Stmt_cache_size];
+static threadlocal unsigned long stmt_clock = 0;
+static unsigned long shared_serial = 0, last_serial = 0;
+
+static unsigned long new_serial(void){
+    unsigned long out;
+    OMP_critical(apop_db_serial)
+    out = ++last_serial;
+    return out;
+}
+
+static unsigned long current_serial(void){
+    return thread_handle ? thread_handle->serial : shared_serial;
+}
+
+/* The data sets registered as virtual tables on the shared connection; see
+   apop_sqlite_register_vtab. SQLite frees the registry when the connection closes. */
+static struct vtab_registry *shared_vtabs = NULL;
+
+static struct vtab_registry **current_vtabs(void){
+    return thread_handle ? &thread_handle->vtabs : &shared_vtabs;
+}
+
+/* Strip comments, collapse each run of white space outside of quotes to a single space,
+   and drop trailing spaces and semicolons, so trivially different spellings of a query
+   share an entry. The hash is djb2 over the result. */
+static char *normalise_sql(char const *in, unsigned long *hash){
+    char *out = malloc(strlen(in)+1), *o = out;
+    char close = '\0';
+    for (char const *c = in; *c; c++){
+        if (close){ //inside quotes: copy verbatim.
+            if (*c == close) close = '\0';
+            *o++ = *c;
+        } else if (c[0]=='-' && c[1]=='-'){
+            while (c[1] && c[1] != '\n') c++;
+            if (o > out && o[-1] != ' ') *o++ = ' ';
+        } else if (c[0]=='/' && c[1]=='*'){
+            for (c += 2; *c && !(c[0]=='*' && c[1]=='/'); c++) ;
+            if (!*c) break;
+            c++;
+            if (o > out && o[-1] != ' ') *o++ = ' ';
+        } else if (isspace(*c)){
+            if (o > out && o[-1] != ' ') *o++ = ' ';
+        } else {
+            if (*c=='\'' || *c=='"' || *c=='`') close = *c;
+            else if (*c=='[') close = ']';
+            *o++ = *c;
+        }
     }
+    while (!close && o > out && (o[-1]==' ' || o[-1]==';')) o--;
+    *o = '\0';
+    *hash = 5381;
+    for (char const *c = out; *c; c++) *hash = *hash*33 + (unsigned char)*c;
+    return out;
 }
 
-static void stdDevFinalizePop(sqlite3_context *context){
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if (p && p->cnt>1)
-      sqlite3_result_double(context, sqrt((p->avg2 - gsl_pow_2(p->avg))));
-    else if (p->cnt == 1)
-      	sqlite3_result_double(context, 0);
+/* Every statement in any thread's cache is also listed here, with its connection's
+   serial number, so that closing a connection can finalize the statements that all
+   threads cached on it. Otherwise, sqlite3_close_v2 would leave the connection open
+   until every thread that used it evicted its entries, which an idle thread never
+   does. A thread finalizes its own entry only if the statement is still listed, i.e.,
+   the connection wasn't closed under it. Use from inside OMP_critical(apop_stmt_cache). */
+static struct {
+    struct {sqlite3_stmt *stmt; unsigned long serial;} *list;
+    size_t ct, cap;
+} all_cached;
+
+static int all_cached_add(sqlite3_stmt *stmt, unsigned long serial){
+    if (all_cached.ct == all_cached.cap){
+        size_t newcap = all_cached.cap ? 2*all_cached.cap : Stmt_cache_size;
+        void *newlist = realloc(all_cached.list, sizeof(*all_cached.list) * newcap);
+        if (!newlist) return 1;
+        all_cached.list = newlist;
+        all_cached.cap = newcap;
+    }
+    all_cached.list[all_cached.ct].stmt = stmt;
+    all_cached.list[all_cached.ct++].serial = serial;
+    return 0;
+}
+
+//Drop the statement from the list, returning 1 if it was there to be dropped.
+static int all_cached_remove(sqlite3_stmt *stmt, unsigned long serial){
+    for (size_t i=0; i< all_cached.ct; i++)
+        if (all_cached.list[i].stmt == stmt && all_cached.list[i].serial == serial){
+            all_cached.list[i] = all_cached.list[--all_cached.ct];
+            return 1;
+        }
+    return 0;
+}
+
+static void stmt_cache_clear_entry(cached_stmt_t *e){
+    if (e->stmt)
+        OMP_critical(apop_stmt_cache)
+        if (all_cached_remove(e->stmt, e->serial)) sqlite3_finalize(e->stmt);
+    free(e->sql);
+    *e = (cached_stmt_t){ };
+}
+
+/* For closing the connection with the given serial number: drop this thread's entries
+   for it, and finalize the statements every other thread cached on it. Those threads'
+   entries never match a query again (the serial is retired), and are freed when evicted. */
+static void stmt_cache_drop(unsigned long serial){
+    for (int i=0; i< Stmt_cache_size; i++)
+        if (stmt_cache[i].sql && stmt_cache[i].serial == serial)
+            stmt_cache_clear_entry(stmt_cache+i);
+    OMP_critical(apop_stmt_cache)
+    for (size_t i=0; i< all_cached.ct; )
+        if (all_cached.list[i].serial == serial){
+            sqlite3_finalize(all_cached.list[i].stmt);
+            all_cached.list[i] = all_cached.list[--all_cached.ct];
+        } else i++;
+}
+
+/* Return the query as a reset statement on the current connection, preparing it and
+   caching it (over the least recently used entry) if this thread hasn't seen it yet.
+   If the query holds more than one statement, or none, return NULL with *status ==
+   SQLITE_OK, and the caller should step through it the long way. On a preparation error,
+   return NULL with the error code in *status; errors aren't cached.
+
+   Hand the statement back via stmt_cache_release when done with it. */
+static sqlite3_stmt *stmt_cache_get(char const *query, int *status){
+    unsigned long serial = current_serial(), hash;
+    char *sql = normalise_sql(query, &hash);
+    cached_stmt_t *oldest = stmt_cache;
+    for (int i=0; i< Stmt_cache_size; i++){
+        cached_stmt_t *e = stmt_cache+i;
+        if (e->sql && e->hash == hash && e->serial == serial && !strcmp(e->sql, sql)){
+            free(sql);
+            e->last_used = ++stmt_clock;
+            *status = SQLITE_OK;
+            return e->stmt;
+        }
+        if (e->last_used < oldest->last_used) oldest = e; //empty entries have last_used==0.
+    }
+    sqlite3_stmt *stmt = NULL;
+    char const *tail;
+    *status = sqlite3_prepare_v2(apop_sqlite_db(), sql, -1, &stmt, &tail);
+    if (*status != SQLITE_OK){
+        free(sql);
+        return NULL;
+    }
+    while (tail && isspace(*tail)) tail++;
+    if (tail && *tail){ //more statements follow.
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+    }
+    int unlisted = 0;
+    if (stmt)
+        OMP_critical(apop_stmt_cache)
+        unlisted = all_cached_add(stmt, serial);
+    if (unlisted){ //out of memory: don't cache, and have the caller run it the long way.
+        sqlite3_finalize(stmt);
+        free(sql);
+        return NULL;
+    }
+    stmt_cache_clear_entry(oldest);
+    *oldest = (cached_stmt_t){.sql=sql, .hash=hash, .serial=serial, .stmt=stmt, .last_used=++stmt_clock};
+    return stmt;
+}
+
+static void stmt_cache_release(sqlite3_stmt *stmt){
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+//Close a connection, leaving it to SQLite to finish the job if statements outside the cache (e.g., a cursor) are still open on it.
+static void apop_sqlite_db_close(sqlite3 *conn, unsigned long serial){
+    stmt_cache_drop(serial);
+#if SQLITE_VERSION_NUMBER >= 3007014
+    sqlite3_close_v2(conn);
+#else
+    sqlite3_close(conn);
+#endif
 }
 
+
+
+/* The moment aggregates keep central moments, updated as per Terriberry's extension of
+   Welford's method, which doesn't lose precision to cancellation the way the E(x^2) - E(x)^2
+   form does when the mean is large relative to the spread. Each row merges in as a point
+   with weight w (or 1 for the one-argument forms); merging with weight -w takes the point
+   back out, which is all SQLite needs to run these as window functions. NULL values and
+   weights are skipped, as with the built-in aggregates. */
+
+/** \cond doxy_ignore */
+typedef struct {
+    double n;              /* sum of weights */
+    double mean;
+    double m2, m3, m4;     /* sums of weighted powers of deviations from the mean */
+    sqlite3_int64 cnt;     /* number of rows counted */
+} moments_t;
+/** \endcond */
+
+static inline void moments_add(moments_t *p, double x, double w, int order){
+    double n_a = p->n, n = n_a + w;
+    if (!n){ //the rows left have zero total weight, and so no moments.
+        *p = (moments_t){.cnt=p->cnt};
+        return;
+    }
+    double delta = x - p->mean, dn = delta/n, term = delta*dn*n_a*w;
+    if (order >= 4)
+        p->m4 += term*dn*dn*(n_a*n_a - n_a*w + w*w) + 6*dn*dn*w*w*p->m2 - 4*dn*w*p->m3;
+    if (order >= 3)
+        p->m3 += term*dn*(n_a - w) - 3*dn*w*p->m2;
+    p->m2 += term;
+    p->mean += dn*w;
+    p->n = n;
+}
+
+//sign is 1 to add the row, -1 to remove it.
+static inline void moments_step(sqlite3_context *context, int argc, sqlite3_value **argv, int order, int sign){
+    if (argc<1 || sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    double w = 1;
+    if (argc > 1){
+        if (sqlite3_value_type(argv[1]) == SQLITE_NULL) return;
+        w = sqlite3_value_double(argv[1]);
+        if (isnan(w)) return;
+    }
+    moments_t *p = sqlite3_aggregate_context(context, sizeof(*p));
+    if (!p) return;
+    p->cnt += sign;
+    if (!p->cnt) *p = (moments_t){ }; //start clean, rather than carry round-off forward.
+    else if (w) moments_add(p, sqlite3_value_double(argv[0]), sign*w, order);
+}
+
+#define Moment_steps(name, order) \
+static void name##Step(sqlite3_context *context, int argc, sqlite3_value **argv){ \
+    moments_step(context, argc, argv, order, 1); } \
+static void name##Inverse(sqlite3_context *context, int argc, sqlite3_value **argv){ \
+    moments_step(context, argc, argv, order, -1); }
+
+Moment_steps(two, 2) Moment_steps(three, 3) Moment_steps(four, 4)
+
+/* The finalizers double as xValue functions for windows, so they don't free or change
+   the context. They return NULL when no rows have been counted or the weights sum to
+   zero, and zero for one row.
+
+   For the sample corrections, n is the total weight, unless the weights sum to less
+   than 1.1, in which case they are taken to be proportions and n is the row count, as
+   with apop_vector_var. */
+static moments_t *moments_get(sqlite3_context *context){
+    moments_t *p = sqlite3_aggregate_context(context, 0);
+    return p && p->cnt && p->n ? p : NULL;
+}
+
+static double moments_n(moments_t const *p){ return p->n < 1.1 ? p->cnt : p->n; }
+
 static void varFinalizePop(sqlite3_context *context){
-  StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if( p && p->cnt>1 )
-        sqlite3_result_double(context, (p->avg2 - gsl_pow_2(p->avg)));
-    else if (p->cnt == 1)
-    	sqlite3_result_double(context, 0);
+    moments_t *p = moments_get(context);
+    if (p) sqlite3_result_double(context, p->cnt == 1 ? 0 : p->m2/p->n);
 }
 
-static void stdDevFinalize(sqlite3_context *context){
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if( p && p->cnt>1 ){
-      double rCnt = p->cnt;
-      sqlite3_result_double(context,
-         sqrt((p->avg2 - gsl_pow_2(p->avg))*rCnt/(rCnt-1.0)));
-    } else if (p->cnt == 1)
-      	sqlite3_result_double(context, 0);
+static void stdDevFinalizePop(sqlite3_context *context){
+    moments_t *p = moments_get(context);
+    if (p) sqlite3_result_double(context, p->cnt == 1 ? 0 : sqrt(p->m2/p->n));
 }
 
 static void varFinalize(sqlite3_context *context){
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if( p && p->cnt>1 ){
-      double rCnt = p->cnt;
-      sqlite3_result_double(context,
-         (p->avg2 - gsl_pow_2(p->avg))*rCnt/(rCnt-1.0));
-    } else if (p->cnt == 1)
-      	sqlite3_result_double(context, 0);
+    moments_t *p = moments_get(context);
+    double n = p ? moments_n(p) : 0;
+    if (p) sqlite3_result_double(context, p->cnt == 1 ? 0 : p->m2/p->n * n/(n-1.0));
+}
+
+static void stdDevFinalize(sqlite3_context *context){
+    moments_t *p = moments_get(context);
+    double n = p ? moments_n(p) : 0;
+    if (p) sqlite3_result_double(context, p->cnt == 1 ? 0 : sqrt(p->m2/p->n * n/(n-1.0)));
 }
 
 static void skewFinalize(sqlite3_context *context){
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if( p && p->cnt>1 ){
-      double rCnt = p->cnt;
-      sqlite3_result_double(context,
-         (p->avg3*rCnt - 3*p->avg2*p->avg*rCnt 
-                        + 2*rCnt * gsl_pow_3(p->avg)) * rCnt/((rCnt-1.0)*(rCnt-2.0)));
-    } else if (p->cnt == 1)
-      	sqlite3_result_double(context, 0);
+    moments_t *p = moments_get(context);
+    double n = p ? moments_n(p) : 0;
+    if (p) sqlite3_result_double(context, p->cnt == 1 ? 0 : p->m3/p->n * n*n/((n-1.0)*(n-2.0)));
 }
 
 static void kurtFinalize(sqlite3_context *context){
-    StdDevCtx *p = sqlite3_aggregate_context(context, sizeof(*p));
-    if( p && p->cnt>1 ){
-      double n = p->cnt;
-      double kurtovern = p->avg4 - 4*p->avg3*p->avg
-                        + 6 * p->avg2*gsl_pow_2(p->avg)
-                        - 3* gsl_pow_4(p->avg);
-      double var = p->avg2 - gsl_pow_2(p->avg);
-      long double coeff0= n*n/(gsl_pow_3(n)*(gsl_pow_2(n)-3*n+3));
-      long double coeff1= n*gsl_pow_2(n-1)+ (6*n-9);
-      long double coeff2= n*(6*n-9);
-      sqlite3_result_double(context, coeff0*(coeff1 * kurtovern + coeff2 * gsl_pow_2(var)));
-    } else if (p->cnt == 1)
-      sqlite3_result_double(context, 0);
+    moments_t *p = moments_get(context);
+    if (!p) return;
+    if (p->cnt == 1){
+        sqlite3_result_double(context, 0);
+        return;
+    }
+    double n = moments_n(p);
+    double kurtovern = p->m4/p->n;
+    double var = p->m2/p->n;
+    long double coeff0= n*n/(gsl_pow_3(n)*(gsl_pow_2(n)-3*n+3));
+    long double coeff1= n*gsl_pow_2(n-1)+ (6*n-9);
+    long double coeff2= n*(6*n-9);
+    sqlite3_result_double(context, coeff0*(coeff1 * kurtovern + coeff2 * gsl_pow_2(var)));
+}
+
+/* Order statistics. quantile(x, p) and median(x) keep every non-NULL value and, at the
+   end, select the one(s) at rank p(n-1) in place, in expected linear time, then
+   interpolate between the two neighbors as gsl_stats_quantile_from_sorted_data does.
+
+   quantile_approx(x, p) keeps a KLL sketch (Karnin, Lang, and Liberty, 2016) instead:
+   a stack of buffers where level h holds items that each stand for 2^h observations.
+   When the sketch fills, the lowest full level is sorted and every other item, from a
+   random start, is promoted to the next level. Memory stays at about 3*Kll_k items
+   plus a few per level, and the rank error is about 1.5% of n. */
+
+/** \cond doxy_ignore */
+typedef struct {
+    double *vals, p;
+    size_t n, alloc;
+} quantile_t;
+/** \endcond */
+
+//Read the p argument, or 0.5 for median. On a bad p, set an error and return 0.
+static int quantile_p(sqlite3_context *context, int argc, sqlite3_value **argv, double *p){
+    *p = argc > 1 ? sqlite3_value_double(argv[1]) : 0.5;
+    if ((argc > 1 && sqlite3_value_type(argv[1]) == SQLITE_NULL) || !(*p >= 0 && *p <= 1)){
+        sqlite3_result_error(context, "The quantile must be between zero and one.", -1);
+        return 0;
+    }
+    return 1;
+}
+
+static void quantileStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    quantile_t *q = sqlite3_aggregate_context(context, sizeof(*q));
+    if (!q) {sqlite3_result_error_nomem(context); return;}
+    if (q->n == q->alloc){
+        if (!q->alloc && !quantile_p(context, argc, argv, &q->p)) return;
+        size_t alloc = q->alloc ? 2*q->alloc : 1024;
+        double *vals = realloc(q->vals, alloc*sizeof(double));
+        if (!vals) {sqlite3_result_error_nomem(context); return;}
+        q->vals = vals;
+        q->alloc = alloc;
+    }
+    q->vals[q->n++] = sqlite3_value_double(argv[0]);
+}
+
+/* Rearrange x so that x[k] is what would be there after a sort, with nothing greater
+   before it and nothing less after. This is Hoare's quickselect. */
+static void select_kth(double *x, long n, long k){
+    long lo = 0, hi = n-1;
+    while (hi > lo){
+        double a = x[lo], b = x[lo + (hi-lo)/2], c = x[hi];
+        double pivot = a < b ? (b < c ? b : GSL_MAX(a, c)) : (a < c ? a : GSL_MAX(b, c));
+        long i = lo, j = hi;
+        while (i <= j){
+            while (x[i] < pivot) i++;
+            while (x[j] > pivot) j--;
+            if (i <= j){
+                double t = x[i]; x[i] = x[j]; x[j] = t;
+                i++; j--;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else return;
+    }
+}
+
+static void quantileFinal(sqlite3_context *context){
+    quantile_t *q = sqlite3_aggregate_context(context, 0);
+    if (!q) return;
+    if (q->n){
+        double h = q->p*(q->n-1);
+        long k = h;
+        select_kth(q->vals, q->n, k);
+        double out = q->vals[k];
+        if (h > k){ //interpolate toward the next order statistic: the least of those above.
+            double next = q->vals[k+1];
+            for (size_t i=k+2; i< q->n; i++) next = GSL_MIN(next, q->vals[i]);
+            out += (h-k)*(next-out);
+        }
+        sqlite3_result_double(context, out);
+    }
+    free(q->vals);
+}
+
+#define Kll_k 200
+
+/** \cond doxy_ignore */
+typedef struct {
+    double *items;
+    size_t n, alloc;
+} kll_level_t;
+
+typedef struct {
+    kll_level_t level[64];
+    int height;
+    size_t size, max_size;
+    sqlite3_uint64 rng;
+    double p, min, max; //compaction can drop the extremes, so keep them aside.
+} kll_t;
+
+typedef struct {
+    double x, weight;
+} kll_item_t;
+/** \endcond */
+
+static int compare_doubles(void const *a, void const *b){
+    double const *da = a, *db = b;
+    return (*da > *db) - (*da < *db);
+}
+
+static int compare_kll_items(void const *a, void const *b){
+    return compare_doubles(&((kll_item_t const *)a)->x, &((kll_item_t const *)b)->x);
+}
+
+//Levels near the top get Kll_k slots; each level down gets 2/3 as many, but at least two.
+static size_t kll_capacity(kll_t const *s, int h){
+    return ceil(Kll_k * pow(2/3., s->height - h - 1)) + 1;
+}
+
+static void kll_grow(kll_t *s){
+    s->height++;
+    s->max_size = 0;
+    for (int h=0; h< s->height; h++) s->max_size += kll_capacity(s, h);
+}
+
+static int kll_push(kll_level_t *l, double x){
+    if (l->n == l->alloc){
+        size_t alloc = l->alloc ? 2*l->alloc : 16;
+        double *items = realloc(l->items, alloc*sizeof(double));
+        if (!items) return 1;
+        l->items = items;
+        l->alloc = alloc;
+    }
+    l->items[l->n++] = x;
+    return 0;
+}
+
+//Compact the lowest full level. Return nonzero on allocation failure.
+static int kll_compress(kll_t *s){
+    for (int h=0; h< s->height; h++){
+        kll_level_t *l = s->level+h;
+        if (l->n < kll_capacity(s, h)) continue;
+        if (h+1 == s->height){
+            if (s->height == sizeof(s->level)/sizeof(s->level[0])) return 0; //can't happen before 2^64 rows.
+            kll_grow(s);
+        }
+        qsort(l->items, l->n, sizeof(double), compare_doubles);
+        s->rng ^= s->rng << 13; //xorshift64
+        s->rng ^= s->rng >> 7;
+        s->rng ^= s->rng << 17;
+        size_t start = s->rng & 1, pairs = l->n/2;
+        for (size_t j=0; j< pairs; j++)
+            if (kll_push(s->level+h+1, l->items[2*j+start])) return 1;
+        if (l->n % 2) l->items[0] = l->items[l->n-1]; //the odd one out stays.
+        l->n %= 2;
+        s->size -= pairs;
+        return 0;
+    }
+    return 0;
+}
+
+static void kllStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    kll_t *s = sqlite3_aggregate_context(context, sizeof(*s));
+    if (!s) {sqlite3_result_error_nomem(context); return;}
+    if (!s->height){
+        if (!quantile_p(context, argc, argv, &s->p)) return;
+        s->rng = 0x9E3779B97F4A7C15ULL; //fixed, so a query gives the same answer every time.
+        kll_grow(s);
+        s->min = s->max = sqlite3_value_double(argv[0]);
+    }
+    double x = sqlite3_value_double(argv[0]);
+    s->min = GSL_MIN(s->min, x);
+    s->max = GSL_MAX(s->max, x);
+    if (kll_push(s->level, x) 
+            || (++s->size >= s->max_size && kll_compress(s)))
+        sqlite3_result_error_nomem(context);
+}
+
+static void kllFinal(sqlite3_context *context){
+    kll_t *s = sqlite3_aggregate_context(context, 0);
+    if (!s) return;
+    kll_item_t *items = s->size ? malloc(sizeof(kll_item_t)*s->size) : NULL;
+    size_t n = 0;
+    double total = 0;
+    for (int h=0; h< s->height; h++){
+        for (size_t i=0; items && i< s->level[h].n; i++){
+            items[n++] = (kll_item_t){.x=s->level[h].items[i], .weight=ldexp(1, h)};
+            total += ldexp(1, h);
+        }
+        free(s->level[h].items);
+    }
+    if (n){
+        qsort(items, n, sizeof(kll_item_t), compare_kll_items);
+        double cum = 0, target = s->p*total;
+        size_t i = 0;
+        for ( ; i < n-1 && (cum += items[i].weight) < target; i++) ;
+        sqlite3_result_double(context, s->p == 0 ? s->min : s->p == 1 ? s->max : items[i].x);
+    } else if (s->size) sqlite3_result_error_nomem(context);
+    free(items);
 }
 
 static void powFn(sqlite3_context *context, int argc, sqlite3_value **argv){
@@ -146,21 +541,46 @@ sqfn(sqrt) sqfn(exp) sqfn(log) sqfn(log10) sqfn(sin)
 sqfn(cos) sqfn(tan) sqfn(asin) sqfn(acos) sqfn(atan)
 
 
-static int apop_sqlite_db_open(char const *filename){
-    int status = sqlite3_open(filename ? filename : ":memory:", &db);
-    Apop_stopif(status, db=NULL; return status,
+//Open a connection at *out, with our SQL functions added to it.
+static int apop_sqlite_db_open(char const *filename, sqlite3 **out){
+    int status = sqlite3_open(filename ? filename : ":memory:", out);
+    Apop_stopif(status, sqlite3_close(*out); *out=NULL; return status,
             0, "The database %s didn't open.", filename ? filename : "in memory");
-	sqlite3_create_function(db, "stddev", 1, SQLITE_ANY, NULL, NULL, &twoStep, &stdDevFinalize);
-	sqlite3_create_function(db, "std", 1, SQLITE_ANY, NULL, NULL, &twoStep, &stdDevFinalizePop);
-	sqlite3_create_function(db, "stddev_samp", 1, SQLITE_ANY, NULL, NULL, &twoStep, &stdDevFinalize);
-	sqlite3_create_function(db, "stddev_pop", 1, SQLITE_ANY, NULL, NULL, &twoStep, &stdDevFinalizePop);
-	sqlite3_create_function(db, "var", 1, SQLITE_ANY, NULL, NULL, &twoStep, &varFinalize);
-	sqlite3_create_function(db, "var_samp", 1, SQLITE_ANY, NULL, NULL, &twoStep, &varFinalize);
-	sqlite3_create_function(db, "var_pop", 1, SQLITE_ANY, NULL, NULL, &twoStep, &varFinalizePop);
-	sqlite3_create_function(db, "variance", 1, SQLITE_ANY, NULL, NULL, &twoStep, &varFinalizePop);
-	sqlite3_create_function(db, "skew", 1, SQLITE_ANY, NULL, NULL, &threeStep, &skewFinalize);
-	sqlite3_create_function(db, "kurt", 1, SQLITE_ANY, NULL, NULL, &fourStep, &kurtFinalize);
-	sqlite3_create_function(db, "kurtosis", 1, SQLITE_ANY, NULL, NULL, &fourStep, &kurtFinalize);
+    sqlite3 *db = *out;
+    /* Each moment function takes one argument, or a value and a weight; the weighted
+       forms are also registered with a _w suffix, e.g., var_w(x, w). */
+    struct {char const *name; void (*step)(sqlite3_context*,int,sqlite3_value**),
+                (*inverse)(sqlite3_context*,int,sqlite3_value**), (*final)(sqlite3_context*);}
+    moment_fns[] = {
+        {"stddev", twoStep, twoInverse, stdDevFinalize},
+        {"std", twoStep, twoInverse, stdDevFinalizePop},
+        {"stddev_samp", twoStep, twoInverse, stdDevFinalize},
+        {"stddev_pop", twoStep, twoInverse, stdDevFinalizePop},
+        {"var", twoStep, twoInverse, varFinalize},
+        {"var_samp", twoStep, twoInverse, varFinalize},
+        {"var_pop", twoStep, twoInverse, varFinalizePop},
+        {"variance", twoStep, twoInverse, varFinalizePop},
+        {"skew", threeStep, threeInverse, skewFinalize},
+        {"kurt", fourStep, fourInverse, kurtFinalize},
+        {"kurtosis", fourStep, fourInverse, kurtFinalize}};
+    for (int i=0; i< sizeof(moment_fns)/sizeof(moment_fns[0]); i++){
+        char wname[20];
+        snprintf(wname, sizeof(wname), "%s_w", moment_fns[i].name);
+#if SQLITE_VERSION_NUMBER >= 3025000
+#define Add_moment(name, argc) sqlite3_create_window_function(db, name, argc, SQLITE_ANY, NULL, \
+            moment_fns[i].step, moment_fns[i].final, moment_fns[i].final, moment_fns[i].inverse, NULL);
+#else
+#define Add_moment(name, argc) sqlite3_create_function(db, name, argc, SQLITE_ANY, NULL, \
+            NULL, moment_fns[i].step, moment_fns[i].final);
+#endif
+        Add_moment(moment_fns[i].name, 1)
+        Add_moment(moment_fns[i].name, 2)
+        Add_moment(wname, 2)
+#undef Add_moment
+    }
+	sqlite3_create_function(db, "median", 1, SQLITE_ANY, NULL, NULL, &quantileStep, &quantileFinal);
+	sqlite3_create_function(db, "quantile", 2, SQLITE_ANY, NULL, NULL, &quantileStep, &quantileFinal);
+	sqlite3_create_function(db, "quantile_approx", 2, SQLITE_ANY, NULL, NULL, &kllStep, &kllFinal);
 	sqlite3_create_function(db, "ln", 1, SQLITE_ANY, NULL, &logFn, NULL, NULL);
 	sqlite3_create_function(db, "ran", 0, SQLITE_ANY, NULL, &rngFn, NULL, NULL);
 	sqlite3_create_function(db, "pow", 2, SQLITE_ANY, NULL, &powFn, NULL, NULL);
@@ -168,14 +588,13 @@ static int apop_sqlite_db_open(char const *filename){
 #define sqlink(name) sqlite3_create_function(db, #name , 1, SQLITE_ANY, NULL, &name##Fn, NULL, NULL);
     sqlink(sqrt) sqlink(exp) sqlink(sin) sqlink(cos)
     sqlink(tan) sqlink(asin) sqlink(acos) sqlink(atan) sqlink(log) sqlink(log10)
-	apop_query("pragma short_column_names");
+	sqlite3_exec(db, "pragma short_column_names", NULL, NULL, NULL);
     return 0;
 }
 
 /** \cond doxy_ignore */
 typedef struct {    //for the apop_query_to_... functions.
     int       firstcall, namecol;
-    size_t    currentrow;
     apop_data *outdata;
 } callback_t;
 /** \endcond */
@@ -188,6 +607,7 @@ static int db_to_chars(void *qinfo,int argc, char **argv, char **column){
     if (!d->names->textct) addnames++;
     if (qi->firstcall){
         qi->firstcall = 0;
+        if (!d->textarena && apop_opts.text_arena=='y') d->textarena = apop_text_arena_alloc(0);
         for(int i=0; i<argc; i++)
             if (apop_opts.db_name_column && !strcasecmp(column[i], apop_opts.db_name_column)){
                 qi->namecol = i;
@@ -202,7 +622,7 @@ static int db_to_chars(void *qinfo,int argc, char **argv, char **column){
             apop_name_add(d->names, argv[jj], 'r'); 
             ncshift ++;
         } else {
-            apop_text_set(d, rows, jj-ncshift, (argv[jj]==NULL)? apop_opts.nan_string: argv[jj]);
+            apop_text_set(d, rows, jj-ncshift, "%s", (argv[jj]==NULL)? apop_opts.nan_string: argv[jj]);
             //Asprintf(&(d->text[rows][jj-ncshift]), "%s", (argv[jj]==NULL)? "NaN": argv[jj]);
             if(addnames)
                 apop_name_add(d->names, column[jj], 't'); 
@@ -213,8 +633,8 @@ static int db_to_chars(void *qinfo,int argc, char **argv, char **column){
 apop_data * apop_sqlite_query_to_text(char *query){
     char *err = NULL;
     callback_t qinfo = {.outdata=apop_data_alloc(), .namecol=-1, .firstcall=1};
-    if (db==NULL) apop_db_open(NULL);
-    sqlite3_exec(db, query, db_to_chars, &qinfo, &err); ERRCHECK_SET_ERROR(qinfo.outdata)
+    if (!apop_sqlite_db()) apop_db_open(NULL);
+    sqlite3_exec(apop_sqlite_db(), query, db_to_chars, &qinfo, &err); ERRCHECK_SET_ERROR(qinfo.outdata)
     if (qinfo.outdata->textsize[0]==0){
         apop_data_free(qinfo.outdata);
         return NULL;
@@ -222,11 +642,215 @@ apop_data * apop_sqlite_query_to_text(char *query){
     return qinfo.outdata;
 }
 
+//What atof would make of the cell's text, without making SQLite print numbers to text first.
+static double column_number(sqlite3_stmt *stmt, int col){
+    int type = sqlite3_column_type(stmt, col);
+    if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) return sqlite3_column_double(stmt, col);
+    char const *text = type == SQLITE_NULL ? NULL : (char const *)sqlite3_column_text(stmt, col);
+    return text ? atof(text) : GSL_NAN;
+}
+
+//Numbers come straight from SQLite; only text cells need to be checked for NaN markers and converted.
+static double column_to_double(sqlite3_stmt *stmt, int col){
+    int type = sqlite3_column_type(stmt, col);
+    if (type != SQLITE_TEXT && type != SQLITE_BLOB) return column_number(stmt, col);
+    char const *text = (char const *)sqlite3_column_text(stmt, col);
+    return !text || !strcmp(text, "NULL") 
+            || (apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, text))
+             ? GSL_NAN : atof(text);
+}
+
+/* Bind the values, or the given row of the data set, to the statement's placeholders. The
+   data set's elements go in the order apop_data_to_db writes them: vector, matrix columns,
+   text columns, weights; row names are skipped. NaNs, and text that is blank or matches
+   apop_opts.nan_string, are bound as NULL. Return 0 on success, 1 on error. */
+static int bind_row(sqlite3_stmt *stmt, double const *values, apop_data const *data, int row){
+    int params = sqlite3_bind_parameter_count(stmt), field = 1;
+    if (!data){
+        Apop_stopif(params && !values, return 1, 0, "The query has %i placeholders, but you gave me no values to bind to them.", params);
+        for ( ; field <= params; field++)
+            if (!isnan(values[field-1])) sqlite3_bind_double(stmt, field, values[field-1]);
+        return 0;
+    }
+    Get_vmsizes(data) //vsize, msize1, msize2, wsize
+    int textcols = data->textsize[0] > row ? data->textsize[1] : 0;
+    int have = (vsize > row) + (msize1 > row ? msize2 : 0) + textcols + (wsize > row);
+    Apop_stopif(row < 0 || have != params, return 1, 0, "Row %i of the data set has %i elements to bind, "
+                        "but the query has %i placeholders.", row, have, params);
+#define Bind_number(x) {double v = (x); if (!isnan(v)) sqlite3_bind_double(stmt, field, v); field++;}
+    if (vsize > row) Bind_number(gsl_vector_get(data->vector, row));
+    if (msize1 > row)
+        for (int col=0; col < msize2; col++) Bind_number(gsl_matrix_get(data->matrix, row, col));
+    for (int col=0; col < textcols; col++){
+        char const *text = data->text[row][col];
+        if (*text && !(apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, text)))
+            sqlite3_bind_text(stmt, field, text, -1, SQLITE_STATIC);
+        field++;
+    }
+    if (wsize > row) Bind_number(gsl_vector_get(data->weights, row));
+#undef Bind_number
+    return 0;
+}
+
+/* Run a query that returns no data, via the statement cache if it is a single statement.
+   If bind is nonzero, bind values to its placeholders per bind_row first.
+   Return 0 on success, 1 on error. */
+static int apop_sqlite_query(char const *query, int bind, double const *values, apop_data const *data, int row){
+    int status;
+    sqlite3_stmt *stmt = stmt_cache_get(query, &status);
+    Apop_stopif(status != SQLITE_OK, return 1, 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+    if (!stmt){ //several statements, or none.
+        Apop_stopif(bind, return 1, 0, "%s: I can only bind values to a query of exactly one statement.", query);
+        char *err = NULL;
+        sqlite3_exec(apop_sqlite_db(), query, NULL, NULL, &err);
+        Apop_stopif(err, sqlite3_free(err); return 1, 0, "%s: %s", query, err);
+        return 0;
+    }
+    if (bind && bind_row(stmt, values, data, row)){
+        stmt_cache_release(stmt);
+        return 1;
+    }
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW) ; //any output is ignored, as with sqlite3_exec.
+    Apop_stopif(status != SQLITE_DONE, stmt_cache_release(stmt); return 1, 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+    stmt_cache_release(stmt);
+    return 0;
+}
+
+/** \cond doxy_ignore */
+typedef struct {    //for apop_sqlite_query_to_data.
+    apop_data *out;
+    size_t row, capacity, cols;
+    int namecol;
+} matrix_fill_t;
+/** \endcond */
+
+/* Step through the statement, putting the rows straight into the output matrix, which
+   grows by doubling. Return the status of the last step: SQLITE_DONE if all went well. */
+static int step_to_matrix(sqlite3_stmt *stmt, matrix_fill_t *f){
+    int status, argc = sqlite3_column_count(stmt);
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW){
+        if (!f->out){
+            for (int i=0; i< argc; i++)
+                if (apop_opts.db_name_column && !strcasecmp(sqlite3_column_name(stmt, i), apop_opts.db_name_column)){
+                    f->namecol = i;
+                    break;
+                }
+            f->cols = argc - (f->namecol >= 0);
+            f->out = f->cols ? apop_data_alloc(1, f->cols) : apop_data_alloc();
+            for (int i=0; i< argc; i++)
+                if (i != f->namecol) apop_name_add(f->out->names, sqlite3_column_name(stmt, i), 'c');
+            f->capacity = 1;
+        }
+        if (f->cols && f->row >= f->capacity){
+            f->capacity *= 2;
+            f->out->matrix = apop_matrix_realloc(f->out->matrix, f->capacity, f->cols);
+        }
+        size_t j = 0;
+        for (int i=0; i< argc; i++)
+            if (i == f->namecol) apop_name_add(f->out->names, (char const *)sqlite3_column_text(stmt, i), 'r');
+            else if (j < f->cols) gsl_matrix_set(f->out->matrix, f->row, j++, column_to_double(stmt, i));
+        f->row++;
+    }
+    return status;
+}
+
+/* Put the query's rows into a matrix. A single statement comes from the statement cache,
+   and if bind is nonzero, gets values bound to its placeholders per bind_row. Otherwise,
+   step through each statement in turn. As with sqlite3_exec, an error partway through
+   leaves the rows read so far, with out->error set. */
+static apop_data *sqlite_query_to_matrix(char const *query, int bind, double const *values, apop_data const *data, int row){
+    if (!apop_sqlite_db()) apop_db_open(NULL);
+    matrix_fill_t f = {.namecol = -1};
+    int status;
+    sqlite3_stmt *stmt = stmt_cache_get(query, &status);
+    Apop_stopif(status != SQLITE_OK, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+    Apop_stopif(status == SQLITE_OK && !stmt && bind, status = SQLITE_MISUSE, 0,
+                        "%s: I can only bind values to a query of exactly one statement.", query);
+    if (stmt){
+        if (bind && bind_row(stmt, values, data, row)) status = SQLITE_MISUSE;
+        else {
+            status = step_to_matrix(stmt, &f);
+            Apop_stopif(status != SQLITE_DONE, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+            if (status == SQLITE_DONE) status = SQLITE_OK;
+        }
+        stmt_cache_release(stmt);
+    } else if (status == SQLITE_OK){
+        char const *tail = query;
+        while (tail && *tail){
+            status = sqlite3_prepare_v2(apop_sqlite_db(), tail, -1, &stmt, &tail);
+            Apop_stopif(status != SQLITE_OK, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+            if (status != SQLITE_OK) break;
+            if (!stmt) continue; //white space or a comment.
+            status = step_to_matrix(stmt, &f);
+            Apop_stopif(status != SQLITE_DONE, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+            sqlite3_finalize(stmt);
+            if (status != SQLITE_DONE) break;
+            status = SQLITE_OK;
+        }
+    }
+    if (f.out && f.out->matrix && f.out->matrix->size1 > f.row)
+        f.out->matrix = apop_matrix_realloc(f.out->matrix, f.row, f.cols);
+    if (status != SQLITE_OK){
+        if (!f.out) f.out = apop_data_alloc();
+        f.out->error = 'q';
+    }
+    return f.out;
+}
+
+apop_data * apop_sqlite_query_to_data(char *query){
+    return sqlite_query_to_matrix(query, 0, NULL, NULL, 0);
+}
+
+/* Fill the cursor's page with up to max_rows rows, preparing each statement of the query
+   in turn as the last one runs out. Return the number of rows read. */
+static size_t apop_sqlite_cursor_fill(apop_query_cursor *c, size_t max_rows){
+    size_t n = 0;
+    while (n < max_rows){
+        sqlite3_stmt *stmt = c->result;
+        if (!stmt){
+            if (!c->tail || !*c->tail){
+                c->done = 1;
+                break;
+            }
+            int status = sqlite3_prepare_v2(c->connection, c->tail, -1, &stmt, &c->tail);
+            Apop_stopif(status != SQLITE_OK, c->error='q'; c->done=1, 0, "%s: %s", c->query, sqlite3_errmsg(c->connection));
+            if (c->done) break;
+            c->result = stmt; //NULL for white space or a comment.
+            continue;
+        }
+        int status = sqlite3_step(stmt);
+        if (status != SQLITE_ROW){
+            Apop_stopif(status != SQLITE_DONE, c->error='q'; c->done=1, 0, "%s: %s", c->query, sqlite3_errmsg(c->connection));
+            sqlite3_finalize(stmt);
+            c->result = NULL;
+            if (c->done) break;
+            continue;
+        }
+        int argc = sqlite3_column_count(stmt);
+        if (!c->page){
+            for (int i=0; i< argc; i++)
+                if (apop_opts.db_name_column && !strcasecmp(sqlite3_column_name(stmt, i), apop_opts.db_name_column)){
+                    c->namecol = i;
+                    break;
+                }
+            c->cols = argc - (c->namecol >= 0);
+            c->page = apop_data_alloc();
+            for (int i=0; i< argc; i++)
+                if (i != c->namecol) apop_name_add(c->page->names, sqlite3_column_name(stmt, i), 'c');
+        }
+        if (!cursor_has_room(c, n, max_rows)) break;
+        size_t j = 0;
+        for (int i=0; i< argc; i++)
+            if (i == c->namecol) apop_name_add(c->page->names, (char const *)sqlite3_column_text(stmt, i), 'r');
+            else if (j < c->cols) gsl_matrix_set(c->page->matrix, n, j++, column_to_double(stmt, i));
+        n++;
+    }
+    return n;
+}
+
 /** \cond doxy_ignore */
 typedef struct {
-    apop_data  *d;
-    int        intypes[5];//names, vectors, mcols, textcols, weights.
-    int        current, thisrow, error_thrown;
+    int        intypes[5];//names, vectors, mcols (including factors), textcols, weights.
     const char *instring;
 } apop_qt;
 /** \endcond */
@@ -238,7 +862,7 @@ static void count_types(apop_qt *in, const char *intypes){
     while ((c=intypes[i++]))
         if (c=='n'||c=='N')      in->intypes[0]++;
         else if (c=='v'||c=='V') in->intypes[1]++;
-        else if (c=='m'||c=='M') in->intypes[2]++;
+        else if (c=='m'||c=='M'||c=='f'||c=='F') in->intypes[2]++;
         else if (c=='t'||c=='T') in->intypes[3]++;
         else if (c=='w'||c=='W') in->intypes[4]++;
     if (in->intypes[0]>1)
@@ -249,81 +873,424 @@ static void count_types(apop_qt *in, const char *intypes){
         Apop_notify(1, "You asked apop_query_to_mixed for multiple weighting vectors. I'll ignore all but the last one.");
 }
 
-static int multiquery_callback(void *instruct, int argc, char **argv, char **column){
-    apop_qt *in = instruct;
-    char c;
-    int thistcol    = 0, 
-        thismcol    = 0,
-        colct       = 0,
-        i, addnames = 0;
-    in->thisrow ++;
-    if (!in->d) {
-        in->d = in->intypes[2]
-                ? apop_data_alloc(in->intypes[1], 1, in->intypes[2])
-                : apop_data_alloc(in->intypes[1]);
-        if (in->intypes[4])
-            in->d->weights  = gsl_vector_alloc(1);
-        if (in->intypes[3]){
-            in->d->textsize[0]  = 1;
-            in->d->textsize[1]  = in->intypes[3];
-            in->d->text         = malloc(sizeof(char***));
-        }
+//A copy of the cell's text, in the arena if there is one.
+static char *column_string(struct apop_text_arena *a, sqlite3_stmt *stmt, int col){
+    char const *text = (char const *)sqlite3_column_text(stmt, col);
+    if (!text) return a ? apop_text_arena_copy(a, "NaN", 3) : strdup("NaN");
+    return a ? apop_text_arena_copy(a, text, sqlite3_column_bytes(stmt, col)) : strdup(text);
+}
+
+/* One row of each requested part, named after the first statement's columns. kinds[i]
+   is the lower-cased type for column i, or '\0' for columns past the end of the type list. */
+static apop_data *multiquery_alloc(apop_qt const *in, sqlite3_stmt *stmt, int argc, char const *kinds){
+    apop_data *d = in->intypes[2]
+                ? apop_data_alloc(!!in->intypes[1], 1, in->intypes[2])
+                : apop_data_alloc(!!in->intypes[1]);
+    if (in->intypes[4]) d->weights = gsl_vector_alloc(1);
+    if (in->intypes[3]){
+        d->textsize[1] = in->intypes[3];
+        d->text        = malloc(sizeof(char**));
+        if (apop_opts.text_arena=='y') d->textarena = apop_text_arena_alloc(0);
     }
-    if (!(in->d->names->colct + in->d->names->textct + (in->d->names->vector!=NULL)))
-        addnames++;
-    if (in->d->textsize[1]){
-        in->d->textsize[0]         = in->thisrow;
-        in->d->text                = realloc(in->d->text, sizeof(char ***)*in->thisrow);
-        in->d->text[in->thisrow-1] = malloc(sizeof(char**) * in->d->textsize[1]);
-    }
-    if (in->intypes[2])
-        apop_matrix_realloc(in->d->matrix, in->thisrow, in->intypes[2]);
-    for (i=in->current=0; i< argc; i++){
-        c   = in->instring[in->current++];
-        if (c=='n'||c=='N'){
-            apop_name_add(in->d->names, (argv[i]? argv[i] : "NaN")  , 'r'); 
-            if(addnames)
-                apop_name_add(in->d->names, column[i], 'h'); 
-        } else if (c=='v'||c=='V'){
-            apop_vector_realloc(in->d->vector, in->thisrow);
-            apop_data_set(in->d, in->thisrow-1, -1, 
-                                    argv[i] ? atof(argv[i]) : GSL_NAN);
-            if(addnames)
-                apop_name_add(in->d->names, column[i], 'v'); 
-        } else if (c=='m'||c=='M'){
-            apop_data_set(in->d, in->thisrow-1, thismcol++, 
-                                    argv[i] ? atof(argv[i]) : GSL_NAN);
-            if(addnames)
-                apop_name_add(in->d->names, column[i], 'c'); 
-        } else if (c=='t'||c=='T'){
-            Asprintf(&(in->d->text[in->thisrow-1][thistcol++]), "%s", 
-			                        argv[i] ? argv[i] : "NaN");
-            if(addnames)
-                apop_name_add(in->d->names, column[i], 't'); 
-        } else if (c=='w'||c=='W'){
-            apop_vector_realloc(in->d->weights, in->thisrow);
-            gsl_vector_set(in->d->weights, in->thisrow-1, 
-                                    argv[i] ? atof(argv[i]) : GSL_NAN);
-        }
-        colct++;
+    for (int i=0; i< argc; i++){
+        char type = kinds[i]=='n' ? 'h' : (kinds[i]=='m' || kinds[i]=='f') ? 'c' : kinds[i];
+        if (type=='h' || type=='v' || type=='c' || type=='t')
+            apop_name_add(d->names, sqlite3_column_name(stmt, i), type);
     }
-    int requested = in->intypes[0]+in->intypes[1]+in->intypes[2]+in->intypes[3]+in->intypes[4];
-      Apop_stopif(colct != requested, in->error_thrown='d'; return 1, 1, 
-      "you asked for %i columns in your list of types(%s), but your query produced %u columns. "
-      "The remainder will be placed in the text section. Output data set's ->error element set to 'd'." , requested, in->instring, colct);
-    return 0;
+    return d;
+}
+
+static void multiquery_resize(apop_data *d, size_t rows){
+    if (d->matrix)  d->matrix  = apop_matrix_realloc(d->matrix, rows, d->matrix->size2);
+    if (d->vector)  d->vector  = apop_vector_realloc(d->vector, rows);
+    if (d->weights) d->weights = apop_vector_realloc(d->weights, rows);
+    if (d->textsize[1]) d->text = realloc(d->text, sizeof(char**)*rows);
 }
 
+/* Like apop_sqlite_query_to_data, step through the statements and write each cell
+   straight to its destination. The type list is read once per statement to give each
+   column its part and its slot in that part; all parts grow by doubling and are trimmed
+   at the end. A factor column's text is looked up in that column's category index, and
+   only the code is kept; the codes are put in sorted order and the categories page
+   added once all the rows are in. */
 apop_data *apop_sqlite_multiquery(const char *intypes, char *query){
     Apop_stopif(!intypes, apop_return_data_error('t'), 0, "You gave me NULL for the list of input types. I can't work with that.");
     Apop_stopif(!query, apop_return_data_error('q'), 0, "You gave me a NULL query. I can't work with that.");
-    char *err = NULL;
     apop_qt info = { };
     count_types(&info, intypes);
-	if (!db) apop_db_open(NULL);
-    sqlite3_exec(db, query, multiquery_callback, &info, &err); 
-    Apop_stopif(info.error_thrown, if (!info.d) apop_data_alloc(); info.d->error='d'; return info.d,
-            0, "dimension error");
-    ERRCHECK_SET_ERROR(info.d)
-	return info.d;
+	if (!apop_sqlite_db()) apop_db_open(NULL);
+    int requested = info.intypes[0]+info.intypes[1]+info.intypes[2]+info.intypes[3]+info.intypes[4];
+    int typect = strlen(intypes), status = SQLITE_OK, dim_error = 0;
+    size_t row = 0, capacity = 0;
+    apop_data *d = NULL;
+    apop_category_index *cats = calloc(info.intypes[2]+1, sizeof(apop_category_index));
+    sqlite3_stmt *stmt;
+    char const *tail = query;
+    while (tail && *tail){
+        status = sqlite3_prepare_v2(apop_sqlite_db(), tail, -1, &stmt, &tail);
+        Apop_stopif(status != SQLITE_OK, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+        if (status != SQLITE_OK) break;
+        if (!stmt) continue; //white space or a comment.
+        int argc = sqlite3_column_count(stmt);
+        char kinds[argc+1];
+        int slots[argc+1];
+        for (int i=0, mcol=0, tcol=0; i< argc; i++){
+            kinds[i] = i < typect ? tolower(intypes[i]) : '\0';
+            slots[i] = (kinds[i]=='m' || kinds[i]=='f') ? mcol++ : kinds[i]=='t' ? tcol++ : 0;
+            if (kinds[i]=='f') cats[slots[i]].own = 1;
+        }
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW){
+            if (!d){
+                d = multiquery_alloc(&info, stmt, argc, kinds);
+                capacity = 1;
+            }
+            if (row >= capacity) multiquery_resize(d, capacity *= 2);
+            if (d->textsize[1]){
+                d->text[row] = malloc(sizeof(char*) * d->textsize[1]);
+                for (size_t j=0; j< d->textsize[1]; j++) d->text[row][j] = apop_nul_string;
+                d->textsize[0] = row+1;
+            }
+            for (int i=0; i< argc; i++)
+                if (kinds[i]=='n'){
+                    char const *name = (char const *)sqlite3_column_text(stmt, i);
+                    apop_name_add(d->names, name ? name : "NaN", 'r');
+                }
+                else if (kinds[i]=='v') gsl_vector_set(d->vector, row, column_number(stmt, i));
+                else if (kinds[i]=='m') gsl_matrix_set(d->matrix, row, slots[i], column_number(stmt, i));
+                else if (kinds[i]=='t') d->text[row][slots[i]] = column_string(d->textarena, stmt, i);
+                else if (kinds[i]=='f'){
+                    char const *text = (char const *)sqlite3_column_text(stmt, i);
+                    gsl_matrix_set(d->matrix, row, slots[i], apop_category_code(cats+slots[i], text ? text : "NaN", 'y'));
+                }
+                else if (kinds[i]=='w') gsl_vector_set(d->weights, row, column_number(stmt, i));
+            row++;
+            Apop_stopif(argc != requested, dim_error=1, 1, 
+              "you asked for %i columns in your list of types(%s), but your query produced %u columns. "
+              "The remainder will be placed in the text section. Output data set's ->error element set to 'd'." , requested, intypes, argc);
+            if (dim_error) break;
+        }
+        Apop_stopif(!dim_error && status != SQLITE_DONE, , 0, "%s: %s", query, sqlite3_errmsg(apop_sqlite_db()));
+        sqlite3_finalize(stmt);
+        if (dim_error || status != SQLITE_DONE) break;
+        status = SQLITE_OK;
+    }
+    if (d && row < capacity) multiquery_resize(d, row);
+    for (int j=0; j< info.intypes[2]; j++){
+        if (d && cats[j].own) apop_category_add_page(d, j, cats+j);
+        apop_category_index_free(cats+j);
+    }
+    free(cats);
+    Apop_stopif(dim_error, d->error='d'; return d, 0, "dimension error");
+    if (status != SQLITE_OK){
+        if (!d) d = apop_data_alloc();
+        d->error = 'q';
+    }
+	return d;
+}
+
+/* A virtual table module reading straight from an apop_data set. The columns are laid
+   out as apop_data_to_db would write them: row names, vector, matrix columns, text
+   columns, weights. The rowid is the row number, counting from zero, and constraints on
+   it become a range of rows to read, so a lookup by rowid doesn't scan the whole set.
+   Nothing is copied, so changes to the data set's cells show up in the next query.
+
+   Each connection gets one module, named apop_data, whose aux pointer is the
+   connection's registry of the data sets handed to apop_data_register_vtab. A table
+   names its set by registry key, as in <tt>create virtual table temp.t using
+   apop_data(17)</tt>, so SQL alone can't point a table at anything but a set the program
+   registered. The key is dropped from the registry when its table is dropped. SQLite
+   holds the connection's mutex while it calls the module's methods, and we hold it
+   while changing the registry otherwise. */
+
+/** \cond doxy_ignore */
+struct vtab_registry {
+    struct {unsigned long key; apop_data const *d;} *sets;
+    size_t ct;
+};
+
+typedef struct {
+    sqlite3_vtab base;
+    apop_data const *d;
+    struct vtab_registry *reg;
+    unsigned long key;
+    int namecol, vcol, mcol, mcols, tcol, tcols, wcol; //first column of each part, or -1.
+} data_vtab_t;
+
+typedef struct {
+    sqlite3_vtab_cursor base;
+    sqlite3_int64 row, end;
+} data_vtab_cursor_t;
+/** \endcond */
+
+static sqlite3_int64 data_vtab_rows(data_vtab_t const *t){
+    apop_data const *d = t->d;
+    Get_vmsizes(d) //maxsize, wsize
+    sqlite3_int64 rows = GSL_MAX(maxsize, wsize);
+    if (t->namecol >= 0) rows = GSL_MAX(rows, d->names->rowct);
+    return rows;
+}
+
+static void data_vtab_add_col(char **decl, char *comma, char const *name){
+    xprintf(decl, "%s%c\"", *decl, *comma);
+    for (char const *c = name; *c; c++) //double any quote marks.
+        xprintf(decl, *c=='"' ? "%s\"\"" : "%s%c", *decl, *c);
+    xprintf(decl, "%s\"", *decl);
+    *comma = ',';
+}
+
+static apop_data const *vtab_registry_find(struct vtab_registry const *reg, unsigned long key){
+    for (size_t i=0; i< reg->ct; i++)
+        if (reg->sets[i].key == key) return reg->sets[i].d;
+    return NULL;
+}
+
+static void vtab_registry_drop(struct vtab_registry *reg, unsigned long key){
+    for (size_t i=0; i< reg->ct; i++)
+        if (reg->sets[i].key == key){
+            reg->sets[i] = reg->sets[--reg->ct];
+            return;
+        }
+}
+
+static void vtab_registry_free(void *reg){
+    if (reg) free(((struct vtab_registry*)reg)->sets);
+    free(reg);
+}
+
+//argv[3] is the one module argument, the registry key.
+static int data_vtab_connect(sqlite3 *conn, void *aux, int argc, char const *const *argv,
+                                sqlite3_vtab **out, char **err){
+    unsigned long key = argc == 4 ? strtoul(argv[3], NULL, 10) : 0;
+    apop_data const *d = key ? vtab_registry_find(aux, key) : NULL;
+    if (!d){
+        *err = sqlite3_mprintf("apop_data tables can only be set up via apop_data_register_vtab.");
+        return SQLITE_ERROR;
+    }
+    data_vtab_t *t = sqlite3_malloc(sizeof(data_vtab_t));
+    if (!t) return SQLITE_NOMEM;
+    *t = (data_vtab_t){.d=d, .reg=aux, .key=key, .namecol=-1, .vcol=-1, .mcol=-1, .tcol=-1, .wcol=-1};
+    char *decl = strdup("create table x(");
+    char comma = ' ';
+    int col = 0;
+    if (d->names && d->names->rowct){
+        t->namecol = col++;
+        data_vtab_add_col(&decl, &comma, apop_opts.db_name_column && *apop_opts.db_name_column
+                                            ? apop_opts.db_name_column : "row_names");
+    }
+    if (d->vector){
+        t->vcol = col++;
+        data_vtab_add_col(&decl, &comma, d->names && d->names->vector ? d->names->vector : "vector");
+    }
+    if (d->matrix){
+        t->mcol = col;
+        t->mcols = d->matrix->size2;
+        for (int i=0; i< t->mcols; i++, col++){
+            char *name = NULL;
+            if (!d->names || d->names->colct <= i) Asprintf(&name, "c%i", i);
+            data_vtab_add_col(&decl, &comma, name ? name : d->names->col[i]);
+            free(name);
+        }
+    }
+    if (d->textsize[1]){
+        t->tcol = col;
+        t->tcols = d->textsize[1];
+        for (int i=0; i< t->tcols; i++, col++){
+            char *name = NULL;
+            if (!d->names || d->names->textct <= i) Asprintf(&name, "tc%i", i);
+            data_vtab_add_col(&decl, &comma, name ? name : d->names->text[i]);
+            free(name);
+        }
+    }
+    if (d->weights){
+        t->wcol = col++;
+        data_vtab_add_col(&decl, &comma, "weights");
+    }
+    xprintf(&decl, "%s)", decl);
+    int status = col ? sqlite3_declare_vtab(conn, decl) : SQLITE_ERROR;
+    if (status != SQLITE_OK){
+        *err = sqlite3_mprintf(col ? "%s" : "The data set has no columns.", sqlite3_errmsg(conn));
+        sqlite3_free(t);
+    } else *out = &t->base;
+    free(decl);
+    return status;
+}
+
+static int data_vtab_disconnect(sqlite3_vtab *t){
+    sqlite3_free(t);
+    return SQLITE_OK;
+}
+
+//The table is being dropped, so the connection no longer needs its data set.
+static int data_vtab_destroy(sqlite3_vtab *t){
+    vtab_registry_drop(((data_vtab_t*)t)->reg, ((data_vtab_t*)t)->key);
+    return data_vtab_disconnect(t);
+}
+
+//Bits of idxNum, saying which rowid constraints were handed to data_vtab_filter, in this order.
+#define Rowid_eq 1
+#define Rowid_gt 2
+#define Rowid_ge 4
+#define Rowid_lt 8
+#define Rowid_le 16
+
+static int data_vtab_best_index(sqlite3_vtab *tab, sqlite3_index_info *info){
+    int eq = -1, lo = -1, hi = -1;
+    for (int i=0; i< info->nConstraint; i++){
+        struct sqlite3_index_constraint const *c = info->aConstraint+i;
+        if (!c->usable || c->iColumn != -1) continue;
+        if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) eq = i;
+        else if (c->op == SQLITE_INDEX_CONSTRAINT_GT || c->op == SQLITE_INDEX_CONSTRAINT_GE) lo = i;
+        else if (c->op == SQLITE_INDEX_CONSTRAINT_LT || c->op == SQLITE_INDEX_CONSTRAINT_LE) hi = i;
+    }
+    double rows = data_vtab_rows((data_vtab_t*)tab);
+    int argc = 0;
+    info->idxNum = 0;
+    if (eq >= 0){
+        info->aConstraintUsage[eq].argvIndex = ++argc;
+        info->aConstraintUsage[eq].omit = 1;
+        info->idxNum = Rowid_eq;
+        rows = 1;
+    } else {
+        if (lo >= 0){
+            info->aConstraintUsage[lo].argvIndex = ++argc;
+            info->aConstraintUsage[lo].omit = 1;
+            info->idxNum |= info->aConstraint[lo].op == SQLITE_INDEX_CONSTRAINT_GT ? Rowid_gt : Rowid_ge;
+            rows /= 3;
+        }
+        if (hi >= 0){
+            info->aConstraintUsage[hi].argvIndex = ++argc;
+            info->aConstraintUsage[hi].omit = 1;
+            info->idxNum |= info->aConstraint[hi].op == SQLITE_INDEX_CONSTRAINT_LT ? Rowid_lt : Rowid_le;
+            rows /= 3;
+        }
+    }
+    info->estimatedCost = rows;
+#if SQLITE_VERSION_NUMBER >= 3008002
+    info->estimatedRows = rows;
+#endif
+    if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == -1 && !info->aOrderBy[0].desc)
+        info->orderByConsumed = 1; //rows come out in rowid order.
+    return SQLITE_OK;
+}
+
+static int data_vtab_open(sqlite3_vtab *tab, sqlite3_vtab_cursor **out){
+    data_vtab_cursor_t *c = sqlite3_malloc(sizeof(data_vtab_cursor_t));
+    if (!c) return SQLITE_NOMEM;
+    *c = (data_vtab_cursor_t){ };
+    *out = &c->base;
+    return SQLITE_OK;
+}
+
+static int data_vtab_close(sqlite3_vtab_cursor *c){
+    sqlite3_free(c);
+    return SQLITE_OK;
+}
+
+/* Narrow [row, end) to the rows satisfying the rowid constraints. Comparisons with NULL
+   are never true; non-integer bounds are rounded inward. */
+static int data_vtab_filter(sqlite3_vtab_cursor *cursor, int idxnum, char const *idxstr,
+                                int argc, sqlite3_value **argv){
+    data_vtab_cursor_t *c = (data_vtab_cursor_t*)cursor;
+    double lo = 0, hi = data_vtab_rows((data_vtab_t*)cursor->pVtab);
+    int arg = 0;
+    for (int bit = Rowid_eq; bit <= Rowid_le; bit *= 2){
+        if (!(idxnum & bit)) continue;
+        if (sqlite3_value_type(argv[arg]) == SQLITE_NULL){
+            lo = hi;
+            break;
+        }
+        double v = sqlite3_value_double(argv[arg++]);
+        if (bit == Rowid_eq){
+            lo = GSL_MAX(lo, v == floor(v) ? v : hi);
+            hi = GSL_MIN(hi, v == floor(v) ? v+1 : lo);
+        }
+        else if (bit == Rowid_gt) lo = GSL_MAX(lo, floor(v)+1);
+        else if (bit == Rowid_ge) lo = GSL_MAX(lo, ceil(v));
+        else if (bit == Rowid_lt) hi = GSL_MIN(hi, ceil(v));
+        else if (bit == Rowid_le) hi = GSL_MIN(hi, floor(v)+1);
+    }
+    c->row = GSL_MIN(lo, hi);
+    c->end = hi;
+    return SQLITE_OK;
+}
+
+static int data_vtab_next(sqlite3_vtab_cursor *c){
+    ((data_vtab_cursor_t*)c)->row++;
+    return SQLITE_OK;
+}
+
+static int data_vtab_eof(sqlite3_vtab_cursor *cursor){
+    data_vtab_cursor_t *c = (data_vtab_cursor_t*)cursor;
+    return c->row >= c->end;
+}
+
+//Cells past the end of their part of the data set are NULL, as are NaNs, blank text, and text matching apop_opts.nan_string.
+static int data_vtab_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col){
+    data_vtab_t const *t = (data_vtab_t*)cursor->pVtab;
+    apop_data const *d = t->d;
+    size_t r = ((data_vtab_cursor_t*)cursor)->row;
+    if (col == t->namecol){
+        if (r < d->names->rowct) sqlite3_result_text(ctx, d->names->row[r], -1, SQLITE_STATIC);
+    } else if (col == t->vcol){
+        if (d->vector && r < d->vector->size) sqlite3_result_double(ctx, gsl_vector_get(d->vector, r));
+    } else if (t->mcol >= 0 && col >= t->mcol && col < t->mcol + t->mcols){
+        if (d->matrix && r < d->matrix->size1 && col - t->mcol < d->matrix->size2)
+            sqlite3_result_double(ctx, gsl_matrix_get(d->matrix, r, col - t->mcol));
+    } else if (t->tcol >= 0 && col >= t->tcol && col < t->tcol + t->tcols){
+        char const *text = r < d->textsize[0] && col - t->tcol < d->textsize[1] ? d->text[r][col - t->tcol] : NULL;
+        if (text && *text && !(apop_opts.nan_string && !strcasecmp(apop_opts.nan_string, text)))
+            sqlite3_result_text(ctx, text, -1, SQLITE_STATIC);
+    } else if (col == t->wcol){
+        if (d->weights && r < d->weights->size) sqlite3_result_double(ctx, gsl_vector_get(d->weights, r));
+    }
+    return SQLITE_OK;
+}
+
+static int data_vtab_rowid(sqlite3_vtab_cursor *c, sqlite3_int64 *rowid){
+    *rowid = ((data_vtab_cursor_t*)c)->row;
+    return SQLITE_OK;
+}
+
+static sqlite3_module data_vtab_module = {
+    .xCreate = data_vtab_connect,        .xConnect = data_vtab_connect,
+    .xBestIndex = data_vtab_best_index,
+    .xDisconnect = data_vtab_disconnect, .xDestroy = data_vtab_destroy,
+    .xOpen = data_vtab_open,             .xClose = data_vtab_close,
+    .xFilter = data_vtab_filter,         .xNext = data_vtab_next,
+    .xEof = data_vtab_eof,               .xColumn = data_vtab_column,
+    .xRowid = data_vtab_rowid
+};
+
+/* Register d on the current connection, setting up the connection's module on first
+   use, then create the table. */
+static int apop_sqlite_register_vtab(apop_data const *d, char const *tabname){
+    sqlite3 *conn = apop_sqlite_db();
+    struct vtab_registry **reg = current_vtabs();
+    unsigned long key = new_serial();
+    int status = SQLITE_OK;
+    sqlite3_mutex_enter(sqlite3_db_mutex(conn));
+    if (!*reg){
+        *reg = calloc(1, sizeof(struct vtab_registry));
+        status = *reg ? sqlite3_create_module_v2(conn, "apop_data", &data_vtab_module, *reg, vtab_registry_free)
+                      : SQLITE_NOMEM;
+        if (status != SQLITE_OK) *reg = NULL; //SQLite calls vtab_registry_free on failure.
+    }
+    void *sets = *reg ? realloc((*reg)->sets, sizeof(*(*reg)->sets) * ((*reg)->ct+1)) : NULL;
+    if (sets){
+        (*reg)->sets = sets;
+        (*reg)->sets[(*reg)->ct].key = key;
+        (*reg)->sets[(*reg)->ct++].d = d;
+    }
+    sqlite3_mutex_leave(sqlite3_db_mutex(conn));
+    Apop_stopif(!sets, return 1, 0, "Couldn't set up a virtual table for %s: %s", tabname,
+                    status == SQLITE_OK ? "out of memory" : sqlite3_errmsg(conn));
+    char *q = sqlite3_mprintf("create virtual table temp.\"%w\" using apop_data(%lu)", tabname, key);
+    int out = q ? apop_query("%s", q) : 1;
+    sqlite3_free(q);
+    if (out){
+        sqlite3_mutex_enter(sqlite3_db_mutex(conn));
+        vtab_registry_drop(*reg, key);
+        sqlite3_mutex_leave(sqlite3_db_mutex(conn));
+    }
+    return out;
 }
@@ -38,8 +38,11 @@ void xprintf(char **q, char *format, ...);
 #include <sqlite3.h>
 #include <stddef.h>
 int apop_use_sqlite_prepared_statements(size_t col_ct);
-int apop_prepare_prepared_statements(char const *tabname, size_t col_ct, sqlite3_stmt **statement);
+char *apop_insert_statement(char const *tabname, size_t col_ct, size_t rows); //apop_conversions.c
+int apop_prepare_prepared_statements(char const *tabname, size_t col_ct, size_t rows, sqlite3_stmt **statement);
+sqlite3 *apop_sqlite_db(void); //apop_db_sqlite.c
 char *prep_string_for_sqlite(int prepped_statements, char const *astring);//apop_conversions.c
+double apop_strtod(char const *in, char **end); //apop_strtod.c
 void apop_gsl_error(char const *reason, char const *file, int line, int gsl_errno); //apop_linear_algebra.c
 
 //For when we're forced to use a global variable.
@@ -57,10 +60,12 @@ void apop_gsl_error(char const *reason, char const *file, int line, int gsl_errn
 #ifdef _OPENMP
 #define PRAGMA(x) _Pragma(#x)
 #define OMP_critical(tag) PRAGMA(omp critical ( tag ))
+#define OMP_atomic(type) PRAGMA(omp atomic type)
 #define OMP_for(...) _Pragma("omp parallel for") for(__VA_ARGS__)
 #define OMP_for_reduce(red, ...) PRAGMA(omp parallel for reduction( red )) for(__VA_ARGS__)
 #else
 #define OMP_critical(tag)
+#define OMP_atomic(type)
 #define OMP_for(...) for(__VA_ARGS__)
 #define OMP_for_reduce(red, ...) for(__VA_ARGS__)
 #endif
@@ -83,4 +88,57 @@ extern int vasprintf (char **res, const char *format, va_list args)
 #include "apop.h"
 void add_info_criteria(apop_data *d, apop_model *m, apop_model *est, double ll, int param_ct); //In apop_mle.c
 
+//apop_db.c. Start, count rows of, and finish a load under the given apop_db_load_type.
+//Finish a failed load with a NULL tabname, to roll back the open batch.
+typedef struct {
+    apop_db_load_type const *load;
+    char *journal_mode, *synchronous; //the settings to restore when done.
+    double cache_size;
+    int own_transaction, set_cache_size;
+    char const *skipped; //if not NULL, a pragma that couldn't be set (or "all", inside the user's transaction).
+    size_t rows;
+} apop_db_load_state;
+apop_db_load_state apop_db_load_begin(apop_db_load_type const *load);
+void apop_db_load_row(apop_db_load_state *state);
+void apop_db_load_end(apop_db_load_state *state, char const *tabname);
+apop_db_handle *apop_db_thread_handle(void); //The handle apop_db_use set for this thread, or NULL.
+
 apop_model *maybe_prep(apop_data *d, apop_model *m, _Bool *is_a_copy); //in apop_mcmc, for apop_update.
+void apop_name_drop_index(apop_name *n, char type); //apop_name.c. Call before rewriting a name list in place,
+void apop_name_reindex(apop_name *n, char type);    //and this after.
+void apop_name_trim_rows(apop_name *n, int ct); //apop_name.c. Free all but the first ct row names.
+
+//apop_data.c. Like apop_*_realloc, but for appends: reserve room by doubling.
+gsl_matrix *apop_matrix_grow(gsl_matrix *m, size_t newheight, size_t newwidth);
+gsl_vector *apop_vector_grow(gsl_vector *v, size_t newheight);
+gsl_matrix *apop_matrix_room_for_row(gsl_matrix *m, size_t n, size_t cols, size_t max_rows);
+
+/* apop_data.c and apop_name.c. Bookkeeping for the parts that apop_data_share lets data
+   sets share. A shared vector or matrix counts its holders in its block (see apop_block
+   in apop_data.c). For text and names, every set holding the part points to one count of
+   its holders: an apop_data set via its ->shared element, an apop_name via its ->shared
+   element. The unshare functions give a holder its own copy of a shared part before
+   writing to it, and do nothing otherwise. */
+struct apop_data_shares {int *text;};
+int *apop_share_add(int **count);
+int apop_share_holders(int const *count);
+int apop_share_release(int **count);
+apop_name *apop_name_share(apop_name *in);
+void apop_name_unshare(apop_name *n);
+void apop_page_unshare(apop_data *d); //all parts of the page, not the more pages.
+
+//apop_data.c. Give a data set text storage in large blocks via d->textarena; see apop_text_set.
+struct apop_text_arena *apop_text_arena_alloc(size_t size_hint);
+char *apop_text_arena_copy(struct apop_text_arena *a, char const *text, size_t len);
+
+//apop_regression.c. A hash from category name to its code, numbered in order of first
+//appearance. If own is set, names added are copied, and freed with the index.
+typedef struct {
+    char **names;
+    size_t ct, room, mask;
+    int *slots; //-1 for empty, else a code.
+    _Bool own;
+} apop_category_index;
+int apop_category_code(apop_category_index *ix, char const *name, char add);
+apop_data *apop_category_add_page(apop_data *d, int col, apop_category_index const *ix);
+void apop_category_index_free(apop_category_index *ix);
@@ -205,7 +205,7 @@ APOP_VAR_ENDHEAD
     //else:
     size_t v1size = v1->size; //save in case of reallocing.
     if (inplace == 'y' )
-        out = apop_vector_realloc(v1, v1->size+v2->size);
+        out = apop_vector_grow(v1, v1->size+v2->size);
     else {
         out = gsl_vector_alloc(v1->size + v2->size);
         t   = gsl_vector_subvector(out, 0, v1size).vector;
@@ -264,7 +264,7 @@ APOP_VAR_ENDHEAD
         Apop_stopif(m1->size2 != m2->size2, return NULL, 0, "When stacking matrices on top of each other, they have to have the same number of columns, but  m1->size2==%zu and m2->size2==%zu. Returning NULL.", m1->size2, m2->size2);
         int m1size = m1->size1;
         if (inplace =='y')
-            out = apop_matrix_realloc(m1, m1->size1 + m2->size1, m1->size2);
+            out = apop_matrix_grow(m1, m1->size1 + m2->size1, m1->size2);
         else {
             out     = gsl_matrix_alloc(m1->size1 + m2->size1, m1->size2);
             for (int i=0; i< m1size; i++){
@@ -151,6 +151,7 @@ APOP_VAR_ENDHEAD
 
     //Allocate output
     Get_vmsizes(in); //vsize, msize1, msize2, maxsize
+    if (inplace=='y') apop_page_unshare(in);
     apop_data *out =   (inplace=='y') ? in
                      : (inplace=='v') ? NULL
                      : by_apop_rows ? apop_data_alloc(GSL_MAX(in->textsize[0], maxsize))
@@ -181,7 +181,7 @@ OMP_critical (metro_draw)
     int block = 0, done = 0;
     while (!done){
         s->proposal_count++;
-        earlier_draws->matrix = apop_matrix_realloc(earlier_draws->matrix, earlier_draws->matrix->size1+1, earlier_draws->matrix->size2);
+        earlier_draws->matrix = apop_matrix_grow(earlier_draws->matrix, earlier_draws->matrix->size1+1, earlier_draws->matrix->size2);
         one_step(s->base_model->data, &(vv.vector), m, s, rng, &constraint_fails, 
                             earlier_draws, block, earlier_draws->matrix->size1-1);
         block = (block+1) % s->block_count;
@@ -274,10 +274,10 @@ static void tracepath(const gsl_vector *beta, double value, apop_data **path){
         apop_name_add((*path)->names, "f(x)", 'v');
         apop_name_add((*path)->names, "x", 'm');
     }
-    (*path)->matrix = apop_matrix_realloc((*path)->matrix, msize1+1, beta->size);
+    (*path)->matrix = apop_matrix_grow((*path)->matrix, msize1+1, beta->size);
     gsl_vector_memcpy(Apop_rv(*path, msize1), beta);
 
-    (*path)->vector = apop_vector_realloc((*path)->vector, msize1+1);
+    (*path)->vector = apop_vector_grow((*path)->vector, msize1+1);
     gsl_vector_set((*path)->vector, msize1, value);
 }
 
@@ -4,6 +4,7 @@
 #include "apop_internal.h"
 #include <stdio.h>
 #include <regex.h>
+#include <ctype.h>
 
 /** Allocates a name structure
 \return	An allocated, empty name structure.  In the very unlikely event that \c malloc fails, return \c NULL.
@@ -35,6 +36,124 @@ static unsigned long apop_name_hash(char const *str){
     return hash;
 }
 
+/* Make room for one more name on a list and its hash list. The lists grow by doubling,
+   so adding n names one at a time costs O(n) reallocs in total. */
+static int grow_name_list(char ***list, unsigned long **hash, int ct, int *cap){
+    if (ct < *cap) return 0;
+    int newcap = ct ? ct*2 : 1;
+    char **newlist = realloc(*list, sizeof(char*) * newcap);
+    Apop_stopif(!newlist, return 1, 0, "realloc failed. Probably out of memory.");
+    *list = newlist;
+    unsigned long *newhash = realloc(*hash, sizeof(unsigned long) * newcap);
+    Apop_stopif(!newhash, return 1, 0, "realloc failed. Probably out of memory.");
+    *hash = newhash;
+    *cap = newcap;
+    return 0;
+}
+
+/* For a list of at least Name_index_min names, the apop_name keeps an open-addressed
+   table of positions in the list, keyed on the case-folded name, for apop_name_find. The
+   functions that write names build and maintain the table: add_to_list builds it when the
+   list reaches Name_index_min names and extends it after that, and functions that
+   rewrite a list in place drop the table before and call apop_name_reindex after. So
+   apop_name_find only reads the table, and searches in several threads need no lock.
+   Only lists the apop_name owns (those with a nonzero capacity) get a table, so views
+   like Apop_r never do. Names that share lists (see apop_name_share) share the tables
+   too, which are freed with the lists. */
+#define Name_index_min 16
+
+struct apop_name_index {
+    char **list;  //The list and count that the table describes.
+    int ct;
+    size_t mask;  //The table has mask+1 slots,
+    int *slots;   //each holding a position in the list, or -1 if empty.
+};
+
+static unsigned long name_fold_hash(char const *str){
+    unsigned long int hash = 5381;
+    for (unsigned char c; (c = *str++); ) hash = hash*33 + tolower(c);
+    return hash;
+}
+
+static void name_index_free(struct apop_name_index **ix){
+    if (!*ix) return;
+    free((*ix)->slots);
+    free(*ix);
+    *ix = NULL;
+}
+
+static void name_index_place(struct apop_name_index *ix, int i){
+    size_t s = name_fold_hash(ix->list[i]) & ix->mask;
+    while (ix->slots[s] != -1) s = (s+1) & ix->mask;
+    ix->slots[s] = i;
+}
+
+/* Index list[0]...list[ct-1], in that order, so a search finds the first of any
+   duplicates. Lists too short or not owned get no table. */
+static struct apop_name_index *name_index_build(char **list, int ct, int cap){
+    if (!cap || ct < Name_index_min) return NULL;
+    size_t size = 64;
+    while (size < 4*(size_t)ct) size *= 2;
+    struct apop_name_index *ix = malloc(sizeof(struct apop_name_index));
+    Apop_stopif(!ix, return NULL, 0, "malloc failed. Probably out of memory.");
+    *ix = (struct apop_name_index){.list=list, .mask=size-1, .slots=malloc(size*sizeof(int))};
+    Apop_stopif(!ix->slots, free(ix); return NULL, 0, "malloc failed. Probably out of memory.");
+    memset(ix->slots, -1, size*sizeof(int));
+    for ( ; ix->ct < ct; ix->ct++) name_index_place(ix, ix->ct);
+    return ix;
+}
+
+//The list gained names up to list[ct-1]. Past half full, start over with a bigger table.
+static void name_index_extend(struct apop_name_index **ix, char **list, int ct, int cap){
+    if (!*ix || (*ix)->ct != ct-1 || 2*(size_t)ct > (*ix)->mask+1){
+        name_index_free(ix);
+        *ix = name_index_build(list, ct, cap);
+        return;
+    }
+    (*ix)->list = list;
+    for ( ; (*ix)->ct < ct; (*ix)->ct++) name_index_place(*ix, (*ix)->ct);
+}
+
+static int add_to_list(char ***list, unsigned long **hash, int *ct, int *cap,
+                                    struct apop_name_index **ix, char const *add_me){
+    if (grow_name_list(list, hash, *ct, cap)) return -1;
+    (*list)[*ct] = strdup(add_me);
+    (*hash)[*ct] = apop_name_hash(add_me);
+    ++*ct;
+    if (*ct >= Name_index_min) name_index_extend(ix, *list, *ct, *cap);
+    return *ct;
+}
+
+/* For functions about to rewrite a list in place (deleting or rewriting names, &c.),
+   throw out the index for that list ('r', 'c', or 't'), or for all three ('a'). Call
+   apop_name_reindex when done, unless the list is rebuilt via apop_name_add. */
+void apop_name_drop_index(apop_name *n, char type){
+    if (!n) return;
+    apop_name_unshare(n); //the index goes with the lists.
+    if (type == 'r' || type == 'a') name_index_free(&n->rowindex);
+    if (type == 'c' || type == 'a') name_index_free(&n->colindex);
+    if (type == 't' || type == 'a') name_index_free(&n->textindex);
+}
+
+//For functions that rewrote a list in place: rebuild the index for the list ('r', 'c', 't', or 'a' for all).
+void apop_name_reindex(apop_name *n, char type){
+    if (!n) return;
+    apop_name_drop_index(n, type);
+    if (type == 'r' || type == 'a') n->rowindex = name_index_build(n->row, n->rowct, n->rowcap);
+    if (type == 'c' || type == 'a') n->colindex = name_index_build(n->col, n->colct, n->colcap);
+    if (type == 't' || type == 'a') n->textindex = name_index_build(n->text, n->textct, n->textcap);
+}
+
+/* Keep only the first ct row names, as for a set whose later rows were cut, or whose
+   rows are about to be refilled from the top. */
+void apop_name_trim_rows(apop_name *n, int ct){
+    if (!n) return;
+    apop_name_drop_index(n, 'r');
+    for (int k=ct; k< n->rowct; k++) free(n->row[k]);
+    if (n->rowct > ct) n->rowct = ct;
+    apop_name_reindex(n, 'r');
+}
+
 /** Adds a name to the \ref apop_name structure. Puts it at the end of the given list.
 
 \param n 	An existing, allocated \ref apop_name structure.
@@ -45,6 +164,11 @@ static unsigned long apop_name_hash(char const *str){
 'h': add a title (i.e., a header).<br>
 'v': add (or overwrite) the vector name<br>
 \return 	Returns the number of rows/cols/depvars after you have added the new one. But if \c add_me is \c NULL, return -1.
+
+\li The lists of names are over-allocated, and grow by doubling, so adding names one at a
+time to a long list is efficient. The \c rowcap, \c colcap, and \c textcap elements
+of the \ref apop_name struct record the allocated length of each list. If you replace
+one of the lists with your own array, set the corresponding capacity to zero.
 */
 int apop_name_add(apop_name * n, char const *add_me, char type){
     if (!add_me)
@@ -59,35 +183,16 @@ int apop_name_add(apop_name * n, char const *add_me, char type){
 		strcpy(n->vector, add_me);
 		return 1;
 	} 
-	if (type == 'r'){
-		n->rowct++;
-		n->row	= realloc(n->row, sizeof(char*) * n->rowct);
-		n->row[n->rowct -1]	= malloc(strlen(add_me) + 1);
-		strcpy(n->row[n->rowct -1], add_me);
-		n->rowhash = realloc(n->rowhash, n->rowct * sizeof(unsigned long));
-        n->rowhash[n->rowct-1] = apop_name_hash(add_me);
-		return n->rowct;
-	} 
-	if (type == 't'){
-		n->textct++;
-		n->text	= realloc(n->text, sizeof(char*) * n->textct);
-		n->text[n->textct -1]	= malloc(strlen(add_me) + 1);
-		strcpy(n->text[n->textct -1], add_me);
-		n->texthash = realloc(n->texthash, n->textct * sizeof(unsigned long));
-        n->texthash[n->textct-1] = apop_name_hash(add_me);
-		return n->textct;
-	}
+    apop_name_unshare(n); //the lists may be shared with other sets; see apop_data_share.
+	if (type == 'r')
+        return add_to_list(&n->row, &n->rowhash, &n->rowct, &n->rowcap, &n->rowindex, add_me);
+	if (type == 't')
+        return add_to_list(&n->text, &n->texthash, &n->textct, &n->textcap, &n->textindex, add_me);
 	//else assume (type == 'c')
         Apop_stopif(type != 'c', /*keep going.*/, 
             2,"You gave me >%c<, I'm assuming you meant c; "
                              " copying column names.", type);
-		n->colct++;
-		n->col = realloc(n->col, sizeof(char*) * n->colct);
-		n->col[n->colct -1]	= malloc(strlen(add_me) + 1);
-		strcpy(n->col[n->colct -1], add_me);
-		n->colhash = realloc(n->colhash, n->colct * sizeof(unsigned long));
-        n->colhash[n->colct-1] = apop_name_hash(add_me);
-		return n->colct;
+        return add_to_list(&n->col, &n->colhash, &n->colct, &n->colcap, &n->colindex, add_me);
 }
 
 /** Prints the given list of names to stdout. Useful for debugging.
@@ -124,19 +229,96 @@ void apop_name_print(apop_name * n){
 	}
 }
 	
+static void name_lists_free(apop_name const *n){
+	for (size_t i=0; i < n->colct; i++)  free(n->col[i]);
+	for (size_t i=0; i < n->textct; i++) free(n->text[i]);
+	for (size_t i=0; i < n->rowct; i++)  free(n->row[i]);
+	free(n->col);  free(n->colhash);
+	free(n->text); free(n->texthash);
+	free(n->row);  free(n->rowhash);
+}
+
 /** Free the memory used by an \ref apop_name structure. */
 void  apop_name_free(apop_name * free_me){
     if (!free_me) return; //only needed if users are doing tricky things like newdata = (apop_data){.matrix=...};
-	for (size_t i=0; i < free_me->colct; i++)  free(free_me->col[i]);
-	for (size_t i=0; i < free_me->textct; i++) free(free_me->text[i]);
-	for (size_t i=0; i < free_me->rowct; i++)  free(free_me->row[i]);
-    if (free_me->vector) free(free_me->vector);
-	free(free_me->col);  free(free_me->colhash);
-	free(free_me->text); free(free_me->texthash);
-	free(free_me->row);  free(free_me->rowhash);
+    if (apop_share_release(&free_me->shared) < 1){ //else other sets still hold the lists and their indexes.
+        name_lists_free(free_me);
+        name_index_free(&free_me->rowindex);
+        name_index_free(&free_me->colindex);
+        name_index_free(&free_me->textindex);
+    }
+    free(free_me->vector);
+    free(free_me->title);
 	free(free_me);
 }
 
+/* For apop_data_share: a new apop_name with its own title and vector name, and sharing
+   the row, column, and text lists of the input. Lists the input doesn't own (capacity
+   zero but some names) can't be shared, so then return a copy. */
+apop_name *apop_name_share(apop_name *in){
+    if ((in->rowct && !in->rowcap) || (in->colct && !in->colcap) || (in->textct && !in->textcap))
+        return apop_name_copy(in);
+    apop_name *out = apop_name_alloc();
+    Apop_stopif(!out, return NULL, 0, "malloc failed. Probably out of memory.");
+    int *shared = apop_share_add(&in->shared);
+    if (!shared){
+        free(out);
+        return apop_name_copy(in);
+    }
+    *out = (apop_name){.shared = shared,
+                       .title = in->title ? strdup(in->title) : NULL,
+                       .vector = in->vector ? strdup(in->vector) : NULL,
+                       .row = in->row, .rowhash = in->rowhash, .rowct = in->rowct, .rowcap = in->rowcap,
+                       .col = in->col, .colhash = in->colhash, .colct = in->colct, .colcap = in->colcap,
+                       .text = in->text, .texthash = in->texthash, .textct = in->textct, .textcap = in->textcap,
+                       .rowindex = in->rowindex, .colindex = in->colindex, .textindex = in->textindex};
+    return out;
+}
+
+static int list_copy(char ***list, unsigned long **hash, int ct, int *cap){
+    char **from = *list;
+    unsigned long *fromhash = *hash;
+    *list = NULL;
+    *hash = NULL;
+    *cap = 0;
+    if (!ct) return 0;
+    *list = malloc(sizeof(char*) * ct);
+    *hash = malloc(sizeof(unsigned long) * ct);
+    Apop_stopif(!*list || !*hash, return 1, 0, "malloc failed. Probably out of memory.");
+    for (int i=0; i< ct; i++) (*list)[i] = strdup(from[i]);
+    memcpy(*hash, fromhash, sizeof(unsigned long) * ct);
+    *cap = ct;
+    return 0;
+}
+
+/* Give names whose lists are shared with other sets (see apop_data_share) their own copy
+   of the lists, or ownership if no other set holds them anymore. */
+void apop_name_unshare(apop_name *n){
+    if (!n) return;
+    int ct = apop_share_holders(n->shared);
+    if (ct < 1) return;
+    if (ct > 1){
+        apop_name was = *n;
+        if (list_copy(&n->row, &n->rowhash, n->rowct, &n->rowcap)
+                || list_copy(&n->col, &n->colhash, n->colct, &n->colcap)
+                || list_copy(&n->text, &n->texthash, n->textct, &n->textcap)){
+            *n = was; //still shared.
+            return;
+        }
+        n->rowindex = name_index_build(n->row, n->rowct, n->rowcap);
+        n->colindex = name_index_build(n->col, n->colct, n->colcap);
+        n->textindex = name_index_build(n->text, n->textct, n->textcap);
+        if (!apop_share_release(&n->shared)){
+            name_lists_free(&was);
+            name_index_free(&was.rowindex);
+            name_index_free(&was.colindex);
+            name_index_free(&was.textindex);
+        }
+        return;
+    }
+    apop_share_release(&n->shared);
+}
+
 /** Append one list of names to another.
 
 If the first list is empty, then this is a copy function.
@@ -205,39 +387,66 @@ The function uses POSIX's \c strcasecmp, and so does case-insensitive search the
 \param name     the name you seek; see above.
 \param type     \c 'c' (=column), \c 'r' (=row), or \c 't' (=text). Default is \c 'c'.
 \return         The position of \c findme. If \c 'c', then this may be -1, meaning the vector name. If not found, returns -2.  On error, e.g. <tt>name==NULL</tt>, returns -2.
+
+\li A long list (16 names or more) has a hash table, so a search takes about the same
+time however long the list is. The \ref apop_name_add, \ref apop_name_stack, sorting,
+and \c apop_data_rm_... functions keep the table current. If you write names into a
+list directly, a name the table doesn't know about is still found, by a search through
+the whole list.
+\li Several threads may search the same names at once, but don't add or rewrite names
+while another thread is searching them.
 */
 int apop_name_find(const apop_name *n, const char *name, const char type){
     Apop_stopif(!name, return -2, 0, "You asked me to search for NULL.");
     char **list;
     unsigned long *listh;
     int listct;
+    struct apop_name_index const *index;
     if (type == 'r' || type == 'R'){
         list = n->row;
         listh = n->rowhash;
         listct = n->rowct;
+        index = n->rowindex;
     }
     else if (type == 't' || type == 'T'){
         list = n->text;
         listh = n->texthash;
         listct = n->textct;
+        index = n->textindex;
     }
     else { // default type == 'c'
         list = n->col;
         listh = n->colhash;
         listct = n->colct;
+        index = n->colindex;
+    }
+
+    if (index && index->list == list && index->ct == listct){ //As below, an exact match beats a match up to case.
+        int caseless = -2;
+        for (size_t s = name_fold_hash(name) & index->mask; index->slots[s] != -1; s = ((s+1) & index->mask)){
+            int i = index->slots[s];
+            if (!strcmp(name, list[i])) return i;
+            if (caseless == -2 && !strcasecmp(name, list[i])) caseless = i;
+        }
+        if (caseless != -2) return caseless;
     }
 
+    //Not indexed, or not in the index: a name written into the list in place could be anywhere.
+    int found = -2;
     if (listh) {
         unsigned long hash = apop_name_hash(name);
         for (int i = 0; i < listct; i++)
-            if (hash==listh[i] && !strcasecmp(name, list[i]))
-                return i;
+            if (hash==listh[i] && !strcasecmp(name, list[i])){
+                found = i;
+                break;
+            }
     }
 
     //Hashes may be broken, so try again with plain string comparisons.
-    for (int i = 0; i < listct; i++)
-        if (!strcasecmp(name, list[i])) return i;
+    for (int i = 0; found == -2 && i < listct; i++)
+        if (!strcasecmp(name, list[i])) found = i;
 
+    if (found != -2) return found;
     if ((type=='c' || type == 'C') && n->vector && !strcasecmp(name, n->vector)) return -1;
     return -2;
 }
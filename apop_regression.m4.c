@@ -2,7 +2,6 @@
 /* Copyright (c) 2006--2007 by Ben Klemens.  Licensed under the GPLv2; see COPYING.  */
 
 #include "apop_internal.h"
-#include <search.h> //lsearch; bsearch is in stdlib.
 
 /* For use by MLE, OLS, et al. Available for public use, but undocumented. */
 void apop_estimate_parameter_tests (apop_model *est){
@@ -50,6 +49,77 @@ static int strcmpwrap(const void *a, const void *b){
     return strcmp(*aa, *bb);
 }
 
+static unsigned long category_hash(char const *s){
+    unsigned long hash = 5381;
+    for (int c; (c = *s++); ) hash = ((hash << 5) + hash) + c;
+    return hash;
+}
+
+static int category_index_grow(apop_category_index *ix){
+    size_t size = ix->mask ? 2*(ix->mask+1) : 16;
+    int *slots = malloc(size*sizeof(int));
+    Apop_stopif(!slots, return 1, 0, "malloc failed. Probably out of memory.");
+    for (size_t i=0; i< size; i++) slots[i] = -1;
+    for (size_t k=0; k< ix->ct; k++){
+        size_t i = category_hash(ix->names[k]) & (size-1);
+        while (slots[i] != -1) i = (i+1) & (size-1);
+        slots[i] = k;
+    }
+    free(ix->slots);
+    ix->slots = slots;
+    ix->mask = size-1;
+    return 0;
+}
+
+//The code for name, or -1 if it isn't there. If slot isn't NULL, it gets where name is or would go.
+static int category_find(apop_category_index const *ix, char const *name, size_t *slot){
+    size_t i = category_hash(name) & ix->mask;
+    for ( ; ix->slots[i] != -1; i = (i+1) & ix->mask)
+        if (ix->names[ix->slots[i]] == name || !strcmp(ix->names[ix->slots[i]], name))
+            break;
+    if (slot) *slot = i;
+    return ix->slots[i];
+}
+
+/* Give the code for the category with this name. If it isn't in the index yet and
+   add=='y', add it with the next code, ix->ct; else return -1. */
+int apop_category_code(apop_category_index *ix, char const *name, char add){
+    if (!ix->slots && category_index_grow(ix)) return -1;
+    size_t slot;
+    int code = category_find(ix, name, &slot);
+    if (code >= 0 || add != 'y') return code;
+    if (ix->ct >= ix->room){
+        ix->room = ix->room ? 2*ix->room : 16;
+        ix->names = realloc(ix->names, sizeof(char*)*ix->room);
+    }
+    ix->names[ix->ct] = ix->own ? strdup(name) : (char*)name;
+    ix->slots[slot] = ix->ct++;
+    if (2*ix->ct > ix->mask+1) category_index_grow(ix);
+    return ix->ct-1;
+}
+
+/* The categories, sorted, in a single text column, as apop_text_unique_elements gives
+   them. If rank isn't NULL, set rank[c] to the row where the category with code c landed. */
+static apop_data *apop_category_page(apop_category_index const *ix, size_t *rank){
+    char **sorted = malloc(sizeof(char*)*(ix->ct+1));
+    if (ix->ct) memcpy(sorted, ix->names, sizeof(char*)*ix->ct);
+    qsort(sorted, ix->ct, sizeof(char*), strcmpwrap);
+    apop_data *out = ix->ct ? apop_text_alloc(NULL, ix->ct, 1) : apop_data_alloc();
+    if (ix->ct > 1 && apop_opts.text_arena=='y') out->textarena = apop_text_arena_alloc(0);
+    for (size_t j=0; j< ix->ct; j++){
+        apop_text_set(out, j, 0, "%s", sorted[j]);
+        if (rank) rank[category_find(ix, sorted[j], NULL)] = j;
+    }
+    free(sorted);
+    return out;
+}
+
+void apop_category_index_free(apop_category_index *ix){
+    if (ix->own) for (size_t k=0; k< ix->ct; k++) free(ix->names[k]);
+    free(ix->names);
+    free(ix->slots);
+}
+
 /** Give me a vector of numbers, and I'll give you a sorted list of the unique elements.
   This is basically running <tt>select distinct datacol from data order by datacol</tt>,
   but without the aid of the database.
@@ -60,18 +130,14 @@ static int strcmpwrap(const void *a, const void *b){
   \see apop_text_unique_elements 
 */
 gsl_vector * apop_vector_unique_elements(const gsl_vector *v){
-    size_t prior_elmt_ctr = 107;
+    double *elmts = malloc(sizeof(double)*(v->size+1));
+    for (size_t i=0; i< v->size; i++)
+        elmts[i] = gsl_vector_get(v, i);
+    qsort(elmts, v->size, sizeof(double), compare_doubles);
     size_t elmt_ctr = 0;
-    double *elmts = NULL;
-    for (size_t i=0; i< v->size; i++){
-        if (prior_elmt_ctr != elmt_ctr)
-            elmts = realloc(elmts, sizeof(double)*(elmt_ctr+1));
-        prior_elmt_ctr = elmt_ctr;
-        double val = gsl_vector_get(v, i);
-        lsearch(&val, elmts, &elmt_ctr, sizeof(double), compare_doubles);
-        if (prior_elmt_ctr < elmt_ctr)
-            qsort(elmts, elmt_ctr, sizeof(double), compare_doubles);
-    }
+    for (size_t i=0; i< v->size; i++)
+        if (!elmt_ctr || compare_doubles(elmts+i, elmts+elmt_ctr-1))
+            elmts[elmt_ctr++] = elmts[i];
     gsl_vector *out = apop_array_to_vector(elmts, elmt_ctr);
     free(elmts);
     return out;
@@ -87,28 +153,11 @@ gsl_vector * apop_vector_unique_elements(const gsl_vector *v){
   \see apop_vector_unique_elements
 */
 apop_data * apop_text_unique_elements(const apop_data *d, size_t col){
-  char   **tval;
-
-  //first element for free
-  size_t prior_elmt_ctr, elmt_ctr = 1;
-  char **telmts = malloc(sizeof(char**)*2);
-  telmts[0] = d->text[0][col];
-
-    for (int i=1; i< d->textsize[0]; i++){
-        prior_elmt_ctr  = elmt_ctr;
-        tval    =  &(d->text[i][col]);
-        lsearch (tval, telmts, &elmt_ctr, sizeof(char*), strcmpwrap);
-        if (prior_elmt_ctr  < elmt_ctr){
-            qsort(telmts, elmt_ctr, sizeof(char*), strcmpwrap);
-            telmts = realloc(telmts, sizeof(char**)*(elmt_ctr+1));
-        }
-    }
-
-    //pack and ship
-    apop_data *out = apop_text_alloc(NULL, elmt_ctr, 1);
-    for (int j=0; j< elmt_ctr; j++)
-        apop_text_set(out, j, 0, telmts[j]);
-    free(telmts);
+    apop_category_index ix = { };
+    for (size_t i=0; i< d->textsize[0]; i++)
+        apop_category_code(&ix, d->text[i][col], 'y');
+    apop_data *out = apop_category_page(&ix, NULL);
+    apop_category_index_free(&ix);
     return out;
 }
 
@@ -188,6 +237,27 @@ apop_data * create_factor_list(apop_data *d, int col, char type){
     return factor_list;
 }
 
+/* For query output: matrix column col holds codes from ix, in order of first appearance.
+   Renumber them in sorted order and add the categories page, giving what
+   apop_data_to_factors would have given from a text column. */
+apop_data *apop_category_add_page(apop_data *d, int col, apop_category_index const *ix){
+    if (!ix->ct) return NULL;
+    size_t *rank = malloc(sizeof(size_t)*ix->ct);
+    apop_data *factor_list = apop_category_page(ix, rank);
+    factor_list->vector = gsl_vector_alloc(ix->ct);
+    for (size_t i=0; i< ix->ct; i++)
+        gsl_vector_set(factor_list->vector, i, i);
+    for (size_t i=0; i< d->matrix->size1; i++){
+        double code = gsl_matrix_get(d->matrix, i, col);
+        if (code >= 0 && code < ix->ct) gsl_matrix_set(d->matrix, i, col, rank[(size_t)code]);
+    }
+    free(rank);
+    char *catname = make_catname(d, col, 'd');
+    apop_data_add_page(d, factor_list, catname);
+    free(catname);
+    return factor_list;
+}
+
 /* Producing dummies consists of finding the index of element i, for all i, then
  setting (i, index) to one.
  Producing factors consists of finding the index and then setting (i, datacol) to index.
@@ -201,11 +271,16 @@ static apop_data * dummies_and_factors_core(apop_data *d, int col, char type,
         *factor_list = create_factor_list(d, col, type);
     Get_vmsizes((*factor_list)); //maxsize
     size_t elmt_ctr = maxsize;
-
-    //copy the strings to a single list-of-strings
-    apop_data *telmts = *(*factor_list)->textsize ? apop_data_transpose(*factor_list, .inplace='n'):NULL;
     gsl_vector *delmts = (*factor_list)->vector;
 
+    //Text categories are found via a hash on the names in the factor list. If numeric
+    //categories are just 0, 1, 2, ..., as for a column of codes, a value is its own index.
+    apop_category_index ix = { };
+    _Bool coded = (type == 'd');
+    for (size_t j=0; j< elmt_ctr; j++)
+        if (type == 'd') coded = coded && gsl_vector_get(delmts, j) == j;
+        else             apop_category_code(&ix, (*factor_list)->text[j][0], 'y');
+
     //Now go through the input vector, and for row i find the posn of the vector's
     //name in the element list created above (j), then change (i,j) in
     //the dummy matrix to one.
@@ -219,29 +294,30 @@ static apop_data * dummies_and_factors_core(apop_data *d, int col, char type,
     for (size_t i=0; i< s; i++){
         if (type == 'd'){
             double val = apop_data_get(d, i, col);
-            size_t posn = (size_t)bsearch(&val, delmts->data, elmt_ctr, sizeof(double), compare_doubles);
-            if (posn )
+            size_t posn = 0;
+            if (coded && val >= 0 && val < elmt_ctr && val == (size_t)val)
+                index = val;
+            else if ((posn = (size_t)bsearch(&val, delmts->data, elmt_ctr, sizeof(double), compare_doubles)))
                 index = (posn - (size_t)delmts->data)/sizeof(double);
             else {
                 index = elmt_ctr++;
                 (*factor_list)->vector = apop_vector_realloc((*factor_list)->vector, elmt_ctr);
                 gsl_vector_set((*factor_list)->vector, index, val);
+                coded = coded && val == index;
                 out->matrix = apop_matrix_realloc(out->matrix, out->matrix->size1, elmt_ctr);
                 gsl_vector_set_zero(Apop_cv(out, index));
             }
         } else {
-            size_t posn = (size_t)bsearch(&(d->text[i][col]), *telmts->text, elmt_ctr, sizeof(char**), strcmpwrap);
-            if (posn)
-                index = (posn - (size_t)*telmts->text)/sizeof(char**);
+            int code = apop_category_code(&ix, d->text[i][col], 'n');
+            if (code >= 0)
+                index = code;
             else {
                 index = elmt_ctr++;
                 *factor_list = apop_text_alloc(*factor_list, elmt_ctr, 1);
-                apop_text_set(*factor_list, index, 0, d->text[i][col]);
+                apop_text_set(*factor_list, index, 0, "%s", d->text[i][col]);
+                apop_category_code(&ix, (*factor_list)->text[index][0], 'y');
                 (*factor_list)->vector = apop_vector_realloc((*factor_list)->vector, elmt_ctr);
                 apop_data_set(*factor_list, index, -1, index);
-
-                telmts = apop_text_alloc(telmts, 1, elmt_ctr);
-                apop_text_set(telmts, 0, index, d->text[i][col]);
                 if (dummyfactor == 'd'){
                     out->matrix = apop_matrix_realloc(out->matrix, out->matrix->size1, out->matrix->size2+1);
                     gsl_vector_set_zero(Apop_cv(out, out->matrix->size2-1));
@@ -264,11 +340,12 @@ static apop_data * dummies_and_factors_core(apop_data *d, int col, char type,
             if (type =='d'){
                 sprintf(n, "%s dummy %g", basename, gsl_vector_get(delmts,i));
             } else
-                sprintf(n, "%s", telmts->text[0][i]);
+                sprintf(n, "%s", (*factor_list)->text[i][0]);
             apop_name_add(out->names, n, 'c');
         }
+        free(basename);
     }
-    apop_data_free(telmts);
+    apop_category_index_free(&ix);
     return out;
 }
 
@@ -350,10 +427,13 @@ APOP_VAR_ENDHEAD
     int rm_list[orig_size+1];
     memset (rm_list, 0, (orig_size+1)*sizeof(int)); 
     if (append =='i'){
+        apop_page_unshare(d); //the names and matrix are replaced below; see apop_data_share.
         apop_data **split = apop_data_split(d, col+1, 'c');
         //stack names, then matrices
+        apop_name_drop_index(d->names, 'c');
         for (int i=0; i < d->names->colct; i++)
             free(d->names->col[i]);
+        d->names->colct = 0;
         apop_name_stack(d->names, split[0]->names, 'c');
         for (int k = d->names->colct; k < (split[0]->matrix ? split[0]->matrix->size2 : 0); k++)
             apop_name_add(d->names, "", 'c'); //pad so the name stacking is aligned (if needed)
@@ -365,6 +445,7 @@ APOP_VAR_ENDHEAD
         apop_data_free(split[0]);
         apop_matrix_stack(d->matrix, split[1]->matrix, 'c', .inplace='y');
         apop_data_free(split[1]);
+        free(split);
         return d;
     }
     if (remove!='n' && type!='t'){
@@ -99,6 +99,7 @@ static void rearrange(apop_data *data, size_t height, size_t *perm){
         apop_data_free(first_row_storage);
     }
     free(sorted);
+    apop_name_reindex(data->names, 'r'); //the row names were shuffled in place.
 }
 
 /** Sort an \ref apop_data set on an arbitrary sequence of columns. 
@@ -150,6 +151,7 @@ APOP_VAR_ENDHEAD
     if (!data) return NULL;
 
     apop_data *out = inplace=='n' ? apop_data_copy(data) : data;
+    apop_page_unshare(out);
 
     apop_data *xx = sort_order ? sort_order : out;
     Get_vmsizes(xx); //firstcol, msize2
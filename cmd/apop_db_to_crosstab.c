@@ -6,9 +6,33 @@ Command line utility to convert a three-column table to a crosstab.*/
 #include "apop_internal.h"
 #include <unistd.h>
 
+/* Print one (row, column, value) line per cell, a page of the query at a time, so
+   the table never has to be in memory. The two categories come through the cursor
+   as one row name, joined by the output delimiter. */
+static void stream_sparse(char const *tabname, char const *rowcol, char const *colcol, char const *datacol){
+    char const *d = apop_opts.output_delimiter, *nan = apop_opts.nan_string;
+    int is_aggregate = !!strchr(datacol, ')');
+    char *cell = NULL, *namecol = apop_opts.db_name_column;
+    if (apop_opts.db_engine == 'm')
+        Asprintf(&cell, "concat(coalesce(%s, '%s'), '%s', coalesce(%s, '%s'))", rowcol, nan, d, colcol, nan);
+    else
+        Asprintf(&cell, "coalesce(%s, '%s') || '%s' || coalesce(%s, '%s')", rowcol, nan, d, colcol, nan);
+    apop_opts.db_name_column = "apop_cell";
+    apop_query_cursor *c = apop_query_cursor_open("select %s as apop_cell, %s from %s %s %s%s%s",
+                                cell, datacol, tabname, is_aggregate ? "group by" : "",
+                                is_aggregate ? rowcol : "", is_aggregate ? ", " : "", is_aggregate ? colcol : "");
+    printf("%s%s%s%s%s\n", rowcol, d, colcol, d, datacol);
+    for (apop_data *page; (page = apop_query_cursor_next(c, 10000)); )
+        for (size_t i=0; i< page->names->rowct; i++)
+            printf("%s%s%g\n", page->names->row[i], d, page->matrix ? gsl_matrix_get(page->matrix, i, 0) : NAN);
+    apop_query_cursor_close(c);
+    apop_opts.db_name_column = namecol;
+    free(cell);
+}
+
 int main(int argc, char **argv){
     int c;
-    char verbose=0;
+    char verbose=0, sparse=0;
     char const *msg="Usage: %s [opts] dbname table_name rows columns data\n"
 "\n"
 "A command-line wrapper for the apop_db_to_crosstab function.\n"
@@ -18,6 +42,9 @@ int main(int argc, char **argv){
 "If you need a non-default data column but want a 1-D crosstab, use 1 as your column.\n"
 "\n"
 " -d\tdelimiter (default: <tab>)\n"
+" -s\tsparse: print one row, column, value line per cell as the query produces it,\n"
+"\tinstead of the grid. The output is never held in memory, so this works for\n"
+"\ttables with many categories and few filled cells.\n"
 " -v\tverbose: prints status info on stderr\n"
 " -v -v\tvery verbose: also print queries executed on stderr\n"
 " -h\tdisplay this help and exit\n"
@@ -25,18 +52,19 @@ int main(int argc, char **argv){
 
 	apop_opts.verbose=0;  //so don't print queries until -v -v.
 
-	while ((c = getopt (argc, argv, "d:f:hv-")) != -1)
+	while ((c = getopt (argc, argv, "d:f:hsv-")) != -1)
 		if      (c=='d') strcpy(apop_opts.output_delimiter,optarg);
         else if (c=='h'||c=='-') {printf(msg, argv[0]); exit(0);}
+        else if (c=='s') sparse=1;
         else if (c=='v') {
             verbose++;
             apop_opts.verbose++;
         }
 
     Apop_stopif(optind+2 > argc, return 1, 0, "I need at least two arguments past the options: database table [optional rowcol] [optional columncol] [optional datacol]");
-    _Bool no_rowcol = optind+2 > argc;
-    _Bool no_columncol = optind+3 > argc;
-    _Bool no_datacol = optind+4 > argc;
+    _Bool no_rowcol = optind+2 >= argc;
+    _Bool no_columncol = optind+3 >= argc;
+    _Bool no_datacol = optind+4 >= argc;
     char *rowcol = no_rowcol    ? "1" : argv[optind+2];
     char *colcol = no_columncol ? "1" : argv[optind+3];
     char *datacol = no_datacol  ? NULL: argv[optind+4];
@@ -46,6 +74,10 @@ int main(int argc, char **argv){
             no_datacol ?"":"\ndata col:", datacol);
     }
 	apop_db_open(argv[optind]);
+    if (sparse){
+        stream_sparse(argv[optind +1], rowcol, colcol, datacol ? datacol : "count(*)");
+        return 0;
+    }
 	apop_data *m = apop_db_to_crosstab(argv[optind +1], rowcol, colcol, datacol);
 	apop_data_print(m);
 }
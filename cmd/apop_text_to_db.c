@@ -5,16 +5,18 @@ Copyright (c) 2006--2007, 2013 by Ben Klemens.  Licensed under the GPLv2; see CO
 
 #include "apop_internal.h"
 #include <unistd.h>
+#include <limits.h>
 
 int *break_down(char *in){
     int *out = NULL;
     int ctr = 0;
     char *cp = strtok (in, ",");
     while (cp != NULL) {
-      out = realloc(out, sizeof(int)*(ctr+1));
+      out = realloc(out, sizeof(int)*(ctr+2));
       out[ctr++] = atoi(cp);
       cp = strtok (NULL, ",");
     }
+    if (out) out[ctr] = 0; //mark the end of the list.
     return out;
 }
 
@@ -46,17 +48,24 @@ int main(int argc, char **argv){
 " -ed\t\tif table exists, retain the table, delete all data, refill with the new data (i.e., call 'delete * from your_table')\n"
 " -eo\t\tif table exists, overwrite the table from scratch (deleting the previous table entirely)\n"
 " -ea\t\tif table exists, append new data to the existing table\n"
+" -c\t\tcommit every this many rows: -c 10000 (default: the whole file is one transaction)\n"
+" -J\t\tSQLite journal_mode while loading: -J memory\n"
+" -S\t\tSQLite synchronous setting while loading: -S off\n"
+" -C\t\tSQLite cache_size while loading: -C -200000 (negative means kibibytes)\n"
+" -i\t\tbuild an index on these columns once the data is in: -i \"age,sex\". Repeat for more indexes.\n"
 " -h\t\tdisplay this help and exit\n"
 "\n"
 , argv[0]);
     int * field_list = NULL;
     char if_exists = 'n';
+    char **indexes = NULL;
+    int index_ct = 0;
 
 	if(argc<3){
 		printf("%s", msg);
 		return 0;
 	}
-	while ((c = getopt (argc, argv, "n:d:e:f:hmp:ru:vN:O")) != -1)
+	while ((c = getopt (argc, argv, "n:c:d:e:f:hi:mp:ru:vC:J:N:OS:")) != -1)
         if (c=='n') {
               if (optarg[0]=='c') colnames='n';
               else                apop_opts.nan_string = optarg;
@@ -73,6 +82,16 @@ int main(int argc, char **argv){
         else if (c=='d') strcpy(apop_opts.input_delimiters, optarg);
 		else if (c=='f') field_list = break_down(optarg);
 		else if (c=='h') {printf("%s", msg); return 0;}
+		else if (c=='c') apop_opts.db_load.rows_per_commit = atoi(optarg);
+		else if (c=='J') apop_opts.db_load.journal_mode = optarg;
+		else if (c=='S') apop_opts.db_load.synchronous = optarg;
+		else if (c=='C') apop_opts.db_load.cache_size = atoi(optarg);
+		else if (c=='i') {
+            indexes = realloc(indexes, sizeof(char*)*(index_ct+2));
+            indexes[index_ct++] = optarg;
+            indexes[index_ct] = NULL;
+            apop_opts.db_load.indexes = indexes;
+        }
 		else if (c=='m') apop_opts.db_engine = 'm';
 		else if (c=='u') strcpy(apop_opts.db_user, optarg);
 		else if (c=='p') strcpy(apop_opts.db_pass, optarg);
@@ -89,8 +108,8 @@ int main(int argc, char **argv){
 
         }
 	apop_db_open(argv[optind + 2]);
-    if (tab_exists_check) apop_table_exists(argv[optind+1],1);
-    apop_query("begin");
+	if (tab_exists_check) apop_table_exists(argv[optind+1],1);
+	if (!apop_opts.db_load.rows_per_commit) //the whole file as one transaction
+		apop_opts.db_load.rows_per_commit = INT_MAX;
 	apop_text_to_db(argv[optind], argv[optind+1], rownames, colnames, field_names, .field_ends=field_list, .if_table_exists=if_exists);
-    apop_query("commit");
 }
@@ -704,12 +704,16 @@ Write \ref apop_data sets to the database using \ref apop_data_print, with <tt>.
 
 \li If your data set has zero data (i.e., is just a list of column names or is entirely
     blank), \ref apop_data_print returns without creating anything in the database.
-\li Especially if you are using a pre-2007 version of SQLite, there may be a speed
-    gain to wrapping the call to this function in a begin/commit pair:
+\li The rows go in via prepared statements that insert many rows at a time, all in one
+    transaction (or, if you already have one open, in yours, which you then commit or roll
+    back as you see fit). So with SQLite, writing a data set is all or nothing: if any row
+    fails to go in, the transaction is rolled back, and none of the data set's rows are in
+    the table. With MySQL/mariaDB, the numbers are sent in binary form.
 
 \code
 apop_query("begin;");
 apop_data_print(dataset, .output_name="dbtab", .output_type='d');
+apop_data_print(dataset2, .output_name="dbtab", .output_type='d', .output_append='a');
 apop_query("commit;");
 \endcode
 
@@ -850,9 +854,13 @@ manipulate the \ref apop_data structure and its components.
 \li\ref apop_data_add_named_elmt
 \li\ref apop_data_copy
 \li\ref apop_data_fill
+\li\ref apop_data_make_writable
 \li\ref apop_data_memcpy
 \li\ref apop_data_pack
+\li\ref apop_data_reserve : set aside room for rows to be stacked on later
 \li\ref apop_data_rm_columns
+\li\ref apop_data_share : a copy that duplicates parts only as they are written to
+\li\ref apop_data_shrink_to_fit
 \li\ref apop_data_sort
 \li\ref apop_data_split
 \li\ref apop_data_stack
@@ -860,6 +868,7 @@ manipulate the \ref apop_data structure and its components.
 \li\ref apop_data_unpack
 \li\ref apop_matrix_copy
 \li\ref apop_matrix_realloc
+\li\ref apop_matrix_reserve
 \li\ref apop_matrix_stack
 \li\ref apop_text_set
 \li\ref apop_text_paste
@@ -868,6 +877,7 @@ manipulate the \ref apop_data structure and its components.
 \li\ref apop_vector_fill
 \li\ref apop_vector_stack
 \li\ref apop_vector_realloc
+\li\ref apop_vector_reserve
 \li\ref apop_vector_unique_elements
 
 Apophenia builds upon the GSL, but it would be inappropriate to redundantly replicate
@@ -1385,8 +1395,12 @@ if (!*dataset->text[i][j]) printf("<blank>")
 \endcode
 For the sake of efficiency when dealing with large, sparse data sets, all blank cells
 point to <em>the same</em> static empty string, meaning that freeing cells must be
-done with care. Your best bet is to rely on \ref apop_text_set, \ref apop_text_alloc,
-and \ref apop_text_free to do the memory management for you.
+done with care. Further, the text of a data set produced by a query (\ref
+apop_query_to_text, \ref apop_query_to_mixed_data), or copied from one, is kept in a few
+large blocks owned by the set, not in one allocation per cell (see \ref apop_text_set).
+For such a set, <tt>free(tdata->text[i][j]); tdata->text[i][j] = strdup("new text")</tt>
+will crash. Your best bet is to rely on \ref apop_text_set, \ref apop_text_alloc, and
+\ref apop_text_free to do the memory management for you.
 
 Here is a sample program that uses these forms, plus a few text-handling functions.
 
@@ -1424,6 +1438,12 @@ the original data. Use \ref apop_data_get_factor_names to get a pointer to that
 You can use the factor table to translate from numeric categories back to text (though
 you probably have the original text column in your data anyway).
 
+If the categories are coming from a database, you can skip the text column: give the
+column type \c f in \ref apop_query_to_mixed_data, and the output's matrix will have
+the factors and the <tt>\<categories for your_column\></tt> page, as if you had run
+\ref apop_data_to_factors. The dummies are then one call away, via
+<tt>apop_data_to_dummies(d, .col=your_column_number, .type='d')</tt>.
+
 Having the factor list in an auxiliary table makes it easy to ensure that multiple
 \ref apop_data sets use the same single categorization scheme. Generate factors in the
 first set, then copy the factor list to the second, then run \ref apop_data_to_factors
@@ -1463,8 +1483,10 @@ use when sending queries from Apophenia, such as \c pow, \c stddev, or \c sqrt.
 \li \ref apop_text_to_db : Read a text file on disk into the database. Data analysis projects often start with a call to this.
 \li \ref apop_data_print : If you include the argument <tt>.output_type='d'</tt>, this prints your \ref apop_data set to the database.
 \li \ref apop_query : Manipulate the database, return nothing (e.g., insert rows or create table).
+\li \ref apop_query_bind : As above, with values bound to <tt>?</tt> placeholders; for running one query many times.
 \li \ref apop_db_open : Optional, for when you want to use a database on disk.
 \li \ref apop_db_close : A useful (and in some cases, optional) companion to \ref apop_db_open.
+\li \ref apop_db_handle_open, \ref apop_db_use, \ref apop_db_handle_close : Give a thread a connection of its own, e.g., to query several databases in parallel.
 \li \ref apop_table_exists : Check to make sure you aren't reinventing or destroying data. Also, a clean way to drop a table.
 
 \li Apophenia reserves the right to insert temp tables into the opened database. They
@@ -1481,10 +1503,12 @@ to read in data and write final output tables.
 
 \li\ref apop_db_to_crosstab : take up to three columns in the database (row, column, value) and produce a table of values.
 \li\ref apop_query_to_data
+\li\ref apop_query_to_data_bind : fill <tt>?</tt> placeholders from an array or a data row, reusing the compiled query.
 \li\ref apop_query_to_float
 \li\ref apop_query_to_mixed_data
 \li\ref apop_query_to_text
 \li\ref apop_query_to_vector
+\li\ref apop_query_cursor_open : read a query's output a page of rows at a time, via \ref apop_query_cursor_next and \ref apop_query_cursor_close.
 
 \section wdttd Writing data to the database
 
@@ -1494,6 +1518,9 @@ See the print functions at \ref Legi. E.g.
 apop_data_print(yourdata, .output_type='d', .output_name="dbtab");
 \endcode
 
+To query a data set in memory without writing it to the database at all, give it a
+table name via \ref apop_data_register_vtab.
+
 \section cmdline Command-line utilities
 
 A few functions have proven to be useful enough to be worth breaking out into their own programs, for use in scripts or other data analysis from the command line:
@@ -1528,6 +1555,34 @@ multiply the skew by    \f$(n-1)(n-2)/n^2\f$. The equation for the unbiased samp
 as calculated in <a href="http://modelingwithdata.org/pdfs/moments.pdf">Appendix M of
 <em>Modeling with Data</em></a> is not quite as easy to adjust.
 
+\li Each of these also takes a second argument giving a weight for the row, e.g.,
+<tt>var(x, w)</tt>, or equivalently, <tt>var_w(x, w)</tt>. As with \ref apop_vector_var,
+if the weights sum to more than one, they are read as counts of repeated observations;
+if they sum to less, as proportions, and \f$n\f$ is the row count.
+
+\li Rows where \c x or the weight is \c NULL are skipped, as with \c avg.
+
+\li The moments are accumulated as central moments, so they don't lose precision when
+the mean is large relative to the spread. With SQLite 3.25 or later, they also work as
+window functions, and a moving window takes constant time per row:
+
+\code
+select day, stddev(price) over (order by day rows between 29 preceding and current row)
+from prices
+\endcode
+
+\li Order statistics: <tt>median(x)</tt> and <tt>quantile(x, p)</tt>, for \f$p\in[0, 1]\f$,
+interpolate between the two nearest data points, as does \c gsl_stats_quantile_from_sorted_data.
+They hold every value of the group in memory. For big groups, <tt>quantile_approx(x, p)</tt>
+uses a sketch of a few thousand values at most, and gives an answer whose rank is typically
+within about 1.5% of \f$pn\f$; with \f$p=0\f$ or 1, it gives the exact min or max.
+
+\code
+select state, median(income), quantile(income, .9), quantile_approx(income, .99)
+from people
+group by state
+\endcode
+
 \li Also provided: wrapper functions for standard math library
 functions---<tt>sqrt(x)</tt>, <tt>pow(x,y)</tt>, <tt>exp(x)</tt>, <tt>log(x)</tt>,
 and trig functions. They call the standard math library function of the same name
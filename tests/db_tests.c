@@ -25,7 +25,12 @@ export APOP_DB_ENGINE=mysql
 #endif
 
 #include <apop.h>
+#include <sqlite3.h> //for SQLITE_VERSION_NUMBER
 #include <unistd.h>
+#include <dirent.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 int verbose = 1;
 
 #define Diff(L, R, eps) {double left=(L), right=(R); Apop_stopif(isnan(left-right) || fabs((left)-(right))>(eps), abort(), 0, "%g is too different from %g (abitrary limit=%g).", (double)(left), (double)(right), eps);}
@@ -180,6 +185,622 @@ void test_nan_data(){
     unlink("nantest");
 }
 
+//apop_query_to_data reads numbers as SQLite stores them, so doubles survive the trip
+//to the last bit, and text cells are still converted or marked NaN as before.
+void test_query_types(){
+    if (apop_opts.db_engine == 'm') return;
+    apop_table_exists("qtypes", 'd');
+    apop_query("create table qtypes (x real, n integer, t text);"
+               "insert into qtypes values (1/3.0, 9007199254740992, '2.5');"
+               "insert into qtypes values (null, -4, 'NULL');");
+    for (int i=0; i< 3000; i++) apop_query("insert into qtypes values (%.17g, %i, 'nan')", i/7., i);
+    apop_data *d = apop_query_to_data("select x, n, t from qtypes");
+    assert(d->matrix->size1 == 3002);
+    assert(apop_data_get(d, 0, 0) == 1/3.);
+    assert(apop_data_get(d, 0, 1) == 9007199254740992.);
+    assert(apop_data_get(d, 0, 2) == 2.5);
+    assert(gsl_isnan(apop_data_get(d, 1, 0)));
+    assert(gsl_isnan(apop_data_get(d, 1, 2)));
+    for (int i=0; i< 3000; i++){
+        assert(apop_data_get(d, i+2, 0) == i/7.);
+        assert(apop_data_get(d, i+2, 1) == i);
+        assert(gsl_isnan(apop_data_get(d, i+2, 2)));
+    }
+    apop_data_free(d);
+}
+
+void test_mixed_query_types(){
+    if (apop_opts.db_engine == 'm') return;
+    apop_table_exists("mixtypes", 'd');
+    apop_query("create table mixtypes (name, w real, x real, t text, n integer, u text);"
+               "insert into mixtypes values (null, 2, 1/3.0, null, 9007199254740992, 'two words');");
+    for (int i=0; i< 3000; i++)
+        apop_query("insert into mixtypes values ('r%i', %i, %.17g, '%i', %i, 'u')", i, i%5, i/7., i, i);
+    apop_data *d = apop_query_to_mixed_data("nwmtvt", "select * from mixtypes; select * from mixtypes where n=0");
+    assert(!d->error);
+    assert(d->vector->size == 3002 && d->weights->size == 3002 && d->matrix->size1 == 3002);
+    assert(d->textsize[0] == 3002 && d->textsize[1] == 2 && d->names->rowct == 3002);
+    assert(!strcmp(d->names->title, "name") && !strcmp(d->names->vector, "n"));
+    assert(!strcmp(d->names->col[0], "x") && !strcmp(d->names->text[1], "u"));
+    assert(!strcmp(d->names->row[0], "NaN") && !strcmp(d->text[0][0], "NaN"));
+    assert(!strcmp(d->text[0][1], "two words"));
+    assert(apop_data_get(d, 0, 0) == 1/3. && apop_data_get(d, 0, -1) == 9007199254740992.);
+    for (int i=0; i< 3000; i++){
+        assert(apop_data_get(d, i+1, 0) == i/7. && apop_data_get(d, i+1, -1) == i);
+        assert(gsl_vector_get(d->weights, i+1) == i%5);
+        assert(atoi(d->text[i+1][0]) == i && atoi(d->names->row[i+1]+1) == i);
+    }
+    assert(!strcmp(d->names->row[3001], "r0"));
+    apop_data_free(d);
+
+    d = apop_query_to_mixed_data("mm", "select x, n, t from mixtypes");
+    assert(d->error == 'd');
+    apop_data_free(d);
+}
+
+/* With apop_opts.text_arena=='y', query output keeps its text in a few blocks; check
+   cells through replacement, copying, and reshaping. */
+void test_text_arena(){
+    apop_table_exists("arenatab", 'd');
+    apop_query("create table arenatab (t, u)");
+    apop_query("begin");
+    for (int i=0; i< 5000; i++)
+        apop_query("insert into arenatab values ('a fairly long string, number %i', '%i')", i, i);
+    apop_query("commit");
+
+    apop_data *d = apop_query_to_text("select * from arenatab"); //By default, cells are malloced one by one,
+    assert(!d->textarena);
+    free(d->text[2][0]);                                          //so the user may replace them by hand.
+    d->text[2][0] = strdup("replaced");
+    apop_text_free(d->text, d->textsize[0], d->textsize[1]);
+    d->text = NULL;
+    d->textsize[0] = d->textsize[1] = 0;
+    apop_data_free(d);
+
+    apop_opts.text_arena = 'y';
+    d = apop_query_to_text("select * from arenatab");
+    assert(d->textarena && d->textsize[0] == 5000);
+    apop_text_set(d, 3, 0, "%s", d->text[3][0]); //rewrite a cell from itself.
+    assert(!strcmp(d->text[3][0], "a fairly long string, number 3"));
+    apop_text_set(d, 3, 1, "%i%%", 7);
+    apop_text_set(d, 7, 1, NULL);
+    assert(!strcmp(d->text[3][1], "7%") && !strcmp(d->text[7][1], apop_opts.nan_string));
+    d->text[5][1] = strdup("malloced"); //mixed in with the arena's cells.
+
+    #pragma omp parallel for //threads writing different cells of one set share its arena.
+    for (int i=10; i< 5000; i++)
+        apop_text_set(d, i, 1, "rewritten %i, long enough to fill a few blocks", i);
+    for (int i=10; i< 5000; i++){
+        char want[100];
+        sprintf(want, "rewritten %i, long enough to fill a few blocks", i);
+        assert(!strcmp(d->text[i][1], want));
+    }
+
+    apop_data **halves = apop_data_split(d, 2500, 'r');
+    assert(!strcmp(halves[0]->text[5][1], "malloced") && !strcmp(halves[1]->text[0][0], "a fairly long string, number 2500"));
+    apop_data_free(halves[0]); apop_data_free(halves[1]); free(halves);
+
+    apop_data *c = apop_data_copy(d);
+    assert(c->textarena && c->textarena != d->textarena);
+    int drop[5000];
+    for (int i=0; i< 5000; i++) drop[i] = (i%2 == 0);
+    apop_data_rm_rows(c, drop);
+    assert(c->textsize[0] == 2500);
+    assert(!strcmp(c->text[1][1], "7%") && !strcmp(c->text[2][1], "malloced") && !strcmp(c->text[3][1], apop_opts.nan_string));
+    apop_data_transpose(c);
+    assert(c->textsize[0] == 2 && c->textsize[1] == 2500);
+    assert(!strcmp(c->text[0][2], "a fairly long string, number 5") && !strcmp(c->text[1][2], "malloced"));
+    apop_data_free(c);
+
+    apop_text_alloc(d, 0, 0); //frees only the malloced cell.
+    assert(!d->textsize[0] && !d->textsize[1]);
+    apop_data_free(d);
+
+    d = apop_query_to_mixed_data("mt", "select u, t from arenatab");
+    assert(d->textarena && !strcmp(d->text[4999][0], "a fairly long string, number 4999"));
+    apop_data_free(d);
+    apop_opts.text_arena = 'n';
+}
+
+//A factor column should give what a text column run through apop_data_to_factors gives.
+void test_factor_query(){
+    char *cats[] = {"pear", "apple", "fig", "quince", "date"};
+    apop_table_exists("factab", 'd');
+    apop_query("create table factab (x real, c text)");
+    apop_query("begin");
+    for (int i=0; i< 2000; i++)
+        if (i%97 == 3) apop_query("insert into factab values (%i, null)", i);
+        else           apop_query("insert into factab values (%i, '%s')", i, cats[(i/3)%5]);
+    apop_query("commit");
+    apop_data *f = apop_query_to_mixed_data("mf", "select x, c from factab order by x");
+    apop_data *t = apop_query_to_mixed_data("mt", "select x, c from factab order by x");
+    assert(!f->error && !f->text && f->matrix->size1 == 2000 && f->matrix->size2 == 2);
+    assert(!strcmp(f->names->col[1], "c"));
+    apop_data_to_factors(t, .intype='t', .incol=0, .outcol=0);
+    apop_data *ff = apop_data_get_factor_names(f, 1);
+    apop_data *tf = apop_data_get_factor_names(t, 0, 't');
+    assert(ff && tf && ff->textsize[0] == 6 && tf->textsize[0] == 6);
+    for (int i=0; i< 6; i++){
+        assert(!strcmp(ff->text[i][0], tf->text[i][0]));
+        assert(apop_data_get(ff, i, -1) == i);
+    }
+    for (int i=0; i< 2000; i++){
+        assert(apop_data_get(f, i, 0) == i);
+        assert(apop_data_get(f, i, 1) == apop_data_get(t, i, 0));
+        assert(!strcmp(ff->text[(int)apop_data_get(f, i, 1)][0], i%97==3 ? "NaN" : cats[(i/3)%5]));
+    }
+
+    apop_data *dum = apop_data_to_dummies(f, .col=1, .type='d');
+    assert(dum->matrix->size1 == 2000 && dum->matrix->size2 == 5);
+    for (int i=0; i< 2000; i++){
+        int code = apop_data_get(f, i, 1);
+        for (int j=0; j< 5; j++)
+            assert(apop_data_get(dum, i, j) == (code == j+1));
+    }
+    apop_data_free(dum);
+    apop_data_free(f);
+    apop_data_free(t);
+}
+
+void test_query_cursor(){
+    apop_table_exists("cursed", 'd');
+    apop_query("create table cursed (row_names, x, y)");
+    apop_query("begin");
+    for (int i=0; i< 2500; i++) apop_query("insert into cursed values ('r%i', %i, %g)", i, i, i/4.);
+    apop_query("commit");
+    apop_query_cursor *c = apop_query_cursor_open("select * from cursed order by x");
+    size_t rows = 0, pages = 0;
+    double total = 0;
+    apop_data *kept = NULL;
+    for (apop_data *page; (page = apop_query_cursor_next(c, 1000)); pages++){
+        if (!pages) kept = apop_data_share(page); //the next call must not overwrite this.
+        assert(!page->error);
+        assert(page->matrix->size1 == (pages < 2 ? 1000 : 500) && page->names->rowct == page->matrix->size1);
+        assert(!strcmp(page->names->col[1], "y"));
+        assert(apop_data_get(page, 0, 0) == rows);
+        assert(atoi(page->names->row[page->matrix->size1-1]+1) == rows + page->matrix->size1 - 1);
+        total += apop_matrix_sum(page->matrix);
+        rows += page->matrix->size1;
+    }
+    assert(rows == 2500 && pages == 3);
+    assert(kept->matrix->size1 == 1000 && apop_data_get(kept, 999, 0) == 999 && !strcmp(kept->names->row[999], "r999"));
+    apop_data_free(kept);
+    assert(fabs(total - apop_query_to_float("select sum(x+y) from cursed")) < 1e-6);
+    assert(!apop_query_cursor_next(c, 1000));
+    apop_query_cursor_close(c);
+
+    c = apop_query_cursor_open("select x from cursed where x < 0");
+    assert(!apop_query_cursor_next(c, 10));
+    apop_query_cursor_close(c);
+
+    if (apop_opts.db_engine == 'm') return;
+    int verbosity = apop_opts.verbose;
+    apop_opts.verbose = -1;
+    c = apop_query_cursor_open("select x from cursed; select nonexistent from cursed");
+    size_t before_error = 0;
+    apop_data *page;
+    while ((page = apop_query_cursor_next(c, 1000)) && !page->error) before_error += page->matrix->size1;
+    apop_opts.verbose = verbosity;
+    assert(page && page->error == 'q' && before_error + page->matrix->size1 == 2500);
+    assert(!apop_query_cursor_next(c, 1000));
+    apop_query_cursor_close(c);
+}
+
+//Each thread gets its own connection, which the shared connection can't see, and vice versa.
+void test_db_handles(){
+    apop_table_exists("handle_check", 'd');
+    apop_query("create table handle_check(x); insert into handle_check values (-1)");
+    int ok[8] = {};
+    #pragma omp parallel for
+    for (int i=0; i< 8; i++){
+        apop_db_handle *h = apop_db_handle_open(NULL);
+        assert(h);
+        apop_db_handle *prior = apop_db_use(h);
+        apop_query("create table handle_check(x)");
+        for (int j=0; j<= i; j++) apop_query("insert into handle_check values (%i)", j);
+        ok[i] = apop_query_to_float("select sum(x) from handle_check") == i*(i+1)/2.
+                && apop_query_to_float("select count(*) from handle_check") == i+1;
+        ok[i] &= fabs(apop_query_to_float("select var_pop(x) from handle_check") - (i*(i+2))/12.) < 1e-8;
+        apop_db_use(prior);
+        apop_db_handle_close(h);
+    }
+    for (int i=0; i< 8; i++) assert(ok[i]);
+    assert(apop_query_to_float("select x from handle_check") == -1);
+}
+
+//Whether this process has the given file open, according to /proc; 0 if there is no /proc.
+static int file_is_open(char const *name){
+    DIR *fds = opendir("/proc/self/fd");
+    if (!fds) return 0;
+    int found = 0;
+    for (struct dirent *e; !found && (e = readdir(fds)); ){
+        char path[300], target[1000];
+        snprintf(path, 300, "/proc/self/fd/%s", e->d_name);
+        ssize_t len = readlink(path, target, 999);
+        if (len > 0){
+            target[len] = '\0';
+            found = !!strstr(target, name);
+        }
+    }
+    closedir(fds);
+    return found;
+}
+
+/* Threads that queried a connection keep the statements in their caches; closing the
+   connection has to finalize them all, or SQLite leaves it (and its file) open. */
+void test_close_with_cached_statements(){
+    char *name = "cached_close_test.db";
+    unlink(name);
+    apop_db_handle *h = apop_db_handle_open(name);
+    assert(h);
+    apop_db_handle *prior = apop_db_use(h);
+    apop_query("create table t(x); insert into t values (1)");
+    apop_db_use(prior);
+    int ok[8] = {};
+    #pragma omp parallel for
+    for (int i=0; i< 8; i++){
+        apop_db_handle *was = apop_db_use(h);
+        ok[i] = apop_query_to_float("select x from t") == 1;
+        apop_db_use(was);
+    }
+    for (int i=0; i< 8; i++) assert(ok[i]);
+    apop_db_handle_close(h);
+    assert(!file_is_open(name));
+    unlink(name);
+}
+
+//The moment aggregates should hold up when the mean dwarfs the spread, take weights, and
+//run as window functions.
+void test_moment_aggregates(){
+    if (apop_opts.db_engine == 'm') return; //these are our SQLite extensions.
+    apop_table_exists("moments", 'd');
+    apop_query("create table moments(i, x, w)");
+    gsl_vector *v = gsl_vector_alloc(1000), *w = gsl_vector_alloc(1000);
+    apop_query("begin");
+    for (int i=0; i< 1000; i++){
+        gsl_vector_set(v, i, 1e9 + (i*7919 % 1000)/100.);
+        gsl_vector_set(w, i, 1 + i%3);
+        apop_query_bind("insert into moments values(?, ?, ?)", .values=(double[]){i, v->data[i], w->data[i]});
+    }
+    apop_query("insert into moments values(1000, null, 1)");
+    apop_query("commit");
+    gsl_vector *centered = apop_vector_copy(v);
+    gsl_vector_add_constant(centered, -1e9);
+    Diff(apop_query_to_float("select var(x) from moments"), apop_var(centered), 1e-6);
+    Diff(apop_query_to_float("select var_pop(x) from moments"), apop_var(centered)*999/1000., 1e-6);
+    Diff(apop_query_to_float("select skew(x) from moments"), apop_vector_skew(centered), 1e-6);
+    Diff(apop_query_to_float("select kurt(x) from moments"),
+         apop_query_to_float("select kurt(x - 1e9) from moments"), 1e-4);
+    Diff(apop_query_to_float("select var_w(x, w) from moments"), apop_vector_var(centered, w), 1e-6);
+    Diff(apop_query_to_float("select var(x, w) from moments"), apop_vector_var(centered, w), 1e-6);
+    assert(apop_query_to_float("select var(x) from moments where i < 1") == 0);
+    assert(isnan(apop_query_to_float("select var(x) from moments where i < 0")));
+
+#if SQLITE_VERSION_NUMBER >= 3025000 //moving windows, which need SQLite 3.25 or later.
+    apop_data *moving = apop_query_to_data("select var(x) over (order by i rows between 9 preceding and current row), "
+                                           "var_pop_w(x, w) over (order by i rows between 4 preceding and 5 following) "
+                                           "from moments where i < 1000 order by i");
+    for (int i=0; i< 1000; i+=37){
+        int lo = GSL_MAX(0, i-9);
+        Diff(apop_data_get(moving, i, 0), i ? apop_var(Apop_subvector(centered, lo, i-lo+1)) : 0, 1e-6);
+        lo = GSL_MAX(0, i-4);
+        int hi = GSL_MIN(999, i+5);
+        gsl_vector *sv = Apop_subvector(centered, lo, hi-lo+1), *sw = Apop_subvector(w, lo, hi-lo+1);
+        double wsum = apop_vector_sum(sw);
+        Diff(apop_data_get(moving, i, 1), apop_vector_var(sv, sw)*(wsum-1)/wsum, 1e-6);
+    }
+    apop_data_free(moving);
+
+    //A window whose weights sum to zero has no variance, and doesn't spoil the windows after it.
+    apop_table_exists("zeroweights", 'd');
+    apop_query("create table zeroweights(i, x, w); insert into zeroweights values(0, 1, 3); "
+               "insert into zeroweights values(1, 2, 0); insert into zeroweights values(2, 5, 0); "
+               "insert into zeroweights values(3, 7, 2); insert into zeroweights values(4, 9, 2)");
+    apop_data *zw = apop_query_to_data("select var_w(x, w) over (order by i rows between 1 preceding and current row) "
+                                       "from zeroweights order by i");
+    assert(isnan(apop_data_get(zw, 2)));
+    Diff(apop_data_get(zw, 4), 4/3., 1e-10);
+    apop_data_free(zw);
+#endif
+    gsl_vector_free(v); gsl_vector_free(w); gsl_vector_free(centered);
+}
+
+void test_quantiles(){
+    if (apop_opts.db_engine == 'm') return; //these are our SQLite extensions.
+    apop_table_exists("qtab", 'd');
+    apop_query("create table qtab(g, x)");
+    apop_query("begin");
+    for (int i=0; i< 20001; i++) //a permutation of 0...20000, in two groups.
+        apop_query_bind("insert into qtab values(?, ?)", .values=(double[]){i%2, (i*7919) % 20001});
+    apop_query("insert into qtab values(0, null)");
+    apop_query("commit");
+    assert(apop_query_to_float("select median(x) from qtab") == 10000);
+    assert(apop_query_to_float("select quantile(x, 0) from qtab") == 0);
+    assert(apop_query_to_float("select quantile(x, 1) from qtab") == 20000);
+    Diff(apop_query_to_float("select quantile(x, .95) from qtab"), 19000, 1e-8);
+    Diff(apop_query_to_float("select quantile(x, .123456) from qtab"), .123456*20000, 1e-8);
+    assert(apop_query_to_float("select median(x) from qtab where x < 4") == 1.5);
+
+    apop_data *bygroup = apop_query_to_data("select g, median(x), quantile(x, .25), quantile_approx(x, .25) from qtab group by g order by g");
+    for (int g=0; g< 2; g++){
+        gsl_vector *v = apop_query_to_vector("select x from qtab where g=%i and x is not null", g);
+        gsl_sort_vector(v);
+        Diff(apop_data_get(bygroup, g, 1), gsl_stats_median_from_sorted_data(v->data, 1, v->size), 1e-8);
+        Diff(apop_data_get(bygroup, g, 2), gsl_stats_quantile_from_sorted_data(v->data, 1, v->size, .25), 1e-8);
+        Diff(apop_data_get(bygroup, g, 3), .25*20000, .03*20000);
+        gsl_vector_free(v);
+    }
+    for (double p=0; p<= 1; p+=.1)
+        Diff(apop_query_to_float("select quantile_approx(x, %g) from qtab", p), p*20000, .03*20000);
+    assert(apop_query_to_float("select quantile_approx(x, 0) from qtab") == 0);
+    assert(apop_query_to_float("select quantile_approx(x, 1) from qtab") == 20000);
+
+    int v = apop_opts.verbose; apop_opts.verbose = -1;
+    apop_data *bad = apop_query_to_data("select quantile(x, 2) from qtab");
+    assert(bad->error == 'q');
+    apop_opts.verbose = v;
+    assert(isnan(apop_query_to_float("select median(x) from qtab where x < 0")));
+    apop_data_free(bygroup); apop_data_free(bad);
+}
+
+void test_data_vtab(){
+    if (apop_opts.db_engine == 'm') return; //SQLite only.
+    apop_data *d = apop_text_alloc(apop_data_alloc(1000, 1000, 2), 1000, 1);
+    d->weights = gsl_vector_alloc(1000);
+    apop_name_add(d->names, "id", 'v');
+    apop_name_add(d->names, "x", 'c');
+    for (int i=0; i< 1000; i++){
+        char name[20];
+        sprintf(name, "r%i", i);
+        apop_name_add(d->names, name, 'r');
+        apop_data_set(d, i, -1, i);
+        apop_data_set(d, i, 0, i/10.);
+        apop_data_set(d, i, 1, i%7 ? i : NAN);
+        apop_text_set(d, i, 0, i%2 ? "odd" : "even");
+        gsl_vector_set(d->weights, i, 2);
+    }
+    assert(!apop_data_register_vtab(d, "live"));
+    assert(apop_query_to_float("select count(*) from live") == 1000);
+    assert(apop_query_to_float("select x from live where id = 42") == 4.2);
+    assert(apop_query_to_float("select c1 from live where rowid = 43") == 43);
+    assert(apop_query_to_float("select count(*) from live where c1 is null") == 143);
+    assert(apop_query_to_float("select count(*) from live where tc0 = 'odd'") == 500);
+    assert(apop_query_to_float("select sum(weights) from live") == 2000);
+    assert(apop_query_to_float("select id from live where %s = 'r17'", apop_opts.db_name_column) == 17);
+
+    //rowid ranges, including bounds that aren't integers or are out of range.
+    assert(apop_query_to_float("select count(*) from live where rowid between 100 and 199") == 100);
+    assert(apop_query_to_float("select sum(id) from live where rowid > 997.5") == 998+999);
+    assert(apop_query_to_float("select count(*) from live where rowid >= -5 and rowid < 3") == 3);
+    assert(apop_query_to_float("select count(*) from live where rowid = 2.5 or rowid > 5000") == 0);
+    assert(apop_query_to_float("select count(*) from live where rowid < null") == 0);
+
+    //join against a real table, and see changes to the data without re-registering.
+    apop_table_exists("lookup", 'd');
+    apop_query("create table lookup(id, label); insert into lookup values(3, 'three'); insert into lookup values(5, 'five')");
+    assert(apop_query_to_float("select sum(x) from lookup join live using(id)") == .8);
+    apop_data_set(d, 5, 0, 100);
+    assert(apop_query_to_float("select sum(x) from lookup join live using(id)") == 100.3);
+
+    apop_query("drop table live");
+    assert(!apop_table_exists("live"));
+
+    //Names are quoted, and SQL alone can't make a table of an unregistered data set.
+    assert(!apop_data_register_vtab(d, "live \"set\""));
+    assert(apop_query_to_float("select count(*) from \"live \"\"set\"\"\"") == 1000);
+    int verbosity = apop_opts.verbose;
+    apop_opts.verbose = -1;
+    assert(apop_query("create virtual table temp.rogue using apop_data(%i)", 1<<30));
+    apop_opts.verbose = verbosity;
+    apop_query("drop table \"live \"\"set\"\"\"");
+    apop_data_free(d);
+}
+
+void test_query_bind(){
+    if (apop_opts.db_engine == 'm') return; //SQLite only.
+    apop_table_exists("bound", 'd');
+    apop_query("create table bound(a, b, name)");
+    for (int i=0; i< 200; i++) //far more than the cache holds, but all one query.
+        assert(!apop_query_bind("insert into bound values(?, ?, 'v')", .values=(double[]){i, i%2 ? NAN : 2*i}));
+    assert(apop_query_to_float("select count(*) from bound where b is null") == 100);
+    assert(apop_query_to_float("select sum(a) from bound") == 199*100);
+
+    apop_data *d = apop_text_alloc(apop_data_alloc(3, 1), 3, 1);
+    apop_data_fill(d, 7, 8, 9);
+    apop_text_fill(d, "x", "", "z");
+    for (int i=0; i< 3; i++) assert(!apop_query_bind("insert into bound values(?, 0, ?)", .data=d, .row=i));
+    assert(apop_query_to_float("select count(*) from bound where name is null") == 1);
+    assert(apop_query_to_float("select a from bound where name='z'") == 9);
+
+    //Same query, different spacing and comments: a cache hit, same answer.
+    apop_data *out = apop_query_to_data_bind("select a, b from bound where a < ? -- small ones\n order by a", .values=(double[]){3});
+    apop_data *again = apop_query_to_data_bind("select a,  b from bound\n where a < ? order by a;", .values=(double[]){5});
+    assert(out->matrix->size1 == 3 && again->matrix->size1 == 5);
+    assert(apop_data_get(out, 2, 0) == 2 && apop_data_get(out, 2, 1) == 4);
+    assert(isnan(apop_data_get(again, 3, 1)));
+    assert(!apop_query_to_data_bind("select a from bound where a > ?", .values=(double[]){1e6}));
+
+    //errors: wrong element count, several statements, bad SQL.
+    int v = apop_opts.verbose; apop_opts.verbose = -1;
+    assert(apop_query_bind("insert into bound values(?, ?, ?)", .data=d));
+    assert(apop_query_bind("select ?; select ?", .values=(double[]){1, 2}));
+    apop_data *bad = apop_query_to_data_bind("select ? from nowhere", .values=(double[]){1});
+    assert(bad->error == 'q');
+    apop_opts.verbose = v;
+
+    //apop_query still runs several statements at once.
+    assert(!apop_query("insert into bound values(-1, 0, 'a'); insert into bound values(-2, 0, 'b')"));
+    assert(apop_query_to_float("select count(*) from bound where a < 0") == 2);
+    apop_data_free(d); apop_data_free(out); apop_data_free(again); apop_data_free(bad);
+}
+
+//Numbers headed for numeric columns are bound as numbers; everything else goes in as
+//the text it was. Either way, SQLite should store what it would have made of the text.
+void test_typed_text_import(){
+    if (apop_opts.db_engine == 'm') return; //typeof is SQLite's.
+    FILE *f = fopen("typed_import", "w");
+    fprintf(f, "id, num, big, word\n"
+               "007, 3.0, 9223372036854775807, 12\n"
+               ".5, 1e400, 12345678901234567890, abc\n"
+               "x, 0x10, , NaN\n");
+    fclose(f);
+    apop_table_exists("typed", 'd');
+    apop_text_to_db("typed_import", "typed", .field_params=
+            apop_text_fill(apop_text_alloc(NULL, 1, 2), "id|word", "text"));
+    apop_data *t = apop_query_to_text("select typeof(id), id, typeof(num), num, typeof(big), big, typeof(word) from typed");
+    char *expected[3][7] = {{"text", "007", "integer", "3", "integer", "9223372036854775807", "text"},
+                            {"text", "0.5", "real", "Inf", "real", NULL, "text"},
+                            {"text", "x", "text", "0x10", "null", NULL, "null"}};
+    for (int i=0; i< 3; i++)
+        for (int j=0; j< 7; j++)
+            if (expected[i][j]) assert(!strcasecmp(t->text[i][j], expected[i][j]));
+    apop_data_free(t);
+    unlink("typed_import");
+}
+
+//Batched transactions, temporary pragmas, and indexes built after the load.
+void test_bulk_load(){
+    apop_table_exists("bulk", 'd');
+    apop_table_exists("bulk2", 'd');
+    int rows = apop_text_to_db( DATADIR "/" "test_data" , "bulk", .load=&(apop_db_load_type){
+            .rows_per_commit=3, .synchronous="off", .cache_size=-1000, .indexes=(char*[]){"a", "b, c", NULL}});
+    assert(rows > 0);
+    assert(apop_query_to_float("select count(*) from bulk") == 4);
+    apop_opts.db_load = (apop_db_load_type){.rows_per_commit=3, .indexes=(char*[]){"a", NULL}};
+    apop_data *d = apop_query_to_data("select * from bulk");
+    apop_data_print(d, "bulk2", .output_type='d');
+    apop_opts.db_load = (apop_db_load_type){.rows_per_commit=0};
+    assert(apop_query_to_float("select count(*) from bulk2") == 4);
+    apop_data_free(d);
+    if (apop_opts.db_engine == 'm') return;
+    double synch = apop_query_to_float("pragma synchronous"), cache = apop_query_to_float("pragma cache_size");
+    apop_table_exists("bulk", 'd');
+    apop_text_to_db( DATADIR "/" "test_data" , "bulk", .load=&(apop_db_load_type){
+            .rows_per_commit=3, .synchronous="off", .cache_size=-1000, .indexes=(char*[]){"a", "b, c", NULL}});
+    assert(apop_query_to_float("pragma synchronous") == synch);
+    assert(apop_query_to_float("pragma cache_size") == cache);
+    assert(apop_query_to_float("select count(*) from sqlite_master where type='index' and tbl_name='bulk'") == 2);
+    assert(apop_query_to_float("select count(*) from sqlite_master where type='index' and tbl_name='bulk2'") == 1);
+
+    //Inside the user's transaction, the load neither commits nor touches the pragmas.
+    apop_table_exists("bulk", 'd');
+    apop_query("begin");
+    int verbosity = apop_opts.verbose;
+    apop_opts.verbose = -1;
+    apop_text_to_db( DATADIR "/" "test_data" , "bulk", .load=&(apop_db_load_type){.rows_per_commit=3, .synchronous="off"});
+    apop_opts.verbose = verbosity;
+    assert(apop_query_to_float("pragma synchronous") == synch);
+    apop_query("rollback");
+    assert(!apop_table_exists("bulk"));
+
+    //A failed load rolls back the batch in progress; the committed batches stay.
+    FILE *f = fopen("bulk_fail_test", "w");
+    fprintf(f, "a\n1\n2\n3\n4\n5\n6\n7\n999\n9\n");
+    fclose(f);
+    apop_table_exists("bulkfail", 'd');
+    apop_query("create table bulkfail(a integer check (a < 100))");
+    apop_opts.verbose = -1;
+    rows = apop_text_to_db("bulk_fail_test", "bulkfail", .if_table_exists='a',
+                .load=&(apop_db_load_type){.rows_per_commit=3, .indexes=(char*[]){"a", NULL}});
+    apop_opts.verbose = verbosity;
+    assert(rows == -1);
+    assert(apop_query_to_float("select count(*) from bulkfail") == 6);
+    assert(apop_query_to_float("select count(*) from sqlite_master where type='index' and tbl_name='bulkfail'") == 0);
+    remove("bulk_fail_test");
+}
+
+//More rows than fit in one multi-row insert, with every part of the data set and some NULLs.
+void test_batched_data_to_db(){
+    int rows = 1234;
+    apop_table_exists("batched", 'd');
+    apop_data *d = apop_data_alloc(rows, rows, 3);
+    apop_text_alloc(d, rows, 2);
+    d->weights = gsl_vector_alloc(rows);
+    for (int i=0; i< rows; i++){
+        apop_name_add(d->names, (char[]){'r', 'a'+i%26, '\0'}, 'r');
+        apop_data_set(d, i, -1, i);
+        for (int j=0; j< 3; j++) apop_data_set(d, i, j, (i%7==j) ? NAN : i*10.+j);
+        apop_text_set(d, i, 0, "t%i", i);
+        apop_text_set(d, i, 1, "%s", i%5 ? "x" : "");
+        gsl_vector_set(d->weights, i, i/2.);
+    }
+    apop_data_print(d, "batched", .output_type='d');
+    assert(apop_query_to_float("select count(*) from batched") == rows);
+    apop_data *d2 = apop_query_to_mixed_data("nvmmmttw", "select * from batched order by vector");
+    for (int i=0; i< rows; i++){
+        assert(!strcmp(d->names->row[i], d2->names->row[i]));
+        assert(apop_data_get(d2, i, -1) == i);
+        for (int j=0; j< 3; j++)
+            if (i%7==j) assert(isnan(apop_data_get(d2, i, j)));
+            else assert(apop_data_get(d2, i, j) == i*10.+j);
+        assert(!strcmp(d->text[i][0], d2->text[i][0]));
+        assert(!strcmp(d2->text[i][1], i%5 ? "x" : apop_opts.nan_string));
+        assert(gsl_vector_get(d2->weights, i) == i/2.);
+    }
+    apop_data_free(d2);
+    if (apop_opts.db_engine != 'm'){ //the rows go into a transaction the user has open.
+        apop_query("begin");
+        apop_data_print(d, "batched", .output_type='d', .output_append='a');
+        assert(apop_query_to_float("select count(*) from batched") == 2*rows);
+        apop_query("rollback");
+        assert(apop_query_to_float("select count(*) from batched") == rows);
+    }
+    apop_data_free(d);
+}
+
+//With two threads, apop_text_to_db parses on one and inserts on the other. The table
+//should be the same as a one-thread read, row for row.
+void test_pipelined_text_to_db(){
+#ifdef _OPENMP
+    FILE *f = fopen("pipeline_test", "w");
+    fprintf(f, "id, x, name\n");
+    for (int i=0; i< 20000; i++)
+        fprintf(f, i%7 ? "%i, %g, \"row %i\"\n" : "%i, %g, row %i # comment\n\n", i, i/3., i);
+    fclose(f);
+    apop_table_exists("serial_load", 'd');
+    apop_table_exists("pipeline_load", 'd');
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    int serial_rows = apop_text_to_db("pipeline_test", "serial_load");
+    omp_set_num_threads(2);
+    int pipeline_rows = apop_text_to_db("pipeline_test", "pipeline_load");
+    omp_set_num_threads(threads);
+    assert(serial_rows == pipeline_rows);
+    assert(apop_query_to_float("select count(*) from pipeline_load") == 20000);
+    assert(!apop_query_to_float("select count(*) from serial_load s, pipeline_load p "
+                                "where s.rowid = p.rowid and (s.id != p.id or s.x != p.x or s.name != p.name)"));
+    unlink("pipeline_test");
+#endif
+}
+
+//A gzipped file should read the same as the plain one. Skipped if there's no gzip
+//utility, or if the library was built without zlib.
+void test_compressed_text(){
+    FILE *f = fopen("compressed_test", "w");
+    fprintf(f, "id, x, name\n");
+    for (int i=0; i< 30000; i++) fprintf(f, "%i, %g, \"row %i\"\n", i, i/3., i);
+    fclose(f);
+    if (apop_system("gzip -c compressed_test > compressed_test.gz")) {unlink("compressed_test"); return;}
+    int verbosity = apop_opts.verbose;
+    apop_opts.verbose = -1;
+    apop_data *plain = apop_text_to_data("compressed_test");
+    apop_data *unzipped = apop_text_to_data("compressed_test.gz");
+    apop_opts.verbose = verbosity;
+    if (!unzipped->error){
+        assert(unzipped->matrix->size1 == 30000);
+        for (int i=0; i< 30000; i++)
+            for (int j=0; j< 2; j++)
+                assert(apop_data_get(unzipped, i, j) == apop_data_get(plain, i, j));
+        apop_table_exists("compressed_load", 'd');
+        assert(apop_text_to_db("compressed_test.gz", "compressed_load") == 30001);
+        assert(apop_query_to_float("select count(*) from compressed_load where name = 'row '||id") == 30000);
+    }
+    apop_data_free(plain);
+    apop_data_free(unzipped);
+    unlink("compressed_test");
+    unlink("compressed_test.gz");
+}
+
 #include <sys/wait.h> 
 static void test_printing(){
     //This compares printed output to the printed output in the attached file. 
@@ -239,6 +860,18 @@ void test_crosstabbing() {
     assert(apop_data_get(d, .rowname="A", "G")==5);
     assert(apop_data_get(d, .rowname="C", "G")==1);
 
+    apop_data *sp = apop_db_to_crosstab("snp_ct", "a_allele", "b_allele", "ct", .sparse='y');
+    assert(sp->textsize[0] == apop_query_to_float("select count(*) from snp_ct"));
+    assert(!sp->matrix && !strcmp(sp->names->text[1], "b_allele"));
+    double total = 0;
+    for (int i=0; i< sp->textsize[0]; i++){
+        assert(apop_data_get(d, .rowname=sp->text[i][0], .colname=sp->text[i][1]) == gsl_vector_get(sp->weights, i));
+        total += gsl_vector_get(sp->weights, i);
+    }
+    assert(total == apop_query_to_float("select count(*) from snps"));
+    apop_data_free(sp);
+    apop_data_free(d);
+
     apop_data *ct = apop_text_alloc(apop_data_alloc(3,1),3,1);
     apop_data_set(ct, 0, 0, 1); apop_text_set(ct, 0, 0, "first");
     apop_data_set(ct, 1, 0, 2); apop_text_set(ct, 1, 0, "second");
@@ -262,6 +895,22 @@ int main(){
     do_test("db_to_text", db_to_text());
     do_test("test queries returning empty tables", test_blank_db_queries());
     do_test("NaN handling", test_nan_data());
+    do_test("typed query output", test_query_types());
+    do_test("typed mixed query output", test_mixed_query_types());
+    do_test("text arenas", test_text_arena());
+    do_test("factor columns in query output", test_factor_query());
+    do_test("query cursor", test_query_cursor());
+    do_test("moment aggregates", test_moment_aggregates());
+    do_test("quantile aggregates", test_quantiles());
+    do_test("data sets as virtual tables", test_data_vtab());
+    if (apop_opts.db_engine != 'm') do_test("per-thread database handles", test_db_handles());
+    if (apop_opts.db_engine != 'm') do_test("closing with cached statements", test_close_with_cached_statements());
+    do_test("bound queries", test_query_bind());
+    do_test("typed text import", test_typed_text_import());
+    do_test("bulk loading", test_bulk_load());
+    do_test("batched data to db", test_batched_data_to_db());
+    do_test("pipelined text to db", test_pipelined_text_to_db());
+    do_test("compressed text", test_compressed_text());
     do_test("test printing", test_printing());
     do_test("test db to crosstab", test_crosstabbing());
     apop_db_close();
@@ -38,6 +38,7 @@ post-install tests.  */
 
 #ifdef _OPENMP
 #include <omp.h>
+#include <locale.h>
 #endif
 
 #ifdef FULL_TOLERANCE
@@ -814,6 +815,69 @@ void test_rownames(){
     assert(*zeroone == 10);
 }
 
+//Long lists of names are searched via a hash table, which has to keep up with the list.
+void test_many_rownames(){
+    int n = 1000;
+    apop_data *d = apop_data_alloc(n, 1);
+    char name[20];
+    for (int i=0; i< n; i++){
+        sprintf(name, "Row%i", i);
+        apop_name_add(d->names, name, 'r');
+        apop_data_set(d, i, 0, i);
+    }
+    for (int i=0; i< n; i+=7){
+        sprintf(name, "ROW%i", i);
+        assert(apop_name_find(d->names, name, 'r') == i);
+        assert(apop_data_get(d, .rowname=name) == i);
+    }
+    assert(apop_name_find(d->names, "row1000", 'r') == -2);
+    apop_name_add(d->names, "Row5", 'r'); //a duplicate: find the first.
+    apop_name_add(d->names, "row5", 'r'); //but an exact match beats a match up to case.
+    assert(apop_name_find(d->names, "Row5", 'r') == 5);
+    assert(apop_name_find(d->names, "row5", 'r') == 1001);
+    assert(apop_name_find(d->names, "ROW5", 'r') == 5);
+
+    free(d->names->row[3]); //written in place, behind the index's back.
+    d->names->row[3] = strdup("renamed");
+    assert(apop_name_find(d->names, "renamed", 'r') == 3);
+    assert(apop_name_find(d->names, "row3", 'r') == -2);
+
+    //Many threads searching at once; the index doesn't know these renames, so those go to the full scan.
+    free(d->names->row[7]);
+    d->names->row[7] = strdup("renamed again");
+    int misses = 0;
+    #pragma omp parallel for reduction(+:misses)
+    for (int i=0; i< 20000; i++){
+        int want = i%n;
+        char findme[20];
+        if (want == 3 || want == 7) sprintf(findme, want == 3 ? "renamed" : "renamed again");
+        else sprintf(findme, "Row%i", want);
+        misses += apop_name_find(d->names, findme, 'r') != want;
+    }
+    assert(!misses);
+    free(d->names->row[--d->names->rowct]);
+    free(d->names->row[--d->names->rowct]);
+
+    apop_data_sort(d, .asc='d');
+    assert(apop_name_find(d->names, "row999", 'r') == 0);
+    assert(apop_data_get(d, .rowname="row17") == 17);
+
+    int drop[n];
+    for (int i=0; i< n; i++) drop[i] = (i%2 == 0);
+    apop_data_rm_rows(d, drop);
+    assert(apop_name_find(d->names, "row998", 'r') == 0);
+    assert(apop_data_get(d, .rowname="row18") == 18);
+
+    apop_data *t = apop_data_transpose(d, .inplace='n');
+    assert(apop_name_find(t->names, "row18", 'c') == 490);
+    assert(apop_name_find(t->names, "row18", 'r') == -2);
+    apop_data_transpose(d);
+    assert(apop_name_find(d->names, "row18", 'c') == 490);
+    assert(apop_name_find(d->names, "row18", 'r') == -2);
+    apop_data_free(t);
+    apop_data_free(d);
+}
+
 int get_factor_index(apop_data *flist, char *findme){
     for (int i=0; i< flist->textsize[0]; i++)
         if (apop_strcmp(flist->text[i][0], findme))
@@ -884,6 +948,197 @@ void test_transpose(){
     assert(!strcmp(t->names->row[2], "c"));
     assert(!strcmp(t->names->row[3], "d"));
     assert(!t->names->colct);
+    assert(apop_name_find(t->names, "c", 'r') == 2);
+    apop_name_add(t->names, "e", 'r');
+    assert(apop_name_find(t->names, "e", 'r') == 4);
+}
+
+//The threaded reader should give the same thing as a one-thread read, even with
+//quoted newlines, escapes, and comments that could fool the line splitter.
+void test_parallel_text_read(){
+#ifdef _OPENMP
+    char *fname = "parallel_read_test";
+    FILE *f = fopen(fname, "w");
+    fprintf(f, "# a comment\nrow, one, two, three\n");
+    for (int i=0; i< 60000; i++)
+        fprintf(f, i%3==0 ? "\"r%i, a long name with a quoted\nline break\", %i, %g, %i\n"
+                 : i%3==1 ? "r%i: a long name with an escaped\\\nline break, %i,,%g # comment, \"with a quote\n"
+                          : "r%i, %i, \"%g\", %i\n\n", i, i, i/7., -i);
+    fclose(f);
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    apop_data *serial = apop_text_to_data(fname, .has_row_names='y');
+    omp_set_num_threads(7);
+    apop_data *parallel = apop_text_to_data(fname, .has_row_names='y');
+    omp_set_num_threads(threads);
+    assert(serial->matrix->size1 == 60000);
+    assert(parallel->matrix->size1 == serial->matrix->size1);
+    assert(parallel->names->rowct == serial->names->rowct);
+    for (int i=0; i< serial->matrix->size1; i++){
+        assert(!strcmp(parallel->names->row[i], serial->names->row[i]));
+        for (int j=0; j< serial->matrix->size2; j++){
+            double s = apop_data_get(serial, i, j), p = apop_data_get(parallel, i, j);
+            assert((isnan(s) && isnan(p)) || s == p);
+        }
+    }
+    apop_data_free(serial);
+    apop_data_free(parallel);
+    remove(fname);
+#endif
+}
+
+//The reader parses numbers itself; check it against strtod, including the
+//halfway cases and the far ends of the range.
+void test_number_parsing(gsl_rng *r){
+    char *fname = "number_parsing_test";
+    char *fixed[] = {".5", "-.25e2", "1e-320", "4.9406564584124654e-324", "1.7976931348623157e308",
+                     "1e400", "-inf", "Infinity", "9007199254740993", "2.2250738585072011e-308",
+                     "0.1000000000000000055511151231257827", "12abc", "0x10"};
+    int fixed_ct = sizeof(fixed)/sizeof(char*), rows = 2000;
+    char text[rows][40];
+    FILE *f = fopen(fname, "w");
+    fprintf(f, "x\n");
+    for (int i=0; i< rows; i++){
+        if (i < fixed_ct) snprintf(text[i], 40, "%s", fixed[i]);
+        else {
+            double x = (gsl_rng_uniform(r)-0.5) * pow(10, gsl_rng_uniform_int(r, 600) - 300.);
+            snprintf(text[i], 40, "%.*g", (int)gsl_rng_uniform_int(r, 17)+1, x);
+        }
+        fprintf(f, "%s\n", text[i]);
+    }
+    fprintf(f, "Missing\n");
+    fclose(f);
+    char *nan_string = apop_opts.nan_string;
+    apop_opts.nan_string = "missing";
+    apop_data *d = apop_text_to_data(fname, .has_col_names='y');
+    apop_opts.nan_string = nan_string;
+    assert(d->matrix->size1 == rows+1);
+    for (int i=0; i< rows; i++)
+        assert(apop_data_get(d, i) == strtod(text[i], NULL));
+    assert(isnan(apop_data_get(d, rows)));
+    apop_data_free(d);
+
+    //The forms the reader hands off to the system still take a period as the decimal point.
+    if (setlocale(LC_NUMERIC, "de_DE.UTF-8")){
+        f = fopen(fname, "w");
+        fprintf(f, "x\n0x1.8p1\n1.2345678901234567890123\n-2.50000000000000000000001\nnan(1)\n");
+        fclose(f);
+        d = apop_text_to_data(fname, .has_col_names='y');
+        setlocale(LC_NUMERIC, "C");
+        assert(apop_data_get(d, 0) == 3 && apop_data_get(d, 1) == strtod("1.2345678901234567890123", NULL)
+                && apop_data_get(d, 2) == -2.5 && isnan(apop_data_get(d, 3)));
+        apop_data_free(d);
+    }
+    remove(fname);
+}
+
+/* The reader skips over runs of plain text 16 or 32 bytes at a time where it can. Put
+   each kind of byte that ends a run on either side of those chunk boundaries, and check
+   that the reader gets what it gets when checking one byte at a time. */
+void test_scan_boundaries(){
+    char *fname = "scan_boundary_test";
+    char *specials[] = {",", "\"q,\"", "\\,", "#c", "\xc3\xa9", " ", "\"\\\"\""};
+    int special_ct = sizeof(specials)/sizeof(char*), first = 8, last = 72;
+    FILE *f = fopen(fname, "w");
+    fprintf(f, "a,b,c\n");
+    for (int k=0; k< special_ct; k++)
+        for (int posn=first; posn < last; posn++){
+            for (int i=0; i< posn; i++) fputc('a' + (i+posn)%26, f);
+            fprintf(f, "%s%.*s,x\n", specials[k], posn%37, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijk");
+        }
+    fclose(f);
+    apop_data *read[2];
+    for (int scalar=0; scalar< 2; scalar++){
+        if (scalar) setenv("APOP_SCALAR_SCAN", "1", 1);
+        apop_text_to_db(fname, "scan_test", .if_table_exists='o');
+        unsetenv("APOP_SCALAR_SCAN");
+        read[scalar] = apop_query_to_text("select * from scan_test");
+    }
+    assert(read[0]->textsize[0] == special_ct*(last-first));
+    assert(read[1]->textsize[0] == read[0]->textsize[0] && read[1]->textsize[1] == read[0]->textsize[1]);
+    for (int i=0; i< read[0]->textsize[0]; i++)
+        for (int j=0; j< read[0]->textsize[1]; j++)
+            assert(!strcmp(read[0]->text[i][j], read[1]->text[i][j]));
+    char *utf8_row = read[0]->text[4*(last-first) + 33-first][0]; //the UTF-8 byte pair right after byte 33.
+    assert(strlen(utf8_row) > 34 && !strncmp(utf8_row+33, "\xc3\xa9", 2));
+    assert(!strcmp(read[0]->text[32-first][1], "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"));
+    apop_data_free(read[0]);
+    apop_data_free(read[1]);
+    remove(fname);
+}
+
+//Reading a file in blocks should give the same rows as reading it at once.
+void test_text_stream(){
+    char *fname = "text_stream_test";
+    FILE *f = fopen(fname, "w");
+    fprintf(f, "one, two\n");
+    for (int i=0; i< 2500; i++)
+        fprintf(f, i%10 ? "r%i, %i, %g\n" : "\nr%i, %i, %g # with a comment\n", i, i, i/7.);
+    fclose(f);
+    apop_data *whole = apop_text_to_data(fname, .has_row_names='y');
+    apop_text_stream *s = apop_text_stream_open(fname, .has_row_names='y');
+    int row = 0, blocks = 0;
+    apop_data *kept = NULL;
+    for (apop_data *block; (block = apop_text_stream_next(s, 1000)); blocks++){
+        if (!blocks) kept = apop_data_share(block); //the next call must not overwrite this.
+        assert(!block->error);
+        assert(!strcmp(block->names->col[1], "two"));
+        assert(block->names->rowct == block->matrix->size1);
+        for (int i=0; i< block->matrix->size1; i++, row++){
+            assert(!strcmp(block->names->row[i], whole->names->row[row]));
+            for (int j=0; j< 2; j++)
+                assert(apop_data_get(block, i, j) == apop_data_get(whole, row, j));
+        }
+    }
+    assert(blocks == 3 && row == 2500);
+    for (int i=0; i< 1000; i++)
+        assert(apop_data_get(kept, i, 1) == apop_data_get(whole, i, 1)
+                && !strcmp(kept->names->row[i], whole->names->row[i]));
+    apop_data_free(kept);
+    assert(!apop_text_stream_next(s, 1000));
+    apop_text_stream_close(s);
+    apop_data_free(whole);
+
+    //A row with too many fields stops the stream where it stops apop_text_to_data.
+    f = fopen(fname, "w");
+    fprintf(f, "one, two\nr0, 0, 0\nr1, 1, 1\nr2, 2, 2, 2\nr3, 3, 3\n");
+    fclose(f);
+    int verbosity = apop_opts.verbose;
+    apop_opts.verbose = -1;
+    whole = apop_text_to_data(fname, .has_row_names='y');
+    s = apop_text_stream_open(fname, .has_row_names='y');
+    apop_data *block = apop_text_stream_next(s, 1000);
+    apop_opts.verbose = verbosity;
+    assert(whole->error == 't' && block->error == 't');
+    assert(block->matrix->size1 == 2 && block->names->rowct == whole->names->rowct);
+    for (int i=0; i< block->names->rowct; i++)
+        assert(!strcmp(block->names->row[i], whole->names->row[i]));
+    assert(apop_data_get(block, 1, 1) == 1);
+    assert(!apop_text_stream_next(s, 1000));
+    apop_text_stream_close(s);
+    apop_data_free(whole);
+    remove(fname);
+}
+
+//Fixed-width lines that straddle the reader's buffer boundaries, with a trailing
+//field past the last given field end.
+void test_fixed_width_read(){
+    char *fname = "fixed_width_test";
+    FILE *f = fopen(fname, "w");
+    for (int i=0; i< 20000; i++)
+        fprintf(f, "%05i%8.2f%3i%*i\n", i, i/4., i%7, 1+i%9, i%1000);
+    fclose(f);
+    apop_data *d = apop_text_to_data(fname, .has_col_names='n', .field_ends=(int[]){5, 13, 16, 0});
+    assert(d->matrix->size1 == 20000);
+    assert(d->matrix->size2 == 4);
+    for (int i=0; i< 20000; i++){
+        assert(apop_data_get(d, i, 0) == i);
+        assert(apop_data_get(d, i, 1) == i/4.);
+        assert(apop_data_get(d, i, 2) == i%7);
+        assert(apop_data_get(d, i, 3) == i%1000);
+    }
+    apop_data_free(d);
+    remove(fname);
 }
 
 apop_data *generate_probit_logit_sample (gsl_vector* true_params, gsl_rng *r, apop_model *method){
@@ -986,6 +1241,126 @@ void test_resize(){
     assert(apop_vector_sum(v) == 45);
 }
 
+//Appending rows one at a time should reallocate only as the reserved room doubles.
+void test_reserve(){
+    apop_data *d = apop_data_alloc(1, 1, 3);
+    d->weights = gsl_vector_alloc(1);
+    apop_data *row = apop_data_alloc(1, 1, 3);
+    row->weights = gsl_vector_alloc(1);
+    for (int i=0; i< 2000; i++){
+        apop_data_fill(row, i, i, 2*i, 3*i);
+        gsl_vector_set(row->weights, 0, -i);
+        if (!i) apop_data_memcpy(d, row);
+        else    apop_data_stack(d, row, 'r', .inplace='y');
+    }
+    assert(d->matrix->size1 == 2000 && d->vector->size == 2000 && d->weights->size == 2000);
+    //the reserved room is not in the blocks, which the GSL sees as usual.
+    assert(d->matrix->block->size == 2000*3 && d->vector->block->size == 2000 && d->weights->block->size == 2000);
+    gsl_vector *packed = apop_data_pack(d);
+    assert(packed->size == 2000*5 && gsl_vector_get(packed, 1999) == 1999);
+    gsl_vector_free(packed);
+    for (int i=0; i< 2000; i++)
+        assert(apop_data_get(d, i, -1) == i && apop_data_get(d, i, 2) == 3*i
+                && gsl_vector_get(d->weights, i) == -i);
+    gsl_matrix_view sub = gsl_matrix_submatrix(d->matrix, 1000, 1, 3, 2);
+    assert(gsl_matrix_get(&sub.matrix, 2, 1) == 3*1002);
+    assert(apop_data_get(Apop_r(d, 1999), 0, 0) == 1999);
+
+    apop_data_shrink_to_fit(d);
+    assert(d->matrix->block->size == 2000*3 && d->vector->block->size == 2000 && d->weights->block->size == 2000);
+    apop_data_reserve(d, 5000);
+    assert(d->matrix->block->size == 2000*3 && d->matrix->size1 == 2000 && d->vector->size == 2000);
+    double *before = d->matrix->data;
+    apop_matrix_realloc(d->matrix, 4500, 3);
+    apop_vector_realloc(d->vector, 4500);
+    assert(d->matrix->data == before && apop_data_get(d, 1999, 1) == 2*1999 && apop_data_get(d, 1999, -1) == 1999);
+    assert(d->matrix->block->size == 4500*3 && d->vector->block->size == 4500);
+    apop_matrix_realloc(d->matrix, 10, 3); //shrinking releases the room.
+    assert(d->matrix->block->size == 30 && apop_data_get(d, 9, 1) == 18);
+    gsl_matrix *copy = gsl_matrix_alloc(10, 3);
+    assert(!gsl_matrix_memcpy(copy, d->matrix) && gsl_matrix_get(copy, 9, 2) == 27);
+    gsl_matrix_free(copy);
+    apop_data_free(row);
+    apop_data_free(d);
+}
+
+//A shared set and its original should share storage until one writes, then part ways.
+void test_data_share(){
+    apop_data *d = apop_data_alloc(5, 5, 2);
+    d->weights = gsl_vector_alloc(5);
+    apop_text_alloc(d, 5, 1);
+    for (int i=0; i< 5; i++){
+        apop_data_fill(Apop_r(d, i), i, 10*i, 20*i);
+        gsl_vector_set(d->weights, i, -i);
+        apop_text_set(d, i, 0, "row %i", i);
+        char name[10];
+        sprintf(name, "r%i", i);
+        apop_name_add(d->names, name, 'r');
+    }
+    apop_name_add(d->names, "c0", 'c');
+    apop_data_add_page(d, apop_data_alloc(2), "second");
+    apop_data_set(d->more, 1, .val=7);
+
+    apop_data *s = apop_data_share(d);
+    assert(s->matrix->data == d->matrix->data && s->vector->data == d->vector->data);
+    assert(s->text == d->text && s->names->row == d->names->row);
+    assert(s->more->vector->data == d->more->vector->data);
+    assert(apop_data_get(s, .rowname="r3", .col=1) == 60);
+
+    apop_data_set(s, 2, 0, -1);
+    assert(s->matrix->data != d->matrix->data && s->vector->data == d->vector->data);
+    assert(apop_data_get(d, 2, 0) == 20 && apop_data_get(s, 2, 0) == -1 && apop_data_get(s, 3, 0) == 30);
+    apop_text_set(s, 1, 0, "changed");
+    assert(!strcmp(d->text[1][0], "row 1") && !strcmp(s->text[1][0], "changed")
+            && !strcmp(s->text[4][0], "row 4"));
+    apop_name_add(d->names, "r5", 'r');
+    assert(d->names->rowct == 6 && s->names->rowct == 5 && !strcmp(s->names->row[4], "r4"));
+
+    apop_data *s2 = apop_data_share(s);
+    apop_data_make_writable(s2);
+    assert(s2->vector->data != d->vector->data && s2->weights->data != s->weights->data
+            && s2->more->vector->data != d->more->vector->data);
+    assert(gsl_vector_get(s2->weights, 4) == -4 && apop_data_get(s2->more, 1) == 7);
+    apop_data_free(s2);
+
+    //The original still owns its parts, so it can be resized, taking its own copy first.
+    assert(d->vector->owner && d->weights->owner && d->vector->data == s->vector->data);
+    apop_vector_reserve(d->vector, 100);
+    apop_vector_realloc(d->weights, 6);
+    assert(d->vector->data != s->vector->data && d->weights->data != s->weights->data);
+    assert(d->weights->size == 6 && s->weights->size == 5 && gsl_vector_get(d->weights, 4) == -4
+            && gsl_vector_get(s->vector, 4) == 4 && gsl_vector_get(d->vector, 4) == 4);
+    gsl_vector_set(d->vector, 4, 40); //via the GSL, now that d has its own copy.
+    assert(gsl_vector_get(s->vector, 4) == 4);
+    apop_vector_realloc(d->weights, 5);
+
+    //freeing the original first leaves the parts it shared with s in place.
+    apop_data_free(d);
+    assert(apop_data_get(s, 4, -1) == 4 && apop_data_get(s->more, 1) == 7
+            && !strcmp(s->text[4][0], "row 4") && !strcmp(s->names->row[0], "r0"));
+    //s is now the only holder, so making it writable takes ownership without a copy.
+    double *was = s->vector->data;
+    apop_data_make_writable(s);
+    assert(s->vector->owner && s->vector->data == was);
+    apop_vector_realloc(s->vector, 6);
+    assert(apop_data_get(s, 4, -1) == 4);
+    apop_data_free(s);
+
+    //dummies appended in place replace the names and matrix of the shared set only.
+    apop_data *f = apop_data_alloc(0, 6, 3);
+    for (int i=0; i< 6; i++) apop_data_fill(Apop_r(f, i), i, i%3, -i);
+    apop_data_add_names(f, 'c', "c0", "c1", "c2");
+    apop_data *fs = apop_data_share(f);
+    apop_data_to_dummies(fs, .col=1, .type='d', .append='i');
+    assert(fs->matrix->size2 == 5 && fs->names->colct == 5);
+    assert(!strcmp(fs->names->col[0], "c0") && !strcmp(fs->names->col[4], "c2")
+            && apop_data_get(fs, 5, 4) == -5 && apop_data_get(fs, 5, 3) == 1);
+    assert(f->matrix->size2 == 3 && f->names->colct == 3 && !strcmp(f->names->col[2], "c2")
+            && apop_data_get(f, 5, 1) == 2);
+    apop_data_free(f);
+    apop_data_free(fs);
+}
+
 void test_mvn_gamma(){
     assert(apop_multivariate_gamma(10, 1)==gsl_sf_gamma(10));
     assert(apop_multivariate_lngamma(10, 1)==gsl_sf_lngamma(10));
@@ -1231,6 +1606,7 @@ int main(int argc, char **argv){
     do_test("vtables", test_vtables());
     do_test("test listwise delete", test_listwise_delete());
     do_test("rownames", test_rownames());
+    do_test("many rownames", test_many_rownames());
     do_test("apop_dot", test_dot());
     do_test("apop_jackknife", test_jackknife(r));
     do_test("test multivariate_normal", test_multivariate_normal());
@@ -1251,6 +1627,8 @@ int main(int argc, char **argv){
     do_test("test binomial estimations", test_binomial(r));
     do_test("dummies and factors", dummies_and_factors());
     do_test("test vector/matrix realloc", test_resize());
+    do_test("reserved room for rows", test_reserve());
+    do_test("copy-on-write sharing", test_data_share());
     do_test("test_vector_moving_average", test_vector_moving_average());
     do_test("apop_estimate->dependent test", test_predicted_and_residual(e));
     do_test("OLS test", test_OLS(r));
@@ -1262,6 +1640,11 @@ int main(int argc, char **argv){
     do_test("apop_matrix_summarize", test_summarize());
     do_test("apop_linear_constraint", test_linear_constraint());
     do_test("transposition", test_transpose());
+    do_test("threaded text reading", test_parallel_text_read());
+    do_test("number parsing", test_number_parsing(r));
+    do_test("text streaming", test_text_stream());
+    do_test("SIMD scanning across chunk boundaries", test_scan_boundaries());
+    do_test("fixed-width text reading", test_fixed_width_read());
     do_test("test unique elements", test_unique_elements());
     if (slow_tests){
         if (verbose) printf("\tSlower tests:\n");
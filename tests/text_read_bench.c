@@ -0,0 +1,61 @@
+/* Throughput of the text readers, in megabytes per second.
+
+This is not part of 'make check'; build it with 'make text_read_bench'. It writes a
+file in the style of test_data---a header of quoted and unquoted names, then rows of
+comma-delimited numbers, with a text column and the occasional comment---and times
+apop_text_to_data and apop_text_to_db on it. Run the same binary against different
+builds of the library to compare them.
+
+Usage: text_read_bench [-m megabytes (default 200)] [-f file to write (default ./bench_data)] [-k to keep the file]
+*/
+
+#include <apop.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static double now(){
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec/1e6;
+}
+
+static size_t write_data(char const *filename, size_t megabytes){
+    FILE *f = fopen(filename, "w");
+    Apop_stopif(!f, exit(1), 0, "Couldn't open %s for writing.", filename);
+    fprintf(f, "a, \"b\",c,\"d\",e\n");
+    size_t written = 0;
+    for (int i=0; written < megabytes*1e6; i++)
+        written += fprintf(f, i%1000 ? "%i,%g,%i,%.4f,\"label %i\"\n"
+                                     : "%i,%g,%i,%.4f,\"label %i\" #with a comment\n",
+                            i%97, i/7., -i, i*1.0001, i%13);
+    fclose(f);
+    return written;
+}
+
+int main(int argc, char **argv){
+    size_t megabytes = 200;
+    char *filename = "bench_data";
+    int keep = 0, c;
+    while ((c = getopt(argc, argv, "m:f:k")) != -1)
+        if (c == 'm')      megabytes = atoi(optarg);
+        else if (c == 'f') filename = optarg;
+        else if (c == 'k') keep = 1;
+
+    double bytes = write_data(filename, megabytes);
+    apop_opts.verbose = 0; //the text column produces a NaN warning per row.
+
+    double start = now();
+    apop_data *d = apop_text_to_data(filename);
+    double elapsed = now() - start;
+    printf("apop_text_to_data: %zu rows, %.1f MB/s\n", d->matrix->size1, bytes/1e6/elapsed);
+    apop_data_free(d);
+
+    apop_db_open(NULL);
+    start = now();
+    int rows = apop_text_to_db(filename, "bench");
+    elapsed = now() - start;
+    printf("apop_text_to_db:   %i rows, %.1f MB/s\n", rows, bytes/1e6/elapsed);
+    apop_db_close();
+
+    if (!keep) remove(filename);
+}